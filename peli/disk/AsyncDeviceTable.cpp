@@ -0,0 +1,189 @@
+// peli/disk/AsyncDeviceTable.cpp - Queued block device interface
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "AsyncDeviceTable.hpp"
+
+namespace peli::disk {
+
+int AsyncDeviceTable::Device_BlockTransfer(size_t first, size_t count,
+                                           void *buffer,
+                                           bool is_write) noexcept {
+  const DeviceInfo info = GetInfo();
+  const size_t max_transfer =
+      info.max_transfer != 0 ? info.max_transfer : count;
+  const u32 depth = info.queue_depth == 0         ? 1
+                    : info.queue_depth < MaxPipeline ? info.queue_depth
+                                                     : MaxPipeline;
+  u8 *data = static_cast<u8 *>(buffer);
+
+  BlockVector vectors[MaxPipeline];
+  BlockRequest requests[MaxPipeline];
+  u32 free_mask = (1u << depth) - 1;
+  int result = 0;
+
+  while (free_mask != (1u << depth) - 1 || (count != 0 && result == 0)) {
+    if (count != 0 && result == 0 && free_mask != 0) {
+      const u32 slot = u32(__builtin_ctz(free_mask));
+      const size_t blocks = count < max_transfer ? count : max_transfer;
+      vectors[slot] = {data, blocks * info.block_size};
+      requests[slot] = {
+          .op = is_write ? BlockOp::Write : BlockOp::Read,
+          .first = first,
+          .count = blocks,
+          .vectors = &vectors[slot],
+          .vector_count = 1,
+      };
+      if (int error = Submit(requests[slot])) {
+        result = error;
+        continue;
+      }
+
+      free_mask &= ~(1u << slot);
+      first += blocks;
+      count -= blocks;
+      data += blocks * info.block_size;
+      continue;
+    }
+
+    BlockRequest *done = Reap(true);
+    if (!done) {
+      // Nothing was actually in flight
+      break;
+    }
+    if (done->result != 0 && result == 0) {
+      result = done->result;
+    }
+    free_mask |= 1u << u32(done - requests);
+  }
+  return result;
+}
+
+void CompletionQueue::Push(BlockRequest &request) noexcept {
+  request.next = nullptr;
+  if (m_tail) {
+    m_tail->next = &request;
+  } else {
+    m_head = &request;
+  }
+  m_tail = &request;
+}
+
+BlockRequest *CompletionQueue::Pop() noexcept {
+  BlockRequest *request = m_head;
+  if (request) {
+    m_head = request->next;
+    if (!m_head) {
+      m_tail = nullptr;
+    }
+    request->next = nullptr;
+  }
+  return request;
+}
+
+int TransferVectors(const DeviceTable &table, const BlockRequest &request,
+                    size_t block_size) noexcept {
+  const bool is_write = request.op == BlockOp::Write;
+  size_t first = request.first;
+  size_t remaining = request.count;
+
+  for (u32 i = 0; i < request.vector_count && remaining != 0; i++) {
+    const BlockVector &vector = request.vectors[i];
+    size_t count = vector.size / block_size;
+    if (count > remaining) {
+      count = remaining;
+    }
+    if (count == 0) {
+      continue;
+    }
+
+    if (int error = table.m_block_transfer(table.m_object, first, count,
+                                           vector.data, is_write)) {
+      return error;
+    }
+    first += count;
+    remaining -= count;
+  }
+
+  // The vectors didn't cover the whole range
+  return remaining == 0 ? 0 : -1;
+}
+
+bool SyncDeviceAdapter::Device_Available() noexcept {
+  return m_table.m_available(m_table.m_object);
+}
+
+int SyncDeviceAdapter::Device_Init() noexcept {
+  if (int error = m_table.m_init(m_table.m_object)) {
+    return error;
+  }
+  m_block_size = m_table.m_get_block_size(m_table.m_object);
+  return 0;
+}
+
+void SyncDeviceAdapter::Device_GetInfo(DeviceInfo &info) noexcept {
+  if (m_block_size == 0) {
+    m_block_size = m_table.m_get_block_size(m_table.m_object);
+  }
+
+  info = {
+      .block_size = m_block_size,
+      .block_count = m_hint.block_count,
+      .max_transfer = m_hint.max_transfer != 0 ? m_hint.max_transfer
+                                               : DefaultMaxTransfer,
+      .alignment =
+          m_hint.alignment != 0 ? m_hint.alignment : DefaultAlignment,
+      .preferred_transfer = m_hint.preferred_transfer != 0
+                                ? m_hint.preferred_transfer
+                                : DefaultPreferredTransfer,
+      .queue_depth = 1,
+      .can_flush = true,
+      .can_trim = m_table.m_trim != nullptr,
+  };
+}
+
+int SyncDeviceAdapter::Device_Submit(BlockRequest &request) noexcept {
+  if (m_block_size == 0) {
+    m_block_size = m_table.m_get_block_size(m_table.m_object);
+  }
+
+  const size_t max_transfer =
+      m_hint.max_transfer != 0 ? m_hint.max_transfer : DefaultMaxTransfer;
+  const bool is_transfer =
+      request.op == BlockOp::Read || request.op == BlockOp::Write;
+  if (m_block_size == 0 ||
+      (is_transfer &&
+       (request.count > max_transfer || request.vector_count == 0))) {
+    return -1;
+  }
+
+  switch (request.op) {
+  case BlockOp::Read:
+  case BlockOp::Write:
+    request.result = TransferVectors(m_table, request, m_block_size);
+    break;
+
+  case BlockOp::Flush:
+    request.result = m_table.m_flush ? m_table.m_flush(m_table.m_object) : 0;
+    break;
+
+  case BlockOp::Trim:
+    request.result = m_table.m_trim ? m_table.m_trim(m_table.m_object,
+                                                     request.first,
+                                                     request.count)
+                                    : 0;
+    break;
+  }
+  m_done.Push(request);
+  return 0;
+}
+
+BlockRequest *
+SyncDeviceAdapter::Device_Reap([[maybe_unused]] bool wait) noexcept {
+  // Everything has already completed in Submit
+  return m_done.Pop();
+}
+
+} // namespace peli::disk
@@ -0,0 +1,272 @@
+// peli/disk/AsyncDeviceTable.hpp - Queued block device interface
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Types.hpp"
+#include "../util/Concept.hpp"
+#include "DeviceTable.hpp"
+#include "../util/Transform.hpp"
+
+namespace peli::disk {
+
+enum class BlockOp : u8 {
+  Read,
+  Write,
+
+  /**
+   * Complete once everything written before it is on stable storage.
+   */
+  Flush,
+
+  /**
+   * The blocks are no longer in use and their contents can be discarded.
+   */
+  Trim,
+};
+
+/**
+ * One segment of a scatter-gather buffer. The size must be a multiple of the
+ * block size.
+ */
+struct BlockVector {
+  void *data;
+  size_t size;
+};
+
+/**
+ * An I/O request. Owned by the device from Submit until it is returned by
+ * Reap, and must stay valid for that long.
+ */
+struct BlockRequest {
+  BlockOp op;
+
+  /**
+   * Block range for Read, Write and Trim.
+   */
+  size_t first = 0;
+  size_t count = 0;
+
+  /**
+   * Buffers for Read and Write, covering `count` blocks in total.
+   */
+  const BlockVector *vectors = nullptr;
+  u32 vector_count = 0;
+
+  /**
+   * For the submitter to identify the request on completion.
+   */
+  void *tag = nullptr;
+
+  /**
+   * 0 on success, set by the device on completion.
+   */
+  int result = 0;
+
+  /**
+   * Link for the device's internal queues while the request is in flight.
+   */
+  BlockRequest *next = nullptr;
+};
+
+struct DeviceInfo {
+  size_t block_size = 0;
+
+  /**
+   * Total number of blocks, or 0 if unknown.
+   */
+  size_t block_count = 0;
+
+  /**
+   * Largest number of blocks in one request, or 0 if there is no limit. Larger
+   * requests are rejected.
+   */
+  size_t max_transfer = 0;
+
+  /**
+   * Buffer alignment needed to avoid a bounce copy.
+   */
+  size_t alignment = 0;
+
+  /**
+   * Transfer size, in blocks, at which the device reaches full throughput.
+   */
+  size_t preferred_transfer = 0;
+
+  /**
+   * Number of requests that can be in flight at once. Submitting more fails
+   * until one is reaped.
+   */
+  u32 queue_depth = 0;
+
+  bool can_flush = false;
+  bool can_trim = false;
+};
+
+template <class T>
+concept ImplementsAsyncDeviceTable =
+    requires(T t, BlockRequest &request, DeviceInfo &info) {
+      { t.Device_Available() } -> util::IsConvertibleTo<bool>;
+      { t.Device_Init() } -> util::IsConvertibleTo<int>;
+      t.Device_GetInfo(info);
+      { t.Device_Submit(request) } -> util::IsConvertibleTo<int>;
+      { t.Device_Reap(bool()) } -> util::IsConvertibleTo<BlockRequest *>;
+    };
+
+/**
+ * Type-erased handle to a device with a request queue. Requests are submitted
+ * without waiting and reaped in whatever order they complete, so several can be
+ * kept in flight. Submit returns nonzero without taking ownership of the
+ * request if it is invalid or the queue is full. Reap returns a completed
+ * request, or null if none has completed and `wait` is false, or nothing is in
+ * flight.
+ *
+ * The table also implements the synchronous DeviceTable interface on top of
+ * this, for callers that don't need more than one request in flight.
+ */
+struct AsyncDeviceTable {
+  static constexpr u32 MaxPipeline = 4;
+
+  void *m_object;
+  bool (*m_available)(void *obj);
+  int (*m_init)(void *obj);
+  void (*m_get_info)(void *obj, DeviceInfo &info);
+  int (*m_submit)(void *obj, BlockRequest &request);
+  BlockRequest *(*m_reap)(void *obj, bool wait);
+
+  constexpr AsyncDeviceTable() noexcept = default;
+
+  constexpr AsyncDeviceTable(
+      ImplementsAsyncDeviceTable auto &&object) noexcept {
+    using T = typename util::Transform<decltype(object)>::RemCVR::T;
+    m_object = static_cast<void *>(&object);
+
+    m_available = [](void *obj) -> bool {
+      return static_cast<bool>(static_cast<T *>(obj)->Device_Available());
+    };
+
+    m_init = [](void *obj) -> int {
+      auto result = static_cast<T *>(obj)->Device_Init();
+      if constexpr (util::SameAs<decltype(result), bool>) {
+        return static_cast<int>(!result);
+      } else {
+        return static_cast<int>(result);
+      }
+    };
+
+    m_get_info = [](void *obj, DeviceInfo &info) {
+      static_cast<T *>(obj)->Device_GetInfo(info);
+    };
+
+    m_submit = [](void *obj, BlockRequest &request) -> int {
+      return static_cast<int>(static_cast<T *>(obj)->Device_Submit(request));
+    };
+
+    m_reap = [](void *obj, bool wait) -> BlockRequest * {
+      return static_cast<T *>(obj)->Device_Reap(wait);
+    };
+  }
+
+  bool Available() const noexcept { return m_available(m_object); }
+  int Init() const noexcept { return m_init(m_object); }
+
+  DeviceInfo GetInfo() const noexcept {
+    DeviceInfo info = {};
+    m_get_info(m_object, info);
+    return info;
+  }
+
+  int Submit(BlockRequest &request) const noexcept {
+    return m_submit(m_object, request);
+  }
+
+  BlockRequest *Reap(bool wait = true) const noexcept {
+    return m_reap(m_object, wait);
+  }
+
+  /**
+   * Submit a request and wait for it. Must not be used while other requests
+   * are in flight on the table, as their completions would be consumed.
+   */
+  int Execute(BlockRequest &request) const noexcept {
+    if (int error = Submit(request)) {
+      return error;
+    }
+    while (BlockRequest *done = Reap(true)) {
+      if (done == &request) {
+        return request.result;
+      }
+    }
+    return -1;
+  }
+
+  // DeviceTable interface
+  bool Device_Available() noexcept { return Available(); }
+  int Device_Init() noexcept { return Init(); }
+  size_t Device_GetBlockSize() noexcept { return GetInfo().block_size; }
+
+  /**
+   * Split into requests of up to the device's max transfer, keeping as many in
+   * flight as the queue depth allows, up to MaxPipeline. The same restriction
+   * as Execute() applies.
+   */
+  int Device_BlockTransfer(size_t first, size_t count, void *buffer,
+                           bool is_write) noexcept;
+};
+
+/**
+ * FIFO of completed requests, for devices that finish requests in Submit.
+ */
+class CompletionQueue {
+public:
+  void Push(BlockRequest &request) noexcept;
+  BlockRequest *Pop() noexcept;
+
+private:
+  BlockRequest *m_head = nullptr;
+  BlockRequest *m_tail = nullptr;
+};
+
+/**
+ * Carry out a Read or Write request with synchronous transfers on `table`, one
+ * per vector.
+ */
+int TransferVectors(const DeviceTable &table, const BlockRequest &request,
+                    size_t block_size) noexcept;
+
+/**
+ * Drives a synchronous DeviceTable through the queued interface. Requests are
+ * executed in Submit and reaped in submission order, so the queue depth is
+ * always 1. Flush and Trim go to the device's Device_Flush and Device_Trim if
+ * it has them, and otherwise complete without doing anything.
+ *
+ * The synchronous interface can't report the device's limits, so any field of
+ * `hint` that is nonzero replaces the default.
+ */
+class SyncDeviceAdapter {
+public:
+  static constexpr size_t DefaultMaxTransfer = 0x10000;
+  static constexpr size_t DefaultAlignment = 32;
+  static constexpr size_t DefaultPreferredTransfer = 8;
+
+  constexpr SyncDeviceAdapter(const DeviceTable &table,
+                              const DeviceInfo &hint = {}) noexcept
+      : m_table(table), m_hint(hint) {}
+
+  bool Device_Available() noexcept;
+  int Device_Init() noexcept;
+  void Device_GetInfo(DeviceInfo &info) noexcept;
+  int Device_Submit(BlockRequest &request) noexcept;
+  BlockRequest *Device_Reap(bool wait) noexcept;
+
+private:
+  DeviceTable m_table;
+  DeviceInfo m_hint;
+  size_t m_block_size = 0;
+  CompletionQueue m_done;
+};
+
+} // namespace peli::disk
@@ -0,0 +1,562 @@
+// peli/disk/BlockCache.cpp - Write-back block cache
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "BlockCache.hpp"
+#include "../host/Host.hpp"
+#include "Mem2.hpp"
+
+namespace peli::disk {
+
+BlockCache::~BlockCache() noexcept {
+  if (m_entries) {
+    writeBackAll();
+  }
+  release();
+}
+
+bool BlockCache::reserve() noexcept {
+  if (m_entries) {
+    return true;
+  }
+
+  const DeviceInfo info = m_device.GetInfo();
+  if (info.block_size == 0) {
+    return false;
+  }
+
+  m_block_size = info.block_size;
+  m_block_count = info.block_count;
+  m_max_transfer = info.max_transfer != 0 ? info.max_transfer : ~size_t(0);
+  m_can_flush = info.can_flush;
+  m_can_trim = info.can_trim;
+
+  m_bounce_blocks = ReadAhead > 8 ? ReadAhead : 8;
+  if (m_bounce_blocks > m_max_transfer) {
+    m_bounce_blocks = u32(m_max_transfer);
+  }
+  if (m_bounce_blocks > m_capacity / 4) {
+    m_bounce_blocks = m_capacity / 4;
+  }
+
+  u32 bucket_count = 1;
+  for (m_hash_shift = 32; bucket_count < m_capacity; m_hash_shift--) {
+    bucket_count <<= 1;
+  }
+
+  m_storage_size = (m_capacity + m_bounce_blocks) * m_block_size;
+  m_data = AllocMem2(info.alignment > 32 ? info.alignment : 32,
+                        m_storage_size);
+  m_entries = static_cast<Entry *>(
+      host::Alloc(alignof(Entry), m_capacity * sizeof(Entry)));
+  m_buckets = static_cast<u32 *>(
+      host::Alloc(alignof(u32), bucket_count * sizeof(u32)));
+  m_ghosts = static_cast<size_t *>(
+      host::Alloc(alignof(size_t), m_capacity / 2 * sizeof(size_t)));
+
+  if (!m_data || !m_entries || !m_buckets || !m_ghosts) {
+    release();
+    return false;
+  }
+
+  m_bounce = m_data + m_capacity * m_block_size;
+
+  for (u32 i = 0; i < bucket_count; i++) {
+    m_buckets[i] = None;
+  }
+
+  for (u32 i = 0; i < m_capacity; i++) {
+    m_entries[i] = {
+        .lba = 0,
+        .prev = None,
+        .next = i + 1 < m_capacity ? i + 1 : None,
+        .hash_next = None,
+        .queue = Queue::Free,
+        .dirty = false,
+        .read_ahead = false,
+    };
+  }
+  m_free = 0;
+  return true;
+}
+
+void BlockCache::release() noexcept {
+  if (m_data) {
+    FreeMem2(m_data, m_storage_size);
+  }
+  if (m_entries) {
+    host::Free(m_entries, m_capacity * sizeof(Entry));
+  }
+  if (m_buckets) {
+    host::Free(m_buckets, (u32(1) << (32 - m_hash_shift)) * sizeof(u32));
+  }
+  if (m_ghosts) {
+    host::Free(m_ghosts, m_capacity / 2 * sizeof(size_t));
+  }
+
+  m_data = nullptr;
+  m_bounce = nullptr;
+  m_entries = nullptr;
+  m_buckets = nullptr;
+  m_ghosts = nullptr;
+  m_free = None;
+  m_in = {};
+  m_main = {};
+  m_ghost_count = 0;
+  m_ghost_next = 0;
+}
+
+u32 BlockCache::find(size_t lba) const noexcept {
+  u32 index = m_buckets[bucket(lba)];
+  while (index != None && m_entries[index].lba != lba) {
+    index = m_entries[index].hash_next;
+  }
+  return index;
+}
+
+void BlockCache::link(List &list, u32 index) noexcept {
+  Entry &entry = m_entries[index];
+  entry.prev = None;
+  entry.next = list.head;
+  if (list.head != None) {
+    m_entries[list.head].prev = index;
+  } else {
+    list.tail = index;
+  }
+  list.head = index;
+  list.count++;
+}
+
+void BlockCache::unlink(List &list, u32 index) noexcept {
+  Entry &entry = m_entries[index];
+  if (entry.prev != None) {
+    m_entries[entry.prev].next = entry.next;
+  } else {
+    list.head = entry.next;
+  }
+  if (entry.next != None) {
+    m_entries[entry.next].prev = entry.prev;
+  } else {
+    list.tail = entry.prev;
+  }
+  list.count--;
+}
+
+void BlockCache::touch(u32 index) noexcept {
+  // In is a FIFO, a hit there doesn't reorder anything
+  if (m_entries[index].queue == Queue::Main && m_main.head != index) {
+    unlink(m_main, index);
+    link(m_main, index);
+  }
+}
+
+bool BlockCache::takeGhost(size_t lba) noexcept {
+  for (u32 i = 0; i < m_ghost_count; i++) {
+    if (m_ghosts[i] == lba) {
+      m_ghosts[i] = ~size_t(0);
+      return true;
+    }
+  }
+  return false;
+}
+
+void BlockCache::addGhost(size_t lba) noexcept {
+  m_ghosts[m_ghost_next] = lba;
+  m_ghost_next = m_ghost_next + 1 < m_capacity / 2 ? m_ghost_next + 1 : 0;
+  if (m_ghost_count < m_capacity / 2) {
+    m_ghost_count++;
+  }
+}
+
+void BlockCache::drop(u32 index) noexcept {
+  Entry &entry = m_entries[index];
+  unlink(entry.queue == Queue::Main ? m_main : m_in, index);
+
+  u32 *link = &m_buckets[bucket(entry.lba)];
+  while (*link != index) {
+    link = &m_entries[*link].hash_next;
+  }
+  *link = entry.hash_next;
+
+  entry.queue = Queue::Free;
+  entry.dirty = false;
+  entry.next = m_free;
+  m_free = index;
+}
+
+int BlockCache::evict(u32 &index) noexcept {
+  // Keep In to a quarter of the cache, otherwise take from the end of Main
+  const bool from_in = m_in.count > m_capacity / 4 || m_main.count == 0;
+  const u32 victim = from_in ? m_in.tail : m_main.tail;
+
+  if (m_entries[victim].dirty) {
+    if (int error = writeRun(victim)) {
+      return error;
+    }
+  }
+
+  if (from_in) {
+    addGhost(m_entries[victim].lba);
+  }
+  drop(victim);
+
+  index = m_free;
+  m_free = m_entries[index].next;
+  return 0;
+}
+
+int BlockCache::insert(size_t lba, u32 &index) noexcept {
+  if (m_free != None) {
+    index = m_free;
+    m_free = m_entries[index].next;
+  } else if (int error = evict(index)) {
+    return error;
+  }
+
+  Entry &entry = m_entries[index];
+  entry.lba = lba;
+  entry.dirty = false;
+  entry.read_ahead = false;
+
+  // Seen recently enough to still be remembered, so it goes straight to Main
+  entry.queue = takeGhost(lba) ? Queue::Main : Queue::In;
+  link(entry.queue == Queue::Main ? m_main : m_in, index);
+
+  u32 &head = m_buckets[bucket(lba)];
+  entry.hash_next = head;
+  head = index;
+  return 0;
+}
+
+int BlockCache::writeRun(u32 index) noexcept {
+  const size_t first = m_entries[index].lba;
+
+  // Gather the dirty blocks following this one into the bounce buffer
+  u32 count = 1;
+  for (; count < m_bounce_blocks; count++) {
+    const u32 next = find(first + count);
+    if (next == None || !m_entries[next].dirty) {
+      break;
+    }
+    if (count == 1) {
+      __builtin_memcpy(m_bounce, data(index), m_block_size);
+    }
+    __builtin_memcpy(m_bounce + count * m_block_size, data(next),
+                     m_block_size);
+  }
+
+  u8 *buffer = count == 1 ? data(index) : m_bounce;
+  if (int error = m_device.Device_BlockTransfer(first, count, buffer, true)) {
+    return error;
+  }
+
+  m_stats.writebacks++;
+  m_stats.writeback_blocks += count;
+  for (u32 i = 0; i < count; i++) {
+    m_entries[find(first + i)].dirty = false;
+  }
+  return 0;
+}
+
+int BlockCache::writeBackAll() noexcept {
+  for (u32 i = 0; i < m_capacity; i++) {
+    if (m_entries[i].queue == Queue::Free || !m_entries[i].dirty) {
+      continue;
+    }
+
+    // Start from the beginning of the dirty run this block is in
+    u32 start = i;
+    for (u32 prev; m_entries[start].lba != 0 &&
+                   (prev = find(m_entries[start].lba - 1)) != None &&
+                   m_entries[prev].dirty;) {
+      start = prev;
+    }
+
+    // Runs longer than the bounce buffer take more than one write
+    while (start != None && m_entries[start].dirty) {
+      const size_t lba = m_entries[start].lba;
+      if (int error = writeRun(start)) {
+        return error;
+      }
+      start = find(lba + m_bounce_blocks);
+    }
+  }
+  return 0;
+}
+
+int BlockCache::readAhead(size_t first) noexcept {
+  // Skip what was already fetched, and only refill once at least half of the
+  // window is used up
+  size_t start = first;
+  while (start < first + ReadAhead && find(start) != None) {
+    start++;
+  }
+  if (start >= first + ReadAhead / 2 + (ReadAhead == 1 ? 1 : 0)) {
+    return 0;
+  }
+
+  size_t count = m_bounce_blocks;
+  if (m_block_count != 0) {
+    if (start >= m_block_count) {
+      return 0;
+    }
+    if (count > m_block_count - start) {
+      count = m_block_count - start;
+    }
+  }
+
+  // Make room first, evicting may write back through the bounce buffer
+  for (size_t i = 0; i < count; i++) {
+    if (find(start + i) != None) {
+      continue;
+    }
+
+    u32 index;
+    if (int error = insert(start + i, index)) {
+      return error;
+    }
+    m_entries[index].read_ahead = true;
+    m_stats.read_ahead_blocks++;
+  }
+
+  const bool failed =
+      m_device.Device_BlockTransfer(start, count, m_bounce, false) != 0;
+
+  for (size_t i = 0; i < count; i++) {
+    const u32 index = find(start + i);
+    if (index == None || !m_entries[index].read_ahead ||
+        m_entries[index].dirty) {
+      continue;
+    }
+
+    // Not worth failing the read over, e.g. past the end of the device
+    if (failed) {
+      drop(index);
+    } else {
+      __builtin_memcpy(data(index), m_bounce + i * m_block_size,
+                       m_block_size);
+    }
+  }
+  return 0;
+}
+
+int BlockCache::read(size_t first, size_t count, u8 *buffer) noexcept {
+  const bool sequential = first == m_sequential;
+  m_sequential = first + count;
+
+  if (count >= m_capacity / 4) {
+    if (int error =
+            m_device.Device_BlockTransfer(first, count, buffer, false)) {
+      return error;
+    }
+
+    // Dirty blocks are newer than what's on the device
+    for (size_t i = 0; i < count; i++) {
+      const u32 index = find(first + i);
+      if (index != None && m_entries[index].dirty) {
+        __builtin_memcpy(buffer + i * m_block_size, data(index), m_block_size);
+      }
+    }
+    m_stats.read_misses += count;
+    return 0;
+  }
+
+  for (size_t i = 0; i < count;) {
+    const u32 index = find(first + i);
+    if (index != None) {
+      Entry &entry = m_entries[index];
+      if (entry.read_ahead) {
+        entry.read_ahead = false;
+        m_stats.read_ahead_hits++;
+      }
+      touch(index);
+      __builtin_memcpy(buffer + i * m_block_size, data(index), m_block_size);
+      m_stats.read_hits++;
+      i++;
+      continue;
+    }
+
+    // Read the whole run of missing blocks at once
+    size_t end = i + 1;
+    while (end < count && end - i < m_max_transfer &&
+           find(first + end) == None) {
+      end++;
+    }
+
+    u8 *run = buffer + i * m_block_size;
+    if (int error =
+            m_device.Device_BlockTransfer(first + i, end - i, run, false)) {
+      return error;
+    }
+
+    for (; i < end; i++) {
+      u32 slot;
+      if (int error = insert(first + i, slot)) {
+        return error;
+      }
+      __builtin_memcpy(data(slot), buffer + i * m_block_size, m_block_size);
+      m_stats.read_misses++;
+    }
+  }
+
+  if (sequential && ReadAhead != 0) {
+    return readAhead(first + count);
+  }
+  return 0;
+}
+
+int BlockCache::write(size_t first, size_t count, const u8 *buffer) noexcept {
+  if (count >= m_capacity / 4) {
+    if (int error = m_device.Device_BlockTransfer(
+            first, count, const_cast<u8 *>(buffer), true)) {
+      return error;
+    }
+
+    // Keep cached copies current, they're now clean
+    for (size_t i = 0; i < count; i++) {
+      const u32 index = find(first + i);
+      if (index != None) {
+        __builtin_memcpy(data(index), buffer + i * m_block_size, m_block_size);
+        m_entries[index].dirty = false;
+      }
+    }
+    m_stats.write_misses += count;
+    return 0;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    u32 index = find(first + i);
+    if (index != None) {
+      touch(index);
+      m_stats.write_hits++;
+    } else {
+      if (int error = insert(first + i, index)) {
+        return error;
+      }
+      m_stats.write_misses++;
+    }
+
+    __builtin_memcpy(data(index), buffer + i * m_block_size, m_block_size);
+    m_entries[index].dirty = true;
+    m_entries[index].read_ahead = false;
+  }
+  return 0;
+}
+
+int BlockCache::Flush() noexcept {
+  // Also fills in the device info if the cache couldn't be allocated
+  if (reserve()) {
+    if (int error = writeBackAll()) {
+      return error;
+    }
+  }
+
+  if (!m_can_flush) {
+    return 0;
+  }
+
+  BlockRequest request = {.op = BlockOp::Flush};
+  return m_device.Execute(request);
+}
+
+int BlockCache::Trim(size_t first, size_t count) noexcept {
+  for (u32 i = 0; reserve() && i < m_capacity; i++) {
+    if (m_entries[i].queue != Queue::Free && m_entries[i].lba >= first &&
+        m_entries[i].lba - first < count) {
+      drop(i);
+    }
+  }
+
+  if (!m_can_trim) {
+    return 0;
+  }
+
+  BlockRequest request = {
+      .op = BlockOp::Trim,
+      .first = first,
+      .count = count,
+  };
+  return m_device.Execute(request);
+}
+
+int BlockCache::Invalidate() noexcept {
+  if (!m_entries) {
+    return 0;
+  }
+
+  if (int error = writeBackAll()) {
+    return error;
+  }
+
+  for (u32 i = 0; i < m_capacity; i++) {
+    if (m_entries[i].queue != Queue::Free) {
+      drop(i);
+    }
+  }
+  m_ghost_count = 0;
+  m_ghost_next = 0;
+  m_sequential = ~size_t(0);
+  return 0;
+}
+
+bool BlockCache::Device_Available() noexcept { return m_device.Available(); }
+
+int BlockCache::Device_Init() noexcept {
+  if (int error = m_device.Init()) {
+    return error;
+  }
+
+  // The cache is optional, without it requests go straight to the device
+  reserve();
+  return 0;
+}
+
+size_t BlockCache::Device_GetBlockSize() noexcept {
+  return m_entries ? m_block_size : m_device.GetInfo().block_size;
+}
+
+int BlockCache::Device_BlockTransfer(size_t first, size_t count, void *buffer,
+                                     bool is_write) noexcept {
+  if (!reserve()) {
+    return m_device.Device_BlockTransfer(first, count, buffer, is_write);
+  }
+
+  return is_write ? write(first, count, static_cast<const u8 *>(buffer))
+                  : read(first, count, static_cast<u8 *>(buffer));
+}
+
+void BlockCache::Device_GetInfo(DeviceInfo &info) noexcept {
+  info = m_device.GetInfo();
+  info.queue_depth = ~u32(0);
+  info.can_flush = true;
+  info.can_trim = true;
+}
+
+int BlockCache::Device_Submit(BlockRequest &request) noexcept {
+  switch (request.op) {
+  case BlockOp::Read:
+  case BlockOp::Write:
+    request.result = TransferVectors(*this, request, Device_GetBlockSize());
+    break;
+
+  case BlockOp::Flush:
+    request.result = Flush();
+    break;
+
+  case BlockOp::Trim:
+    request.result = Trim(request.first, request.count);
+    break;
+  }
+
+  m_done.Push(request);
+  return 0;
+}
+
+BlockRequest *BlockCache::Device_Reap([[maybe_unused]] bool wait) noexcept {
+  // Everything has already completed in Submit
+  return m_done.Pop();
+}
+
+} // namespace peli::disk
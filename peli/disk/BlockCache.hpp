@@ -0,0 +1,192 @@
+// peli/disk/BlockCache.hpp - Write-back block cache
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Types.hpp"
+#include "../host/Config.h"
+#include "AsyncDeviceTable.hpp"
+
+namespace peli::disk {
+
+/**
+ * Write-back cache over an AsyncDeviceTable, implementing the synchronous
+ * DeviceTable interface. Block data lives at the top of MEM2.
+ *
+ * Replacement is 2Q: a block seen for the first time goes into a small FIFO,
+ * and only moves to the main LRU list if it is used again after leaving it, so
+ * one pass over a large file doesn't evict everything else. Reads that
+ * continue where the last one ended also fetch the next blocks ahead of time.
+ *
+ * Dirty blocks are written back when evicted and on Flush(), in runs of
+ * contiguous blocks where possible. Transfers of a quarter of the cache or more
+ * bypass it.
+ *
+ * Not thread safe, the filesystem is expected to serialize access to a volume.
+ */
+class BlockCache {
+public:
+  static constexpr u32 DefaultCapacity = PELI_DISK_CACHE_BLOCKS;
+  static constexpr u32 ReadAhead = PELI_DISK_CACHE_READ_AHEAD;
+
+  struct Stats {
+    /**
+     * Blocks requested by the filesystem that were or weren't cached.
+     */
+    u32 read_hits;
+    u32 read_misses;
+    u32 write_hits;
+    u32 write_misses;
+
+    /**
+     * Blocks fetched by read-ahead, and how many of those were later read.
+     */
+    u32 read_ahead_blocks;
+    u32 read_ahead_hits;
+
+    /**
+     * Dirty blocks written to the device, and the requests used to do it.
+     */
+    u32 writeback_blocks;
+    u32 writebacks;
+  };
+
+  explicit BlockCache(const AsyncDeviceTable &device,
+                      u32 capacity = DefaultCapacity) noexcept
+      : m_device(device), m_capacity(capacity < 8 ? 8 : capacity) {}
+  ~BlockCache() noexcept;
+
+  BlockCache(const BlockCache &) = delete;
+  BlockCache &operator=(const BlockCache &) = delete;
+
+  /**
+   * Write back all dirty blocks and ask the device to make them durable.
+   */
+  int Flush() noexcept;
+
+  /**
+   * Drop the range from the cache without writing it back, and pass the trim
+   * on to the device.
+   */
+  int Trim(size_t first, size_t count) noexcept;
+
+  /**
+   * Write back dirty blocks and empty the cache, e.g. after the device was
+   * changed behind its back.
+   */
+  int Invalidate() noexcept;
+
+  const Stats &GetStats() const noexcept { return m_stats; }
+  void ResetStats() noexcept { m_stats = {}; }
+
+  // DeviceTable interface
+  bool Device_Available() noexcept;
+  int Device_Init() noexcept;
+  size_t Device_GetBlockSize() noexcept;
+  int Device_BlockTransfer(size_t first, size_t count, void *buffer,
+                           bool is_write) noexcept;
+
+  // AsyncDeviceTable interface, requests complete in Submit
+  void Device_GetInfo(DeviceInfo &info) noexcept;
+  int Device_Submit(BlockRequest &request) noexcept;
+  BlockRequest *Device_Reap(bool wait) noexcept;
+
+private:
+  static constexpr u32 None = ~u32(0);
+
+  enum class Queue : u8 {
+    Free,
+
+    /**
+     * First reference, FIFO.
+     */
+    In,
+
+    /**
+     * Referenced again after leaving In, LRU.
+     */
+    Main,
+  };
+
+  struct Entry {
+    size_t lba;
+    u32 prev;
+    u32 next;
+    u32 hash_next;
+    Queue queue;
+    bool dirty;
+    bool read_ahead;
+  };
+
+  struct List {
+    u32 head = None;
+    u32 tail = None;
+    u32 count = 0;
+  };
+
+  bool reserve() noexcept;
+  void release() noexcept;
+
+  u8 *data(u32 index) const noexcept {
+    return m_data + index * m_block_size;
+  }
+
+  u32 bucket(size_t lba) const noexcept {
+    return u32(lba * 0x9E3779B1) >> m_hash_shift;
+  }
+
+  u32 find(size_t lba) const noexcept;
+  void link(List &list, u32 index) noexcept;
+  void unlink(List &list, u32 index) noexcept;
+  void touch(u32 index) noexcept;
+  bool takeGhost(size_t lba) noexcept;
+  void addGhost(size_t lba) noexcept;
+  int evict(u32 &index) noexcept;
+  int insert(size_t lba, u32 &index) noexcept;
+  void drop(u32 index) noexcept;
+  int writeRun(u32 index) noexcept;
+  int writeBackAll() noexcept;
+  int readAhead(size_t first) noexcept;
+
+  int read(size_t first, size_t count, u8 *buffer) noexcept;
+  int write(size_t first, size_t count, const u8 *buffer) noexcept;
+
+  AsyncDeviceTable m_device;
+  u32 m_capacity;
+  size_t m_block_size = 0;
+  size_t m_block_count = 0;
+  size_t m_max_transfer = 0;
+  bool m_can_flush = false;
+  bool m_can_trim = false;
+
+  // Block data and the bounce buffer for read-ahead and writeback runs, in
+  // MEM2
+  u8 *m_data = nullptr;
+  u8 *m_bounce = nullptr;
+  size_t m_storage_size = 0;
+  u32 m_bounce_blocks = 0;
+
+  Entry *m_entries = nullptr;
+  u32 *m_buckets = nullptr;
+  u32 m_hash_shift = 0;
+  u32 m_free = None;
+
+  List m_in;
+  List m_main;
+
+  // Blocks recently pushed out of In, without their data
+  size_t *m_ghosts = nullptr;
+  u32 m_ghost_count = 0;
+  u32 m_ghost_next = 0;
+
+  // Where a sequential read would continue
+  size_t m_sequential = ~size_t(0);
+
+  CompletionQueue m_done;
+  Stats m_stats = {};
+};
+
+} // namespace peli::disk
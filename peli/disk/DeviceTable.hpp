@@ -30,6 +30,12 @@ struct DeviceTable {
   int (*m_block_transfer)(void *obj, size_t first, size_t count, void *buffer,
                           bool is_write);
 
+  /**
+   * Optional, null if the device has no Device_Flush or Device_Trim.
+   */
+  int (*m_flush)(void *obj) = nullptr;
+  int (*m_trim)(void *obj, size_t first, size_t count) = nullptr;
+
   constexpr DeviceTable() noexcept = default;
 
   constexpr DeviceTable(ImplementsDeviceTable auto &&object) noexcept {
@@ -71,6 +77,19 @@ struct DeviceTable {
         return static_cast<int>(result);
       }
     };
+
+    if constexpr (requires(T t) { t.Device_Flush(); }) {
+      m_flush = [](void *obj) -> int {
+        return static_cast<int>(static_cast<T *>(obj)->Device_Flush());
+      };
+    }
+
+    if constexpr (requires(T t) { t.Device_Trim(size_t(), size_t()); }) {
+      m_trim = [](void *obj, size_t first, size_t count) -> int {
+        return static_cast<int>(
+            static_cast<T *>(obj)->Device_Trim(first, count));
+      };
+    }
   }
 };
 
@@ -0,0 +1,40 @@
+// peli/disk/Mem2.hpp - Long-lived MEM2 allocations for disk buffers
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Types.hpp"
+#include "../host/Config.h"
+#include "../host/Host.hpp"
+
+#if defined(PELI_HOST_PPC)
+#include "../rt/Arena.hpp"
+#endif
+
+namespace peli::disk {
+
+/**
+ * Allocate from the top of the MEM2 arena, away from the heap. Memory is only
+ * given back by FreeMem2 if nothing was allocated from the top since. Other
+ * hosts use the heap.
+ */
+inline u8 *AllocMem2(size_t align, size_t size) noexcept {
+#if defined(PELI_HOST_PPC)
+  return rt::Arena::AllocFromMem2Hi(size, align);
+#else
+  return static_cast<u8 *>(host::Alloc(align, size));
+#endif
+}
+
+inline void FreeMem2(u8 *ptr, size_t size) noexcept {
+#if defined(PELI_HOST_PPC)
+  rt::Arena::FreeToMem2Hi(ptr, size);
+#else
+  host::Free(ptr, size);
+#endif
+}
+
+} // namespace peli::disk
@@ -0,0 +1,213 @@
+// peli/disk/RamDisk.cpp - Block device backed by MEM2
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "RamDisk.hpp"
+#include "../host/Host.hpp"
+#include "Mem2.hpp"
+
+namespace peli::disk {
+
+namespace {
+
+constexpr size_t ChunkSize = RamDisk::ChunkBlocks * RamDisk::BlockSize;
+
+size_t bitmapSize(size_t block_count) noexcept {
+  const size_t chunks = (block_count + RamDisk::ChunkBlocks - 1) /
+                        RamDisk::ChunkBlocks;
+  return (chunks + 31) / 32 * sizeof(u32);
+}
+
+} // namespace
+
+RamDisk::RamDisk(size_t block_count, bool lazy_zero) noexcept
+    : m_block_count(block_count), m_size(block_count * BlockSize) {
+  if (block_count == 0) {
+    return;
+  }
+
+  m_data = AllocMem2(32, m_size);
+  if (!m_data) {
+    return;
+  }
+
+  if (lazy_zero) {
+    m_touched = static_cast<u32 *>(
+        host::Alloc(alignof(u32), bitmapSize(block_count)));
+    if (m_touched) {
+      __builtin_memset(m_touched, 0, bitmapSize(block_count));
+      return;
+    }
+  }
+
+  __builtin_memset(m_data, 0, m_size);
+}
+
+RamDisk::~RamDisk() noexcept {
+  if (m_touched) {
+    host::Free(m_touched, bitmapSize(m_block_count));
+  }
+  if (m_data) {
+    FreeMem2(m_data, m_size);
+  }
+}
+
+void RamDisk::read(size_t first, size_t count, u8 *buffer) const noexcept {
+  size_t offset = first * BlockSize;
+  const size_t end = (first + count) * BlockSize;
+
+  while (offset < end) {
+    const size_t chunk = offset / ChunkSize;
+    const size_t chunk_end = (chunk + 1) * ChunkSize;
+    const size_t length = (chunk_end < end ? chunk_end : end) - offset;
+
+    if (touched(chunk)) {
+      __builtin_memcpy(buffer, m_data + offset, length);
+    } else {
+      __builtin_memset(buffer, 0, length);
+    }
+
+    buffer += length;
+    offset += length;
+  }
+}
+
+void RamDisk::write(size_t first, size_t count, const u8 *buffer) noexcept {
+  size_t offset = first * BlockSize;
+  const size_t end = (first + count) * BlockSize;
+
+  while (offset < end) {
+    const size_t chunk = offset / ChunkSize;
+    const size_t chunk_start = chunk * ChunkSize;
+    const size_t chunk_end = chunk_start + ChunkSize;
+    const size_t length = (chunk_end < end ? chunk_end : end) - offset;
+
+    if (!touched(chunk)) {
+      // Only clear what this write doesn't cover
+      __builtin_memset(m_data + chunk_start, 0, offset - chunk_start);
+      if (offset + length < chunk_end && offset + length < m_size) {
+        const size_t tail_end = chunk_end < m_size ? chunk_end : m_size;
+        __builtin_memset(m_data + offset + length, 0,
+                         tail_end - (offset + length));
+      }
+      m_touched[chunk / 32] |= u32(1) << (chunk % 32);
+    }
+
+    __builtin_memcpy(m_data + offset, buffer, length);
+    buffer += length;
+    offset += length;
+  }
+}
+
+int RamDisk::Trim(size_t first, size_t count) noexcept {
+  if (!m_touched || first >= m_block_count) {
+    return 0;
+  }
+  if (count > m_block_count - first) {
+    count = m_block_count - first;
+  }
+
+  // Whole chunks go back to untouched, partial ones are zeroed
+  size_t block = first;
+  const size_t end = first + count;
+  while (block < end) {
+    const size_t chunk = block / ChunkBlocks;
+    const size_t chunk_end = (chunk + 1) * ChunkBlocks;
+    const size_t blocks = (chunk_end < end ? chunk_end : end) - block;
+
+    if (blocks == ChunkBlocks ||
+        (block % ChunkBlocks == 0 && block + blocks == m_block_count)) {
+      m_touched[chunk / 32] &= ~(u32(1) << (chunk % 32));
+    } else if (touched(chunk)) {
+      __builtin_memset(m_data + block * BlockSize, 0, blocks * BlockSize);
+    }
+    block += blocks;
+  }
+  return 0;
+}
+
+int RamDisk::Device_BlockTransfer(size_t first, size_t count, void *buffer,
+                                  bool is_write) noexcept {
+  if (!m_data || first > m_block_count || count > m_block_count - first) {
+    return -1;
+  }
+
+  if (is_write) {
+    write(first, count, static_cast<const u8 *>(buffer));
+  } else {
+    read(first, count, static_cast<u8 *>(buffer));
+  }
+  return 0;
+}
+
+void RamDisk::Device_GetInfo(DeviceInfo &info) noexcept {
+  info = {
+      .block_size = BlockSize,
+      .block_count = m_block_count,
+      .max_transfer = m_block_count,
+      .alignment = 1,
+      .preferred_transfer = ChunkBlocks,
+      .queue_depth = ~u32(0),
+      .can_flush = true,
+      .can_trim = true,
+  };
+}
+
+int RamDisk::Device_Submit(BlockRequest &request) noexcept {
+  if (!m_data || request.first > m_block_count ||
+      request.count > m_block_count - request.first) {
+    return -1;
+  }
+
+  if (request.op == BlockOp::Read || request.op == BlockOp::Write) {
+    size_t blocks = 0;
+    for (u32 i = 0; i < request.vector_count; i++) {
+      blocks += request.vectors[i].size / BlockSize;
+    }
+    if (blocks < request.count) {
+      return -1;
+    }
+  }
+
+  request.result = 0;
+  switch (request.op) {
+  case BlockOp::Read:
+  case BlockOp::Write: {
+    size_t block = request.first;
+    size_t remaining = request.count;
+    for (u32 i = 0; i < request.vector_count && remaining != 0; i++) {
+      const BlockVector &vector = request.vectors[i];
+      size_t count = vector.size / BlockSize;
+      count = count < remaining ? count : remaining;
+
+      if (request.op == BlockOp::Write) {
+        write(block, count, static_cast<const u8 *>(vector.data));
+      } else {
+        read(block, count, static_cast<u8 *>(vector.data));
+      }
+      block += count;
+      remaining -= count;
+    }
+    break;
+  }
+
+  case BlockOp::Flush:
+    break;
+
+  case BlockOp::Trim:
+    request.result = Trim(request.first, request.count);
+    break;
+  }
+
+  m_done.Push(request);
+  return 0;
+}
+
+BlockRequest *RamDisk::Device_Reap([[maybe_unused]] bool wait) noexcept {
+  // Everything has already completed in Submit
+  return m_done.Pop();
+}
+
+} // namespace peli::disk
@@ -0,0 +1,79 @@
+// peli/disk/RamDisk.hpp - Block device backed by MEM2
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Types.hpp"
+#include "AsyncDeviceTable.hpp"
+
+namespace peli::disk {
+
+/**
+ * Block device in memory allocated from the top of MEM2, for scratch data that
+ * doesn't need to outlive the program. Starts out zeroed, so it can be
+ * formatted like any other device. Implements both the synchronous and queued
+ * device interfaces; requests complete immediately.
+ *
+ * With lazy zeroing, memory is only cleared the first time each chunk is
+ * written, and reads of untouched chunks return zeros without touching it.
+ * Trimmed chunks go back to that state.
+ */
+class RamDisk {
+public:
+  static constexpr size_t BlockSize = 512;
+
+  /**
+   * Granularity of lazy zeroing and trim, in blocks.
+   */
+  static constexpr size_t ChunkBlocks = 64;
+
+  RamDisk(size_t block_count, bool lazy_zero = true) noexcept;
+  ~RamDisk() noexcept;
+
+  RamDisk(const RamDisk &) = delete;
+  RamDisk &operator=(const RamDisk &) = delete;
+
+  bool IsValid() const noexcept { return m_data != nullptr; }
+  size_t GetBlockCount() const noexcept { return m_block_count; }
+
+  /**
+   * Discard the range, reads from it return zeros afterwards. Does nothing
+   * without lazy zeroing.
+   */
+  int Trim(size_t first, size_t count) noexcept;
+
+  // DeviceTable interface
+  bool Device_Available() noexcept { return IsValid(); }
+  int Device_Init() noexcept { return IsValid() ? 0 : -1; }
+  size_t Device_GetBlockSize() noexcept { return BlockSize; }
+  int Device_BlockTransfer(size_t first, size_t count, void *buffer,
+                           bool is_write) noexcept;
+
+  // AsyncDeviceTable interface
+  void Device_GetInfo(DeviceInfo &info) noexcept;
+  int Device_Submit(BlockRequest &request) noexcept;
+  BlockRequest *Device_Reap(bool wait) noexcept;
+
+private:
+  bool touched(size_t chunk) const noexcept {
+    return !m_touched || (m_touched[chunk / 32] >> (chunk % 32)) & 1;
+  }
+
+  void read(size_t first, size_t count, u8 *buffer) const noexcept;
+  void write(size_t first, size_t count, const u8 *buffer) noexcept;
+
+  u8 *m_data = nullptr;
+  size_t m_block_count;
+  size_t m_size;
+
+  // One bit per chunk that has been written since it was last zeroed, null
+  // without lazy zeroing
+  u32 *m_touched = nullptr;
+
+  CompletionQueue m_done;
+};
+
+} // namespace peli::disk
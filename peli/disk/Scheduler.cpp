@@ -0,0 +1,322 @@
+// peli/disk/Scheduler.cpp - Block request merging and reordering
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "Scheduler.hpp"
+#include "../host/Host.hpp"
+
+namespace peli::disk {
+
+Scheduler::~Scheduler() noexcept {
+  if (m_staging) {
+    writeback();
+    host::Free(m_staging, m_staging_size);
+  }
+}
+
+bool Scheduler::reserve() noexcept {
+  if (m_staging) {
+    return true;
+  }
+
+  m_info = m_device.GetInfo();
+  if (m_info.block_size == 0) {
+    return false;
+  }
+
+  m_staging_size = MaxBlocks * m_info.block_size;
+  m_staging = static_cast<u8 *>(host::Alloc(
+      m_info.alignment > 32 ? m_info.alignment : 32, m_staging_size));
+  return m_staging != nullptr;
+}
+
+void Scheduler::sortPending() noexcept {
+  for (u32 i = 0; i < m_pending; i++) {
+    m_order[i] = i;
+  }
+
+  // Insertion sort, FatFs mostly writes in ascending order already
+  for (u32 i = 1; i < m_pending; i++) {
+    const u32 slot = m_order[i];
+    u32 j = i;
+    for (; j > 0 && m_lba[m_order[j - 1]] > m_lba[slot]; j--) {
+      m_order[j] = m_order[j - 1];
+    }
+    m_order[j] = slot;
+  }
+}
+
+int Scheduler::writeback() noexcept {
+  if (m_pending == 0) {
+    return 0;
+  }
+
+  sortPending();
+
+  const size_t block_size = m_info.block_size;
+  const size_t max_transfer =
+      m_info.max_transfer != 0 ? m_info.max_transfer : MaxBlocks;
+  const u32 queue_depth = m_info.queue_depth != 0 ? m_info.queue_depth : 1;
+
+  int result = 0;
+  u32 in_flight = 0;
+  u32 vector_count = 0;
+  u32 request_count = 0;
+
+  auto reapOne = [&]() {
+    if (BlockRequest *done = m_device.Reap(true)) {
+      in_flight--;
+      if (done->result != 0 && result == 0) {
+        result = done->result;
+      }
+    } else {
+      // Nothing was actually in flight
+      in_flight = 0;
+    }
+  };
+
+  for (u32 i = 0; i < m_pending && result == 0;) {
+    // Gather the next contiguous run, joining vectors for blocks that are
+    // also adjacent in the staging area
+    BlockRequest &request = m_requests[request_count++];
+    const u32 first_vector = vector_count;
+    const size_t first = m_lba[m_order[i]];
+    size_t count = 0;
+
+    for (; i < m_pending && count < max_transfer &&
+           m_lba[m_order[i]] == first + count;
+         i++, count++) {
+      u8 *data = m_staging + m_order[i] * block_size;
+      BlockVector *last = vector_count != first_vector
+                              ? &m_vectors[vector_count - 1]
+                              : nullptr;
+      if (last && static_cast<u8 *>(last->data) + last->size == data) {
+        last->size += block_size;
+      } else {
+        m_vectors[vector_count++] = {data, block_size};
+      }
+    }
+
+    request = {
+        .op = BlockOp::Write,
+        .first = first,
+        .count = count,
+        .vectors = &m_vectors[first_vector],
+        .vector_count = vector_count - first_vector,
+    };
+
+    if (in_flight == queue_depth) {
+      reapOne();
+      if (result != 0) {
+        break;
+      }
+    }
+
+    if (int error = m_device.Submit(request)) {
+      result = error;
+      break;
+    }
+    in_flight++;
+    m_stats.writebacks++;
+  }
+
+  while (in_flight != 0) {
+    reapOne();
+  }
+
+  // On failure everything stays pending so the next attempt retries it
+  if (result == 0) {
+    m_pending = 0;
+  }
+  return result;
+}
+
+int Scheduler::read(size_t first, size_t count, u8 *buffer) noexcept {
+  m_stats.reads++;
+
+  if (int error = m_device.Device_BlockTransfer(first, count, buffer, false)) {
+    return error;
+  }
+
+  if (m_pending == 0 || first > m_highest || first + count <= m_lowest) {
+    return 0;
+  }
+
+  // Pending writes are newer than what's on the device
+  const size_t block_size = m_info.block_size;
+  for (u32 slot = 0; slot < m_pending; slot++) {
+    if (m_lba[slot] >= first && m_lba[slot] < first + count) {
+      __builtin_memcpy(buffer + (m_lba[slot] - first) * block_size,
+                       m_staging + slot * block_size, block_size);
+      m_stats.forwarded_blocks++;
+    }
+  }
+  return 0;
+}
+
+int Scheduler::write(size_t first, size_t count, const u8 *buffer) noexcept {
+  m_stats.writes++;
+  m_stats.write_blocks += count;
+
+  if (count > MaxBlocks / 2) {
+    // Already one large transfer, staging it would only add a copy. Anything
+    // pending in the range is older, so write that back first.
+    if (int error = writeback()) {
+      return error;
+    }
+    m_stats.bypass_writes++;
+    return m_device.Device_BlockTransfer(first, count, const_cast<u8 *>(buffer),
+                                         true);
+  }
+
+  if (m_pending + count > MaxBlocks) {
+    if (int error = writeback()) {
+      return error;
+    }
+  }
+
+  const size_t block_size = m_info.block_size;
+  for (size_t i = 0; i < count; i++) {
+    const size_t lba = first + i;
+
+    u32 slot = m_pending;
+    if (m_pending != 0 && lba >= m_lowest && lba <= m_highest) {
+      for (slot = 0; slot < m_pending && m_lba[slot] != lba; slot++) {
+      }
+    }
+
+    if (slot != m_pending) {
+      m_stats.absorbed_blocks++;
+    } else {
+      if (m_pending == 0 || lba < m_lowest) {
+        m_lowest = lba;
+      }
+      if (m_pending == 0 || lba > m_highest) {
+        m_highest = lba;
+      }
+      m_lba[m_pending++] = lba;
+    }
+
+    __builtin_memcpy(m_staging + slot * block_size, buffer + i * block_size,
+                     block_size);
+  }
+  return 0;
+}
+
+int Scheduler::Flush() noexcept {
+  // Also fills in the device info if staging couldn't be allocated
+  reserve();
+
+  if (int error = writeback()) {
+    return error;
+  }
+
+  m_stats.flushes++;
+  if (!m_info.can_flush) {
+    return 0;
+  }
+
+  BlockRequest request = {.op = BlockOp::Flush};
+  return m_device.Execute(request);
+}
+
+int Scheduler::Trim(size_t first, size_t count) noexcept {
+  reserve();
+
+  // Drop pending blocks in the range, keeping the rest in order
+  const size_t block_size = m_info.block_size;
+  u32 kept = 0;
+  for (u32 slot = 0; slot < m_pending; slot++) {
+    const size_t lba = m_lba[slot];
+    if (lba >= first && lba < first + count) {
+      continue;
+    }
+
+    if (kept != slot) {
+      m_lba[kept] = lba;
+      __builtin_memcpy(m_staging + kept * block_size,
+                       m_staging + slot * block_size, block_size);
+    }
+    if (kept == 0 || lba < m_lowest) {
+      m_lowest = lba;
+    }
+    if (kept == 0 || lba > m_highest) {
+      m_highest = lba;
+    }
+    kept++;
+  }
+  m_pending = kept;
+
+  if (!m_info.can_trim) {
+    return 0;
+  }
+
+  BlockRequest request = {
+      .op = BlockOp::Trim,
+      .first = first,
+      .count = count,
+  };
+  return m_device.Execute(request);
+}
+
+bool Scheduler::Device_Available() noexcept { return m_device.Available(); }
+
+int Scheduler::Device_Init() noexcept {
+  if (int error = m_device.Init()) {
+    return error;
+  }
+
+  // Staging is optional, without it requests go straight to the device
+  reserve();
+  return 0;
+}
+
+size_t Scheduler::Device_GetBlockSize() noexcept {
+  return m_staging ? m_info.block_size : m_device.GetInfo().block_size;
+}
+
+int Scheduler::Device_BlockTransfer(size_t first, size_t count, void *buffer,
+                                    bool is_write) noexcept {
+  if (!reserve()) {
+    return m_device.Device_BlockTransfer(first, count, buffer, is_write);
+  }
+
+  return is_write ? write(first, count, static_cast<const u8 *>(buffer))
+                  : read(first, count, static_cast<u8 *>(buffer));
+}
+
+void Scheduler::Device_GetInfo(DeviceInfo &info) noexcept {
+  info = m_device.GetInfo();
+  info.queue_depth = ~u32(0);
+  info.can_flush = true;
+  info.can_trim = true;
+}
+
+int Scheduler::Device_Submit(BlockRequest &request) noexcept {
+  switch (request.op) {
+  case BlockOp::Read:
+  case BlockOp::Write:
+    request.result = TransferVectors(*this, request, Device_GetBlockSize());
+    break;
+
+  case BlockOp::Flush:
+    request.result = Flush();
+    break;
+
+  case BlockOp::Trim:
+    request.result = Trim(request.first, request.count);
+    break;
+  }
+
+  m_done.Push(request);
+  return 0;
+}
+
+BlockRequest *Scheduler::Device_Reap([[maybe_unused]] bool wait) noexcept {
+  // Everything has already completed in Submit
+  return m_done.Pop();
+}
+
+} // namespace peli::disk
@@ -0,0 +1,127 @@
+// peli/disk/Scheduler.hpp - Block request merging and reordering
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Types.hpp"
+#include "../host/Config.h"
+#include "AsyncDeviceTable.hpp"
+
+namespace peli::disk {
+
+/**
+ * Request queue between a filesystem and a device, implementing the
+ * synchronous DeviceTable interface on top of an AsyncDeviceTable.
+ *
+ * Writes are copied into a staging area and return immediately. A block
+ * written again while still pending is overwritten in place. When the staging
+ * area fills up, or on Flush(), the pending blocks are sorted by LBA and each
+ * contiguous run is written back as one multi-block request, with up to the
+ * device's queue depth in flight.
+ *
+ * Reads go to the device straight away without waiting for writeback, and any
+ * pending writes in the range are copied over the result.
+ *
+ * Not thread safe, the filesystem is expected to serialize access to a volume.
+ */
+class Scheduler {
+public:
+  static constexpr u32 MaxBlocks = PELI_DISK_SCHEDULER_BLOCKS;
+
+  struct Stats {
+    /**
+     * Calls from the filesystem.
+     */
+    u32 reads;
+    u32 writes;
+
+    /**
+     * Blocks written by the filesystem, and how many of those replaced a block
+     * that was still pending.
+     */
+    u32 write_blocks;
+    u32 absorbed_blocks;
+
+    /**
+     * Blocks in read results that came from pending writes.
+     */
+    u32 forwarded_blocks;
+
+    /**
+     * Write requests issued from staging. `writes` divided by this is the
+     * merge ratio.
+     */
+    u32 writebacks;
+    u32 flushes;
+
+    /**
+     * Writes large enough to skip staging, sent straight to the device.
+     */
+    u32 bypass_writes;
+  };
+
+  explicit Scheduler(const AsyncDeviceTable &device) noexcept
+      : m_device(device) {}
+  ~Scheduler() noexcept;
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  /**
+   * Write back all pending blocks and ask the device to make them durable.
+   */
+  int Flush() noexcept;
+
+  /**
+   * Discard pending writes in the range and pass the trim on to the device.
+   */
+  int Trim(size_t first, size_t count) noexcept;
+
+  const Stats &GetStats() const noexcept { return m_stats; }
+  void ResetStats() noexcept { m_stats = {}; }
+
+  // DeviceTable interface
+  bool Device_Available() noexcept;
+  int Device_Init() noexcept;
+  size_t Device_GetBlockSize() noexcept;
+  int Device_BlockTransfer(size_t first, size_t count, void *buffer,
+                           bool is_write) noexcept;
+
+  // AsyncDeviceTable interface, requests complete in Submit
+  void Device_GetInfo(DeviceInfo &info) noexcept;
+  int Device_Submit(BlockRequest &request) noexcept;
+  BlockRequest *Device_Reap(bool wait) noexcept;
+
+private:
+  bool reserve() noexcept;
+  int read(size_t first, size_t count, u8 *buffer) noexcept;
+  int write(size_t first, size_t count, const u8 *buffer) noexcept;
+  int writeback() noexcept;
+  void sortPending() noexcept;
+
+  AsyncDeviceTable m_device;
+  DeviceInfo m_info = {};
+
+  // Pending blocks are stored in the order they were first written
+  u8 *m_staging = nullptr;
+  size_t m_staging_size = 0;
+  u32 m_pending = 0;
+  size_t m_lba[MaxBlocks];
+
+  // Range covered by pending blocks, to skip lookups for reads outside it
+  size_t m_lowest = 0;
+  size_t m_highest = 0;
+
+  // Writeback state
+  u32 m_order[MaxBlocks];
+  BlockVector m_vectors[MaxBlocks];
+  BlockRequest m_requests[MaxBlocks];
+
+  CompletionQueue m_done;
+  Stats m_stats = {};
+};
+
+} // namespace peli::disk
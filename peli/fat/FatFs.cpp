@@ -544,15 +544,19 @@ static WCHAR LfnBuf[FF_MAX_LFN + 1];		/* LFN working buffer */
 #endif
 #define LEAVE_MKFS(res)	return res
 
-#elif FF_USE_LFN == 3 	/* LFN enabled with dynamic working buffer on the heap */
+#elif FF_USE_LFN == 3 	/* LFN enabled with per-volume working buffer (other work areas on the heap) */
+/* The buffers live in the filesystem object and are only used while the volume
+/  is locked, so concurrent callers on one volume are already serialized and
+/  name operations never touch the heap. */
 #if FF_FS_EXFAT
-#define DEF_NAMEBUFF		WCHAR *lfn;	/* Pointer to LFN working buffer and directory entry block scratchpad buffer */
-#define INIT_NAMEBUFF(fs)	{ lfn = (WCHAR*) ff_memalloc((FF_MAX_LFN+1)*2 + MAXDIRB(FF_MAX_LFN)); if (!lfn) LEAVE_FF(fs, FR_NOT_ENOUGH_CORE); (fs)->lfnbuf = lfn; (fs)->dirbuf = (BYTE*)(lfn+FF_MAX_LFN+1); }
-#define FREE_NAMEBUFF()	ff_memfree(lfn)
+#define DEF_NAMEBUFF
+#define INIT_NAMEBUFF(fs)	{ (fs)->lfnbuf = (fs)->lfn_pool; (fs)->dirbuf = (fs)->dir_pool; }
+#define FREE_NAMEBUFF()
+static_assert(sizeof FATFS::dir_pool >= MAXDIRB(FF_MAX_LFN));
 #else
-#define DEF_NAMEBUFF		WCHAR *lfn;	/* Pointer to LFN working buffer */
-#define INIT_NAMEBUFF(fs)	{ lfn = ff_memalloc((FF_MAX_LFN+1)*2); if (!lfn) LEAVE_FF(fs, FR_NOT_ENOUGH_CORE); (fs)->lfnbuf = lfn; }
-#define FREE_NAMEBUFF()	ff_memfree(lfn)
+#define DEF_NAMEBUFF
+#define INIT_NAMEBUFF(fs)	{ (fs)->lfnbuf = (fs)->lfn_pool; }
+#define FREE_NAMEBUFF()
 #endif
 #define LEAVE_MKFS(res)	{ if (!work) ff_memfree(buf); return res; }
 #define MAX_MALLOC	0x8000	/* Must be >=FF_MAX_SS */
@@ -1107,6 +1111,116 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* FAT sector cache in the filesystem object                             */
+/*-----------------------------------------------------------------------*/
+
+#define FC_SECTORS	PELI_FAT_TABLE_CACHE_SECTORS
+#define CLUSTER_BITMAP	(FF_USE_LFN == 3 && !FF_FS_READONLY && PELI_FAT_CLUSTER_BITMAP_SIZE > 0)
+
+static void fat_cache_reset (
+	FATFS* fs		/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FC_SECTORS; i++) {
+		fs->fc_sect[i] = (LBA_t)0 - 1;
+		fs->fc_use[i] = 0;
+	}
+#if !FF_FS_READONLY
+	fs->fc_dirty = 0;
+	fs->fc_writes = 0;
+#endif
+	fs->fc_tick = 0;
+	fs->fc_last = 0;
+}
+
+
+static UINT fat_slot (	/* Cache slot holding the sector, FC_SECTORS:Disk error */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sect		/* Sector LBA in the 1st FAT */
+)
+{
+	UINT i, v;
+
+
+	i = fs->fc_last;
+	if (fs->fc_sect[i] != sect) {	/* Not the last used sector? */
+		for (i = 0; i < FC_SECTORS && fs->fc_sect[i] != sect; i++) ;
+		if (i == FC_SECTORS) {		/* Miss: replace the least recently used slot */
+			for (v = 0, i = 1; i < FC_SECTORS; i++) {
+				if (fs->fc_use[i] < fs->fc_use[v]) v = i;
+			}
+			i = v;
+#if !FF_FS_READONLY
+			if (fs->fc_dirty & (DWORD)1 << i) {	/* Write back the evicted sector */
+				if (disk_write(fs->pdrv, fs->fc_buf[i], fs->fc_sect[i], 1) != RES_OK) return FC_SECTORS;
+				if (fs->n_fats == 2) disk_write(fs->pdrv, fs->fc_buf[i], fs->fc_sect[i] + fs->fsize, 1);	/* Reflect it to 2nd FAT */
+				fs->fc_dirty &= ~((DWORD)1 << i);
+				fs->fc_writes += fs->n_fats;
+			}
+#endif
+			if (disk_read(fs->pdrv, fs->fc_buf[i], sect, 1) != RES_OK) {
+				fs->fc_sect[i] = (LBA_t)0 - 1;	/* Invalidate the slot */
+				fs->fc_use[i] = 0;
+				return FC_SECTORS;
+			}
+			fs->fc_sect[i] = sect;
+		}
+		fs->fc_last = (BYTE)i;
+	}
+	fs->fc_use[i] = ++fs->fc_tick;
+	return i;
+}
+
+
+#if !FF_FS_READONLY
+static FRESULT fat_cache_write (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs,		/* Filesystem object */
+	const BYTE* order,	/* Dirty slots in ascending sector order */
+	UINT n,			/* Number of dirty slots */
+	LBA_t ofs		/* Offset of the FAT copy from the 1st FAT */
+)
+{
+	UINT i, k;
+
+
+	for (i = 0; i < n; i += k) {	/* Neighbouring slots holding consecutive sectors go in one write */
+		for (k = 1; i + k < n && order[i + k] == order[i] + k && fs->fc_sect[order[i + k]] == fs->fc_sect[order[i]] + k; k++) ;
+		if (disk_write(fs->pdrv, fs->fc_buf[order[i]], fs->fc_sect[order[i]] + ofs, k) != RES_OK) return FR_DISK_ERR;
+		fs->fc_writes++;
+	}
+	return FR_OK;
+}
+
+
+static FRESULT fat_cache_flush (	/* Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	BYTE order[FC_SECTORS];
+	UINT i, j, n;
+
+
+	if (!fs->fc_dirty) return FR_OK;
+
+	for (n = 0, i = 0; i < FC_SECTORS; i++) {	/* Sort the dirty slots by sector */
+		if (!(fs->fc_dirty & (DWORD)1 << i)) continue;
+		for (j = n++; j > 0 && fs->fc_sect[order[j - 1]] > fs->fc_sect[i]; j--) order[j] = order[j - 1];
+		order[j] = (BYTE)i;
+	}
+	if (fat_cache_write(fs, order, n, 0) != FR_OK) return FR_DISK_ERR;	/* 1st FAT */
+	if (fs->n_fats == 2) fat_cache_write(fs, order, n, fs->fsize);	/* Mirror them to 2nd FAT in one pass */
+	fs->fc_dirty = 0;
+	return FR_OK;
+}
+#endif
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Synchronize filesystem and data on the storage                        */
@@ -1119,7 +1233,8 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 	FRESULT res;
 
 
-	res = sync_window(fs);
+	res = fat_cache_flush(fs);
+	if (res == FR_OK) res = sync_window(fs);
 	if (res == FR_OK) {
 		if (fs->fsi_flag == 1) {	/* Allocation changed? */
 			fs->fsi_flag = 0;
@@ -1183,7 +1298,7 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 	DWORD clst		/* Cluster number to get the value */
 )
 {
-	UINT wc, bc;
+	UINT wc, bc, i;
 	DWORD val;
 	FATFS *fs = obj->fs;
 
@@ -1197,21 +1312,21 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 		switch (fs->fs_type) {
 		case FS_FAT12 :
 			bc = (UINT)clst; bc += bc / 2;
-			if (move_window(fs, fs->fatbase + (bc / SS(fs))) != FR_OK) break;
-			wc = fs->win[bc++ % SS(fs)];		/* Get 1st byte of the entry */
-			if (move_window(fs, fs->fatbase + (bc / SS(fs))) != FR_OK) break;
-			wc |= fs->win[bc % SS(fs)] << 8;	/* Merge 2nd byte of the entry */
+			if ((i = fat_slot(fs, fs->fatbase + (bc / SS(fs)))) == FC_SECTORS) break;
+			wc = fs->fc_buf[i][bc++ % SS(fs)];		/* Get 1st byte of the entry */
+			if ((i = fat_slot(fs, fs->fatbase + (bc / SS(fs)))) == FC_SECTORS) break;
+			wc |= fs->fc_buf[i][bc % SS(fs)] << 8;	/* Merge 2nd byte of the entry */
 			val = (clst & 1) ? (wc >> 4) : (wc & 0xFFF);	/* Adjust bit position */
 			break;
 
 		case FS_FAT16 :
-			if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 2))) != FR_OK) break;
-			val = ld_16(fs->win + clst * 2 % SS(fs));		/* Simple WORD array */
+			if ((i = fat_slot(fs, fs->fatbase + (clst / (SS(fs) / 2)))) == FC_SECTORS) break;
+			val = ld_16(fs->fc_buf[i] + clst * 2 % SS(fs));		/* Simple WORD array */
 			break;
 
 		case FS_FAT32 :
-			if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4))) != FR_OK) break;
-			val = ld_32(fs->win + clst * 4 % SS(fs)) & 0x0FFFFFFF;	/* Simple DWORD array but mask out upper 4 bits */
+			if ((i = fat_slot(fs, fs->fatbase + (clst / (SS(fs) / 4)))) == FC_SECTORS) break;
+			val = ld_32(fs->fc_buf[i] + clst * 4 % SS(fs)) & 0x0FFFFFFF;	/* Simple DWORD array but mask out upper 4 bits */
 			break;
 #if FF_FS_EXFAT
 		case FS_EXFAT :
@@ -1231,8 +1346,8 @@ static DWORD get_fat (		/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFF
 					if (obj->n_frag != 0) {	/* Is it on the growing edge? */
 						val = 0x7FFFFFFF;	/* Generate EOC */
 					} else {
-						if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4))) != FR_OK) break;
-						val = ld_32(fs->win + clst * 4 % SS(fs)) & 0x7FFFFFFF;
+						if ((i = fat_slot(fs, fs->fatbase + (clst / (SS(fs) / 4)))) == FC_SECTORS) break;
+						val = ld_32(fs->fc_buf[i] + clst * 4 % SS(fs)) & 0x7FFFFFFF;
 					}
 					break;
 				}
@@ -1262,7 +1377,7 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 	DWORD val		/* New value to be set to the entry */
 )
 {
-	UINT bc;
+	UINT bc, i;
 	BYTE *p;
 	FRESULT res = FR_INT_ERR;
 
@@ -1271,38 +1386,47 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 		switch (fs->fs_type) {
 		case FS_FAT12:
 			bc = (UINT)clst; bc += bc / 2;	/* bc: byte offset of the entry */
-			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
+			res = (i = fat_slot(fs, fs->fatbase + (bc / SS(fs)))) == FC_SECTORS ? FR_DISK_ERR : FR_OK;
 			if (res != FR_OK) break;
-			p = fs->win + bc++ % SS(fs);
+			p = fs->fc_buf[i] + bc++ % SS(fs);
 			*p = (clst & 1) ? ((*p & 0x0F) | ((BYTE)val << 4)) : (BYTE)val;	/* Update 1st byte */
-			fs->wflag = 1;
-			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
+			fs->fc_dirty |= (DWORD)1 << i;
+			res = (i = fat_slot(fs, fs->fatbase + (bc / SS(fs)))) == FC_SECTORS ? FR_DISK_ERR : FR_OK;
 			if (res != FR_OK) break;
-			p = fs->win + bc % SS(fs);
+			p = fs->fc_buf[i] + bc % SS(fs);
 			*p = (clst & 1) ? (BYTE)(val >> 4) : ((*p & 0xF0) | ((BYTE)(val >> 8) & 0x0F));	/* Update 2nd byte */
-			fs->wflag = 1;
+			fs->fc_dirty |= (DWORD)1 << i;
 			break;
 
 		case FS_FAT16:
-			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)));
+			res = (i = fat_slot(fs, fs->fatbase + (clst / (SS(fs) / 2)))) == FC_SECTORS ? FR_DISK_ERR : FR_OK;
 			if (res != FR_OK) break;
-			st_16(fs->win + clst * 2 % SS(fs), (WORD)val);	/* Simple WORD array */
-			fs->wflag = 1;
+			st_16(fs->fc_buf[i] + clst * 2 % SS(fs), (WORD)val);	/* Simple WORD array */
+			fs->fc_dirty |= (DWORD)1 << i;
 			break;
 
 		case FS_FAT32:
 #if FF_FS_EXFAT
 		case FS_EXFAT:
 #endif
-			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)));
+			res = (i = fat_slot(fs, fs->fatbase + (clst / (SS(fs) / 4)))) == FC_SECTORS ? FR_DISK_ERR : FR_OK;
 			if (res != FR_OK) break;
 			if (!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) {
-				val = (val & 0x0FFFFFFF) | (ld_32(fs->win + clst * 4 % SS(fs)) & 0xF0000000);
+				val = (val & 0x0FFFFFFF) | (ld_32(fs->fc_buf[i] + clst * 4 % SS(fs)) & 0xF0000000);
 			}
-			st_32(fs->win + clst * 4 % SS(fs), val);
-			fs->wflag = 1;
+			st_32(fs->fc_buf[i] + clst * 4 % SS(fs), val);
+			fs->fc_dirty |= (DWORD)1 << i;
 			break;
 		}
+#if CLUSTER_BITMAP
+		if (res == FR_OK && fs->cbm && fs->fs_type != FS_EXFAT) {	/* Reflect it to the cluster bitmap */
+			if (val & 0x0FFFFFFF) {
+				fs->cbm[clst / 32] |= 0x80000000 >> clst % 32;
+			} else {
+				fs->cbm[clst / 32] &= ~(0x80000000 >> clst % 32);
+			}
+		}
+#endif
 	}
 	return res;
 }
@@ -1312,6 +1436,122 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 
 
 
+#if CLUSTER_BITMAP
+/*-----------------------------------------------------------------------*/
+/* FAT/FAT32: Cluster bitmap in memory                                   */
+/*-----------------------------------------------------------------------*/
+/* One bit per cluster, set when the FAT entry is not zero, MSB first in
+/  each DWORD. It is built on the first allocation or free cluster count
+/  after mount and kept up to date by put_fat(). If it cannot be allocated
+/  or the FAT cannot be read, allocation searches the FAT instead until the
+/  volume is remounted. */
+
+static void cbm_reset (
+	FATFS* fs		/* Filesystem object */
+)
+{
+	if (fs->cbm) ff_memfree(fs->cbm);
+	fs->cbm = 0;
+	fs->cbm_stat = 0;
+}
+
+
+static FRESULT cbm_build (	/* FR_OK:Built, FR_NOT_ENOUGH_CORE:Not available, FR_DISK_ERR */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	DWORD *cbm, clst, nw, nfree = 0, stat;
+	LBA_t sect;
+	UINT i = 0, slot = 0;
+	FFOBJID obj;
+
+
+	if (fs->cbm) return FR_OK;
+	if (fs->cbm_stat || fs->fs_type == FS_EXFAT) return FR_NOT_ENOUGH_CORE;
+	nw = (fs->n_fatent + 31) / 32;
+	cbm = (nw * 4 <= PELI_FAT_CLUSTER_BITMAP_SIZE) ? (DWORD*)ff_memalloc(nw * 4) : 0;
+	if (!cbm) {
+		fs->cbm_stat = 1;		/* Do not try again until remounted */
+		return FR_NOT_ENOUGH_CORE;
+	}
+	memset(cbm, 0xFF, nw * 4);	/* Clusters 0, 1 and beyond the end are never free */
+
+	if (fs->fs_type == FS_FAT12) {	/* FAT12: Bit field entries */
+		obj.fs = fs;
+		for (clst = 2; clst < fs->n_fatent; clst++) {
+			stat = get_fat(&obj, clst);
+			if (stat == 0xFFFFFFFF || stat == 1) break;
+			if (stat == 0) { cbm[clst / 32] &= ~(0x80000000 >> clst % 32); nfree++; }
+		}
+		if (clst < fs->n_fatent) {
+			ff_memfree(cbm);
+			fs->cbm_stat = 1;	/* Do not try again until remounted */
+			return FR_DISK_ERR;
+		}
+	} else {					/* FAT16/32: WORD/DWORD entries */
+		sect = fs->fatbase;
+		for (clst = 0; clst < fs->n_fatent; clst++) {
+			if (i == 0 && (slot = fat_slot(fs, sect++)) == FC_SECTORS) {
+				ff_memfree(cbm);
+				fs->cbm_stat = 1;	/* Do not try again until remounted */
+				return FR_DISK_ERR;
+			}
+			if (fs->fs_type == FS_FAT16) {
+				stat = ld_16(fs->fc_buf[slot] + i); i += 2;
+			} else {
+				stat = ld_32(fs->fc_buf[slot] + i) & 0x0FFFFFFF; i += 4;
+			}
+			i %= SS(fs);
+			if (stat == 0 && clst >= 2) { cbm[clst / 32] &= ~(0x80000000 >> clst % 32); nfree++; }
+		}
+	}
+
+	fs->cbm = cbm;
+	fs->free_clst = nfree;		/* Now free cluster count is valid */
+	fs->fsi_flag |= 1;
+	return FR_OK;
+}
+
+
+static DWORD cbm_find (	/* 0:Not found, 2..:Cluster block found */
+	FATFS* fs,		/* Filesystem object */
+	DWORD clst,		/* Cluster number to scan from */
+	DWORD ncl		/* Number of contiguous clusters to find (1..) */
+)
+{
+	DWORD val, scl = 0, ctr = 0, bm;
+	UINT sh, n, k;
+	int wrap = 0;
+
+
+	if (clst < 2 || clst >= fs->n_fatent) clst = 2;
+	val = clst;
+	for (;;) {
+		if (val >= fs->n_fatent) {	/* Wrap around, a block does not continue over the end */
+			if (wrap) return 0;
+			val = 2; ctr = 0; wrap = 1;
+		}
+		if (wrap && val >= clst && ctr == 0) return 0;	/* All clusters have been checked */
+		sh = val % 32; n = 32 - sh;	/* Bit position of val and bits left in the word */
+		if (ctr == 0) {				/* Find the top of a free block */
+			bm = ~fs->cbm[val / 32] << sh;
+			if (bm == 0) { val += n; continue; }	/* No free cluster in the rest of the word */
+			k = __builtin_clz(bm);
+			val += k; sh += k; n -= k; scl = val;
+		}
+		bm = fs->cbm[val / 32] << sh;	/* Count free clusters from val */
+		k = bm ? __builtin_clz(bm) : 32;
+		if (k > n) k = n;
+		ctr += k; val += k;
+		if (ctr >= ncl) return scl;		/* Found a block large enough */
+		if (k < n) ctr = 0;			/* The block ended in this word */
+	}
+}
+#endif
+
+
+
+
 #if FF_FS_EXFAT && !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* exFAT: Accessing FAT and Allocation Bitmap                            */
@@ -1591,6 +1831,9 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 	} else
 #endif
 	{	/* On the FAT/FAT32 volume */
+#if CLUSTER_BITMAP
+		if (cbm_build(fs) == FR_DISK_ERR) return 0xFFFFFFFF;	/* Build the cluster bitmap if not yet */
+#endif
 		ncl = 0;
 		if (scl == clst) {						/* Stretching an existing chain? */
 			ncl = scl + 1;						/* Test if next cluster is free */
@@ -1604,8 +1847,13 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 			}
 		}
 		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
-			ncl = scl;	/* Start cluster */
-			for (;;) {
+#if CLUSTER_BITMAP
+			if (fs->cbm) {
+				ncl = cbm_find(fs, scl + 1, 1);	/* Find a free cluster in the bitmap */
+				if (ncl == 0) return 0;			/* No free cluster */
+			} else
+#endif
+			for (ncl = scl;;) {
 				ncl++;							/* Next cluster */
 				if (ncl >= fs->n_fatent) {		/* Check wrap-around */
 					ncl = 2;
@@ -1658,6 +1906,16 @@ static DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
 
 	tbl = fp->cltbl + 1;	/* Top of CLMT */
 	cl = (DWORD)(ofs / SS(fs) / fs->csize);	/* Cluster order from top of the file */
+	if (fp->cltbl == fp->clmap) {	/* Automatic map: end order of each fragment, binary search */
+		UINT lo = 0, hi = (fp->cltbl[0] - 2) / 2, mid;
+
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (cl < tbl[mid * 2]) hi = mid; else lo = mid + 1;
+		}
+		if (lo == (fp->cltbl[0] - 2) / 2) return 0;	/* Beyond the end (error) */
+		return cl - (lo == 0 ? 0 : tbl[lo * 2 - 2]) + tbl[lo * 2 + 1];
+	}
 	for (;;) {
 		ncl = *tbl++;			/* Number of cluters in the fragment */
 		if (ncl == 0) return 0;	/* End of table? (error) */
@@ -1667,11 +1925,147 @@ static DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
 	return cl + *tbl;	/* Return the cluster number */
 }
 
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Create link map table                                  */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT clmt_create (	/* FR_OK, FR_NOT_ENOUGH_CORE: Table too small, or error */
+	FIL* fp			/* Pointer to the file object, cltbl[0] holds the table size */
+)
+{
+	DWORD cl, pcl, ncl, tcl, tlen, ulen;
+	DWORD *tbl;
+	FATFS *fs = fp->obj.fs;
+
+
+	tbl = fp->cltbl;
+	tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
+	cl = fp->obj.sclust;		/* Origin of the chain */
+	if (cl != 0) {
+		do {
+			/* Get a fragment */
+			tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
+			do {
+				pcl = cl; ncl++;
+				cl = get_fat(&fp->obj, cl);
+				if (cl <= 1) return FR_INT_ERR;
+				if (cl == 0xFFFFFFFF) return FR_DISK_ERR;
+			} while (cl == pcl + 1);
+			if (ulen <= tlen) {		/* Store the length and top of the fragment */
+				*tbl++ = ncl; *tbl++ = tcl;
+			}
+		} while (cl < fs->n_fatent);	/* Repeat until end of chain */
+	}
+	*fp->cltbl = ulen;	/* Number of items used */
+	if (ulen > tlen) return FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
+	*tbl = 0;		/* Terminate table */
+	return FR_OK;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Automatic link map for large files                     */
+/*-----------------------------------------------------------------------*/
+
+static void clmt_release (	/* Also called when the chain changes, so a map may fit again */
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	fp->clfail = 0;
+	if (fp->clmap) {
+		if (fp->cltbl == fp->clmap) fp->cltbl = 0;
+		ff_linkmap_free(fp->clmap);
+		fp->clmap = 0;
+	}
+}
+
+
+static FRESULT clmt_auto (	/* FR_OK: Mapped or left to the FAT, or a disk error */
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t ofs		/* Offset being seeked to */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	DWORD *tbl, n, i;
+	FRESULT res;
+
+
+	if (fp->clmap && ofs > fp->obj.objsize && (fp->flag & FA_WRITE)) {	/* Seeking past the end stretches the chain */
+		clmt_release(fp);
+		return FR_OK;
+	}
+	if (fp->cltbl || fp->clfail) return FR_OK;	/* Already mapped, application table or gave up */
+	if (fp->obj.objsize < PELI_FAT_LINKMAP_THRESHOLD || ofs > fp->obj.objsize) return FR_OK;
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT && fp->obj.stat == 2) return FR_OK;	/* Contiguous, nothing to walk */
+#endif
+	(void)fs;
+
+	fp->clmap = ff_linkmap_alloc();
+	if (!fp->clmap) return FR_OK;	/* Pool exhausted, try again on a later seek */
+	fp->clmap[0] = PELI_FAT_LINKMAP_SIZE;
+	fp->cltbl = fp->clmap;
+	res = clmt_create(fp);
+	if (res != FR_OK) {
+		clmt_release(fp);
+		if (res != FR_NOT_ENOUGH_CORE) return res;	/* Broken chain or disk error */
+		fp->clfail = 1;		/* Too fragmented for the table, keep using the FAT until the chain changes */
+		return FR_OK;
+	}
+
+	/* Turn fragment lengths into end orders for the binary search */
+	tbl = fp->clmap + 1;
+	for (n = 0, i = 0; tbl[i] != 0; i += 2) {
+		n += tbl[i]; tbl[i] = n;
+	}
+	return FR_OK;
+}
+
 #endif	/* FF_USE_FASTSEEK */
 
 
 
 
+/*-----------------------------------------------------------------------*/
+/* File handling - Extend a direct transfer over contiguous clusters     */
+/*-----------------------------------------------------------------------*/
+
+static UINT run_sectors (	/* Number of sectors that can be transferred in one go (<= cc) */
+	FIL* fp,		/* Pointer to the file object, fp->clust is updated to the last cluster of the run */
+	UINT csect,		/* Sector offset of fp->fptr in the current cluster */
+	UINT cc,		/* Number of whole sectors requested */
+	int stretch		/* 0:Follow the chain, 1:Follow or stretch the chain */
+)
+{
+	FATFS *fs = fp->obj.fs;
+	DWORD clst = fp->clust, ncl;
+	UINT n = fs->csize - csect;	/* Sectors up to the cluster boundary */
+
+
+	while (n < cc) {	/* Take in the next cluster while it is physically next to the current one */
+#if FF_USE_FASTSEEK
+		if (fp->cltbl) {
+			ncl = clmt_clust(fp, fp->fptr + (FSIZE_t)n * SS(fs));
+		} else
+#endif
+		{
+#if !FF_FS_READONLY
+			ncl = stretch ? create_chain(&fp->obj, clst) : get_fat(&fp->obj, clst);
+#else
+			ncl = get_fat(&fp->obj, clst);
+#endif
+		}
+		if (ncl != clst + 1) break;	/* Fragmented, end of chain or error (left to the caller's next cluster step) */
+		clst = ncl; n += fs->csize;
+	}
+	fp->clust = clst;
+	return (n < cc) ? n : cc;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Fill a cluster with zeros                        */
 /*-----------------------------------------------------------------------*/
@@ -2411,29 +2805,35 @@ static FRESULT dir_read (
 
 
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Find an object in the directory                  */
+/* Directory handling - Scan the directory for an object                 */
 /*-----------------------------------------------------------------------*/
 
-static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp					/* Pointer to the directory object with the file name */
+static FRESULT dir_scan (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,				/* Pointer to the directory object with the file name */
+	int single,				/* 0:Whole directory from the top, 1:Only the entry block at the current position */
+	UINT* n_ent				/* Returns number of entries (exFAT: objects) passed over (can be null) */
 )
 {
-	FRESULT res;
+	FRESULT res = FR_OK;
 	FATFS *fs = dp->obj.fs;
 	BYTE et;
+	UINT n = 0;
 #if FF_USE_LFN
 	BYTE attr, ord, sum;
 #endif
 
-	res = dir_sdi(dp, 0);			/* Rewind directory object */
-	if (res != FR_OK) return res;
+	if (!single) {
+		res = dir_sdi(dp, 0);			/* Rewind directory object */
+		if (res != FR_OK) return res;
+	}
 #if FF_FS_EXFAT
 	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
 		BYTE nc;
 		UINT di, ni;
 		WORD hash = xname_sum(fs->lfnbuf);		/* Hash value of the name to find */
 
-		while ((res = DIR_READ_FILE(dp)) == FR_OK) {	/* Read an item */
+		while ((res = (single && n) ? FR_NO_FILE : DIR_READ_FILE(dp)) == FR_OK) {	/* Read an item (only one if single) */
+			n++;
 #if FF_MAX_LFN < 255
 			if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) continue;		/* Skip comparison if inaccessible object name */
 #endif
@@ -2444,6 +2844,7 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 			}
 			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
 		}
+		if (n_ent) *n_ent = n;
 		return res;
 	}
 #endif
@@ -2456,6 +2857,7 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		if (res != FR_OK) break;
 		et = dp->dir[DIR_Name];		/* Entry type */
 		if (et == 0) { res = FR_NO_FILE; break; }	/* Reached end of directory table */
+		n++;
 #if FF_USE_LFN		/* LFN configuration */
 		dp->obj.attr = attr = dp->dir[DIR_Attr] & AM_MASK;
 		if (et == DDEM || ((attr & AM_VOL) && attr != AM_LFN)) {	/* An entry without valid data */
@@ -2478,18 +2880,422 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 				ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Not matched, reset LFN sequence */
 			}
 		}
+		if (single && attr != AM_LFN) { res = FR_NO_FILE; break; }	/* End of the entry block */
 #else		/* Non LFN configuration */
 		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
 		if (!(dp->dir[DIR_Attr] & AM_VOL) && !memcmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
+		if (single) { res = FR_NO_FILE; break; }
 #endif
 		res = dir_next(dp, 0);	/* Next entry */
 	} while (res == FR_OK);
 
+	if (n_ent) *n_ent = n;
 	return res;
 }
 
 
 
+#define DIR_INDEX	(FF_USE_LFN == 3 && PELI_FAT_DIR_INDEX_COUNT > 0)
+
+#if DIR_INDEX
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Hashed index of large directories                */
+/*-----------------------------------------------------------------------*/
+/* A directory found to hold PELI_FAT_DIR_INDEX_MIN entries or more by a
+/  linear search gets an index of its entry blocks keyed by name hash. Each
+/  block is recorded under the hash of its up-case converted LFN and, on the
+/  FAT volume, also under the hash of its SFN. A lookup only verifies the
+/  blocks whose hash matched. The volume keeps PELI_FAT_DIR_INDEX_COUNT of
+/  them and replaces the least recently used one. */
+
+typedef struct {
+	DWORD hash;		/* Name hash */
+	DWORD ofs;		/* Offset of the entry block in the directory (0xFFFFFFFF:removed) */
+	WORD next;		/* Next record in the bucket (0xFFFF:end) */
+} DIRREC;
+
+struct DIRIDX {
+	DWORD sclust;	/* Start cluster of the directory (0:root) */
+	DWORD use;		/* Last use of the index */
+	UINT n_rec;		/* Number of records stored */
+	UINT n_max;		/* Number of records allocated (0:directory too large to index) */
+	DIRREC* rec;	/* Records */
+	WORD* bkt;		/* Head record of each bucket, n_max of them */
+};
+
+static_assert(PELI_FAT_DIR_INDEX_ENTRIES <= 0x8000 && (PELI_FAT_DIR_INDEX_ENTRIES & (PELI_FAT_DIR_INDEX_ENTRIES - 1)) == 0);
+
+
+static DWORD didx_mix (	/* Hash of a character at a position */
+	DWORD chr,		/* Up-case converted character (0:end of the name) */
+	UINT pos		/* Position in the name */
+)
+{
+	DWORD h = (chr ^ (DWORD)pos << 20) * 0x9E3779B1;
+
+	return h ^ (h >> 16);
+}
+
+
+/* The hash is a sum over the characters so that LFN entries stored in
+/  reverse order can be added up as they come */
+
+static DWORD didx_name_hash (	/* Hash of a file name */
+	const WCHAR* name	/* File name */
+)
+{
+	DWORD h = 0;
+	UINT i;
+
+
+	for (i = 0; name[i]; i++) h += didx_mix(ff_wtoupper(name[i]), i);
+	return h + didx_mix(0, i);
+}
+
+
+static DWORD didx_sfn_hash (	/* Hash of an SFN */
+	const BYTE* sfn		/* SFN in directory entry format */
+)
+{
+	DWORD h = 0;
+	UINT i;
+
+
+	for (i = 0; i < 11; i++) h += didx_mix(sfn[i], i);
+	return ~h;
+}
+
+
+static DWORD didx_lfn_hash (	/* Part of the name hash held in an LFN entry */
+	const BYTE* dir		/* Pointer to the LFN entry */
+)
+{
+	DWORD h = 0;
+	UINT ni, di;
+	WCHAR chr;
+
+
+	ni = (UINT)((dir[LDIR_Ord] & ~LLEF) - 1) * 13;	/* Position of the first character */
+	for (di = 0; di < 13; di++, ni++) {
+		chr = ld_16(dir + LfnOfs[di]);
+		if (chr == 0) break;
+		h += didx_mix(ff_wtoupper(chr), ni);
+	}
+	if (chr == 0 || (dir[LDIR_Ord] & LLEF)) h += didx_mix(0, ni);	/* End of the name */
+	return h;
+}
+
+
+static DIRIDX* didx_find_idx (	/* Index of the directory, 0:None */
+	FATFS* fs,		/* Filesystem object */
+	DWORD sclust	/* Start cluster of the directory */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < PELI_FAT_DIR_INDEX_COUNT; i++) {
+		if (fs->didx[i] && fs->didx[i]->sclust == sclust) {
+			fs->didx[i]->use = ++fs->didx_tick;
+			return fs->didx[i];
+		}
+	}
+	return 0;
+}
+
+
+static DIRIDX* didx_create (	/* New empty index, 0:Not enough memory */
+	DWORD sclust,	/* Start cluster of the directory */
+	UINT n_max		/* Number of records, power of 2 */
+)
+{
+	DIRIDX *idx;
+	UINT i;
+
+
+	idx = (DIRIDX*)ff_memalloc(sizeof (DIRIDX) + n_max * (sizeof (DIRREC) + sizeof (WORD)));
+	if (!idx) return 0;
+	idx->sclust = sclust;
+	idx->use = 0;
+	idx->n_rec = 0;
+	idx->n_max = n_max;
+	idx->rec = (DIRREC*)(idx + 1);
+	idx->bkt = (WORD*)(idx->rec + n_max);
+	for (i = 0; i < n_max; i++) idx->bkt[i] = 0xFFFF;
+	return idx;
+}
+
+
+static void didx_install (
+	FATFS* fs,		/* Filesystem object */
+	DIRIDX* idx		/* Index to keep, replacing the one of the same directory or the least recently used one */
+)
+{
+	UINT i, v;
+
+
+	for (i = v = 0; i < PELI_FAT_DIR_INDEX_COUNT; i++) {
+		if (!fs->didx[i] || fs->didx[i]->sclust == idx->sclust) { v = i; break; }
+		if (fs->didx[i]->use < fs->didx[v]->use) v = i;
+	}
+	if (fs->didx[v]) ff_memfree(fs->didx[v]);
+	idx->use = ++fs->didx_tick;
+	fs->didx[v] = idx;
+}
+
+
+static void didx_drop (
+	FATFS* fs,		/* Filesystem object */
+	DWORD sclust	/* Start cluster of the directory whose index is to be discarded */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < PELI_FAT_DIR_INDEX_COUNT; i++) {
+		if (fs->didx[i] && fs->didx[i]->sclust == sclust) {
+			ff_memfree(fs->didx[i]);
+			fs->didx[i] = 0;
+		}
+	}
+}
+
+
+static void didx_drop_all (
+	FATFS* fs		/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < PELI_FAT_DIR_INDEX_COUNT; i++) {
+		if (fs->didx[i]) ff_memfree(fs->didx[i]);
+		fs->didx[i] = 0;
+	}
+	fs->didx_tick = 0;
+}
+
+
+static int didx_put (	/* 1:Stored, 0:Could not grow the index */
+	DIRIDX** pidx,	/* Index, replaced when it grows */
+	DWORD hash,		/* Name hash */
+	DWORD ofs		/* Offset of the entry block */
+)
+{
+	DIRIDX *idx = *pidx, *nidx;
+	DIRREC *rec;
+	UINT i, b;
+
+
+	if (idx->n_rec == idx->n_max) {	/* Full? Move the live records to a double sized one */
+		if (idx->n_max * 2 > PELI_FAT_DIR_INDEX_ENTRIES) return 0;
+		nidx = didx_create(idx->sclust, idx->n_max * 2);
+		if (!nidx) return 0;
+		nidx->use = idx->use;
+		for (i = 0; i < idx->n_rec; i++) {
+			rec = &idx->rec[i];
+			if (rec->ofs == 0xFFFFFFFF) continue;
+			b = rec->hash & (nidx->n_max - 1);
+			nidx->rec[nidx->n_rec].hash = rec->hash;
+			nidx->rec[nidx->n_rec].ofs = rec->ofs;
+			nidx->rec[nidx->n_rec].next = nidx->bkt[b];
+			nidx->bkt[b] = (WORD)nidx->n_rec++;
+		}
+		ff_memfree(idx);
+		*pidx = idx = nidx;
+		if (idx->n_rec == idx->n_max) return 0;
+	}
+	b = hash & (idx->n_max - 1);
+	idx->rec[idx->n_rec].hash = hash;
+	idx->rec[idx->n_rec].ofs = ofs;
+	idx->rec[idx->n_rec].next = idx->bkt[b];
+	idx->bkt[b] = (WORD)idx->n_rec++;
+	return 1;
+}
+
+
+static FRESULT didx_build (	/* FR_OK:Index installed, FR_NOT_ENOUGH_CORE:Not indexed, or disk error */
+	DIR* dp			/* Directory object, its position is lost */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DIRIDX *idx;
+	DWORD lhash = 0, ofs = 0;
+	BYTE et, attr, ord = 0xFF, sum = 0xFF;
+	int ok = 1;
+
+
+	idx = didx_create(dp->obj.sclust, 256);
+	if (!idx) return FR_NOT_ENOUGH_CORE;
+
+	res = dir_sdi(dp, 0);
+#if FF_FS_EXFAT
+	if (res == FR_OK && fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		BYTE nc;
+		UINT di, ni;
+
+		while (ok && (res = DIR_READ_FILE(dp)) == FR_OK) {
+			for (lhash = 0, nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {
+				if ((di % SZDIRE) == 0) di += 2;
+				lhash += didx_mix(ff_wtoupper(ld_16(fs->dirbuf + di)), ni);
+			}
+			ok = didx_put(&idx, lhash + didx_mix(0, ni), dp->blk_ofs);
+		}
+	} else
+#endif
+	while (ok && res == FR_OK) {	/* On the FAT/FAT32 volume */
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		et = dp->dir[DIR_Name];
+		if (et == 0) { res = FR_NO_FILE; break; }	/* End of directory table */
+		attr = dp->dir[DIR_Attr] & AM_MASK;
+		if (et == DDEM || ((attr & AM_VOL) && attr != AM_LFN)) {	/* An entry without valid data */
+			ord = 0xFF;
+		} else if (attr == AM_LFN) {
+			if (et & LLEF) {			/* Start of an entry block */
+				et &= (BYTE)~LLEF;
+				ord = et; ofs = dp->dptr; sum = dp->dir[LDIR_Chksum]; lhash = 0;
+			}
+			if (et == ord && sum == dp->dir[LDIR_Chksum]) {
+				lhash += didx_lfn_hash(dp->dir); ord--;
+			} else {
+				ord = 0xFF;
+			}
+		} else {						/* SFN entry */
+			if (ord == 0 && sum == sum_sfn(dp->dir)) {	/* With a valid LFN */
+				ok = didx_put(&idx, lhash, ofs);
+			} else {
+				ofs = dp->dptr;
+			}
+			if (ok) ok = didx_put(&idx, didx_sfn_hash(dp->dir), ofs);
+			ord = 0xFF;
+		}
+		if (ok) res = dir_next(dp, 0);
+	}
+
+	if (res != FR_OK && res != FR_NO_FILE) {	/* Disk error */
+		ff_memfree(idx);
+		return res;
+	}
+	if (!ok) {	/* Too large, remember it to keep using the linear search */
+		ff_memfree(idx);
+		idx = didx_create(dp->obj.sclust, 0);
+		if (!idx) return FR_NOT_ENOUGH_CORE;
+		didx_install(fs, idx);
+		return FR_NOT_ENOUGH_CORE;
+	}
+	didx_install(fs, idx);
+	return FR_OK;
+}
+
+
+static FRESULT didx_lookup (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,		/* Pointer to the directory object with the file name */
+	DIRIDX* idx		/* Index of the directory */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DWORD hash[2];
+	DIRREC *rec;
+	UINT i, r;
+	BYTE by[2];
+
+
+	by[0] = !(dp->fn[NSFLAG] & NS_NOLFN);	/* By the LFN */
+	by[1] = fs->fs_type != FS_EXFAT && !(dp->fn[NSFLAG] & NS_LOSS);	/* By the SFN */
+	hash[0] = by[0] ? didx_name_hash(fs->lfnbuf) : 0;
+	hash[1] = by[1] ? didx_sfn_hash(dp->fn) : 0;
+	for (i = 0; i < 2; i++) {
+		if (!by[i]) continue;
+		for (r = idx->bkt[hash[i] & (idx->n_max - 1)]; r != 0xFFFF; r = rec->next) {
+			rec = &idx->rec[r];
+			if (rec->hash != hash[i] || rec->ofs == 0xFFFFFFFF) continue;
+			res = dir_sdi(dp, rec->ofs);
+			if (res == FR_OK) res = dir_scan(dp, 1, 0);		/* Verify the entry block */
+			if (res != FR_NO_FILE) return res;
+		}
+	}
+	return FR_NO_FILE;
+}
+
+
+#if !FF_FS_READONLY
+static void didx_add (
+	DIR* dp,		/* Directory object of a newly registered entry block */
+	DWORD ofs,		/* Offset of the entry block */
+	int lfn			/* Has an LFN */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	DIRIDX *idx = didx_find_idx(fs, dp->obj.sclust);
+	UINT i;
+	int ok = 1;
+
+
+	if (!idx || idx->n_max == 0) return;
+	for (i = 0; i < PELI_FAT_DIR_INDEX_COUNT && fs->didx[i] != idx; i++) ;
+	if (lfn) ok = didx_put(&fs->didx[i], didx_name_hash(fs->lfnbuf), ofs);
+	if (ok && fs->fs_type != FS_EXFAT) ok = didx_put(&fs->didx[i], didx_sfn_hash(dp->fn), ofs);
+	if (!ok) didx_drop(fs, dp->obj.sclust);	/* Lost track of the directory */
+}
+
+
+static void didx_remove (
+	DIR* dp,		/* Directory object of the entry block removed */
+	DWORD ofs		/* Offset of the entry block */
+)
+{
+	DIRIDX *idx = didx_find_idx(dp->obj.fs, dp->obj.sclust);
+	UINT i;
+
+
+	if (!idx) return;
+	for (i = 0; i < idx->n_rec; i++) {
+		if (idx->rec[i].ofs == ofs) idx->rec[i].ofs = 0xFFFFFFFF;
+	}
+}
+#endif
+
+#endif	/* DIR_INDEX */
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Find an object in the directory                  */
+/*-----------------------------------------------------------------------*/
+
+static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+#if DIR_INDEX
+	FRESULT res;
+	DIRIDX *idx = didx_find_idx(dp->obj.fs, dp->obj.sclust);
+	UINT n;
+
+
+	if (idx && idx->n_max) return didx_lookup(dp, idx);	/* Indexed directory */
+	res = dir_scan(dp, 0, &n);
+	if (!idx && n >= PELI_FAT_DIR_INDEX_MIN && (res == FR_OK || res == FR_NO_FILE)) {	/* Large directory not indexed yet? */
+		switch (didx_build(dp)) {
+		case FR_OK:
+			return didx_lookup(dp, didx_find_idx(dp->obj.fs, dp->obj.sclust));
+		case FR_NOT_ENOUGH_CORE:
+			return dir_scan(dp, 0, 0);	/* The position was lost, search it again */
+		default:
+			return FR_DISK_ERR;
+		}
+	}
+	return res;
+#else
+	return dir_scan(dp, 0, 0);
+#endif
+}
+
+
+
 
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
@@ -2504,6 +3310,7 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 	FATFS *fs = dp->obj.fs;
 #if FF_USE_LFN		/* LFN configuration */
 	UINT n, len, n_ent;
+	DWORD ofs;
 	BYTE sn[12];
 
 
@@ -2544,6 +3351,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 		}
 
 		create_xdir(fs->dirbuf, fs->lfnbuf);	/* Create on-memory directory block to be written later */
+#if DIR_INDEX
+		didx_add(dp, dp->blk_ofs, 1);
+#endif
 		return FR_OK;
 	}
 #endif
@@ -2564,6 +3374,7 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 	/* Create an SFN with/without LFNs. */
 	n_ent = (sn[NSFLAG] & NS_LFN) ? (len + 12) / 13 + 1 : 1;	/* Number of entries to allocate */
 	res = dir_alloc(dp, n_ent);		/* Allocate entries */
+	ofs = dp->dptr - (n_ent - 1) * SZDIRE;	/* Top of the entry block */
 	if (res == FR_OK && --n_ent) {	/* Set LFN entry if needed */
 		res = dir_sdi(dp, dp->dptr - n_ent * SZDIRE);
 		if (res == FR_OK) {
@@ -2594,6 +3405,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 			dp->dir[DIR_NTres] = dp->fn[NSFLAG] & (NS_BODY | NS_EXT);	/* Put low-case flags */
 #endif
 			fs->wflag = 1;
+#if DIR_INDEX
+			didx_add(dp, ofs, sn[NSFLAG] & NS_LFN);
+#endif
 		}
 	}
 
@@ -2618,6 +3432,9 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 #if FF_USE_LFN		/* LFN configuration */
 	DWORD last = dp->dptr;
 
+#if DIR_INDEX
+	didx_remove(dp, (dp->blk_ofs == 0xFFFFFFFF) ? last : dp->blk_ofs);
+#endif
 	res = (dp->blk_ofs == 0xFFFFFFFF) ? FR_OK : dir_sdi(dp, dp->blk_ofs);	/* Goto top of the entry block if LFN is exist */
 	if (res == FR_OK) {
 		do {
@@ -3504,6 +4321,13 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	/* Following code attempts to mount the volume. (find an FAT volume, analyze the BPB and initialize the filesystem object) */
 
 	fs->fs_type = 0;					/* Invalidate the filesystem object */
+	fat_cache_reset(fs);				/* Discard the FAT sector cache */
+#if CLUSTER_BITMAP
+	cbm_reset(fs);						/* Discard the cluster bitmap */
+#endif
+#if DIR_INDEX
+	didx_drop_all(fs);					/* Discard the directory indexes */
+#endif
 	stat = disk_initialize(fs->pdrv);	/* Initialize the volume hosting physical drive */
 	if (stat & STA_NOINIT) { 			/* Check if the initialization succeeded */
 		return FR_NOT_READY;			/* Failed to initialize due to no medium or hard error */
@@ -3575,8 +4399,8 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 		if (bcl < 2 || bcl >= fs->n_fatent) return FR_NO_FILESYSTEM;	/* (Wrong cluster#) */
 		fs->bitbase = fs->database + fs->csize * (bcl - 2);	/* Bitmap sector */
 		for (;;) {	/* Check if bitmap is contiguous */
-			if (move_window(fs, fs->fatbase + bcl / (SS(fs) / 4)) != FR_OK) return FR_DISK_ERR;
-			cv = ld_32(fs->win + bcl % (SS(fs) / 4) * 4);
+			if ((i = fat_slot(fs, fs->fatbase + bcl / (SS(fs) / 4))) == FC_SECTORS) return FR_DISK_ERR;
+			cv = ld_32(fs->fc_buf[i] + bcl % (SS(fs) / 4) * 4);
 			if (cv == 0xFFFFFFFF) break;				/* Last link? */
 			if (cv != ++bcl) return FR_NO_FILESYSTEM;	/* Fragmented bitmap? */
 		}
@@ -3767,6 +4591,12 @@ FRESULT f_mount (
 		ff_mutex_delete(vol);
 #endif
 		cfs->fs_type = 0;		/* Invalidate the filesystem object to be unregistered */
+#if CLUSTER_BITMAP
+		cbm_reset(cfs);
+#endif
+#if DIR_INDEX
+		didx_drop_all(cfs);
+#endif
 	}
 
 	if (fs) {					/* Register new filesystem object */
@@ -3785,6 +4615,12 @@ FRESULT f_mount (
 #endif
 #endif
 		fs->fs_type = 0;		/* Invalidate the new filesystem object */
+#if CLUSTER_BITMAP
+		fs->cbm = 0; fs->cbm_stat = 0;	/* No cluster bitmap yet */
+#endif
+#if DIR_INDEX
+		memset(fs->didx, 0, sizeof fs->didx);	/* No indexes yet */
+#endif
 		FatFs[vol] = fs;		/* Register it */
 	}
 
@@ -3941,6 +4777,8 @@ FRESULT f_open (
 			}
 #if FF_USE_FASTSEEK
 			fp->cltbl = 0;		/* Disable fast seek mode */
+			fp->clmap = 0;
+			fp->clfail = 0;
 #endif
 			fp->obj.id = fs->id;	/* Set current volume mount ID */
 			fp->flag = mode;	/* Set file access mode */
@@ -4047,8 +4885,8 @@ FRESULT f_read (
 			sect += csect;
 			cc = btr / SS(fs);					/* When remaining bytes >= sector size, */
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
-				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
-					cc = fs->csize - csect;
+				if (csect + cc > fs->csize) {	/* Clip at the end of the contiguous cluster run */
+					cc = run_sectors(fp, csect, cc, 0);
 				}
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
@@ -4123,6 +4961,9 @@ FRESULT f_write (
 	if ((!FF_FS_EXFAT || fs->fs_type != FS_EXFAT) && (DWORD)(fp->fptr + btw) < (DWORD)fp->fptr) {
 		btw = (UINT)(0xFFFFFFFF - (DWORD)fp->fptr);
 	}
+#if FF_USE_FASTSEEK
+	if (fp->fptr + btw > fp->obj.objsize) clmt_release(fp);	/* The chain may be stretched */
+#endif
 
 	for ( ; btw > 0; btw -= wcnt, *bw += wcnt, wbuff += wcnt, fp->fptr += wcnt, fp->obj.objsize = (fp->fptr > fp->obj.objsize) ? fp->fptr : fp->obj.objsize) {	/* Repeat until all data written */
 		if (fp->fptr % SS(fs) == 0) {		/* On the sector boundary? */
@@ -4162,8 +5003,8 @@ FRESULT f_write (
 			sect += csect;
 			cc = btw / SS(fs);				/* When remaining bytes >= sector size, */
 			if (cc > 0) {					/* Write maximum contiguous sectors directly */
-				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
-					cc = fs->csize - csect;
+				if (csect + cc > fs->csize) {	/* Clip at the end of the contiguous cluster run */
+					cc = run_sectors(fp, csect, cc, 1);
 				}
 				if (disk_write(fs->pdrv, wbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if FF_FS_MINIMIZE <= 2
@@ -4315,6 +5156,9 @@ FRESULT f_close (
 	{
 		res = validate(&fp->obj, &fs);	/* Lock volume */
 		if (res == FR_OK) {
+#if FF_USE_FASTSEEK
+			clmt_release(fp);
+#endif
 #if FF_FS_LOCK
 			res = dec_share(fp->obj.lockid);		/* Decrement file open counter */
 			if (res == FR_OK) fp->obj.fs = 0;	/* Invalidate file object */
@@ -4579,36 +5423,20 @@ FRESULT f_lseek (
 	if (res != FR_OK) LEAVE_FF(fs, res);
 
 #if FF_USE_FASTSEEK
+	if (ofs != CREATE_LINKMAP) {
+		res = clmt_auto(fp, ofs);
+		if (res != FR_OK) ABORT(fs, res);
+	}
 	if (fp->cltbl) {	/* Fast seek */
-		DWORD cl, pcl, ncl, tcl, tlen, ulen;
-		DWORD *tbl;
 		LBA_t dsc;
 
 		if (ofs == CREATE_LINKMAP) {	/* Create CLMT */
-			tbl = fp->cltbl;
-			tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
-			cl = fp->obj.sclust;		/* Origin of the chain */
-			if (cl != 0) {
-				do {
-					/* Get a fragment */
-					tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
-					do {
-						pcl = cl; ncl++;
-						cl = get_fat(&fp->obj, cl);
-						if (cl <= 1) ABORT(fs, FR_INT_ERR);
-						if (cl == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
-					} while (cl == pcl + 1);
-					if (ulen <= tlen) {		/* Store the length and top of the fragment */
-						*tbl++ = ncl; *tbl++ = tcl;
-					}
-				} while (cl < fs->n_fatent);	/* Repeat until end of chain */
-			}
-			*fp->cltbl = ulen;	/* Number of items used */
-			if (ulen <= tlen) {
-				*tbl = 0;		/* Terminate table */
-			} else {
-				res = FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
+			if (fp->cltbl == fp->clmap) LEAVE_FF(fs, FR_OK);	/* Automatic map is already there */
+			if (fp->clmap) {	/* Replaced by the application's table */
+				ff_linkmap_free(fp->clmap); fp->clmap = 0;
 			}
+			res = clmt_create(fp);
+			if (res != FR_OK && res != FR_NOT_ENOUGH_CORE) ABORT(fs, res);
 		} else {						/* Fast seek */
 			if (ofs > fp->obj.objsize) ofs = fp->obj.objsize;	/* Clip offset at the file size */
 			fp->fptr = ofs;				/* Set file pointer */
@@ -4951,7 +5779,7 @@ FRESULT f_getfree (
 	FATFS *fs;
 	DWORD nfree, clst, stat;
 	LBA_t sect;
-	UINT i;
+	UINT i, slot = 0;
 	FFOBJID obj = {};
 
 
@@ -4960,6 +5788,9 @@ FRESULT f_getfree (
 
 	if (res == FR_OK) {
 		*fatfs = fs;				/* Return ptr to the fs object */
+#if CLUSTER_BITMAP
+		if (fs->free_clst > fs->n_fatent - 2) cbm_build(fs);	/* Building the cluster bitmap counts free clusters */
+#endif
 		/* If free_clst is valid, return it without full FAT scan */
 		if (fs->free_clst <= fs->n_fatent - 2) {
 			*nclst = fs->free_clst;
@@ -5006,14 +5837,15 @@ FRESULT f_getfree (
 					i = 0;					/* Offset in the sector */
 					do {	/* Counts numbuer of entries with zero in the FAT */
 						if (i == 0) {	/* New sector? */
-							res = move_window(fs, sect++);
-							if (res != FR_OK) break;
+							if ((slot = fat_slot(fs, sect++)) == FC_SECTORS) {
+								res = FR_DISK_ERR; break;
+							}
 						}
 						if (fs->fs_type == FS_FAT16) {
-							if (ld_16(fs->win + i) == 0) nfree++;	/* FAT16: Is this cluster free? */
+							if (ld_16(fs->fc_buf[slot] + i) == 0) nfree++;	/* FAT16: Is this cluster free? */
 							i += 2;	/* Next entry */
 						} else {
-							if ((ld_32(fs->win + i) & 0x0FFFFFFF) == 0) nfree++;	/* FAT32: Is this cluster free? */
+							if ((ld_32(fs->fc_buf[slot] + i) & 0x0FFFFFFF) == 0) nfree++;	/* FAT32: Is this cluster free? */
 							i += 4;	/* Next entry */
 						}
 						i %= SS(fs);
@@ -5053,6 +5885,9 @@ FRESULT f_truncate (
 	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
 
 	if (fp->fptr < fp->obj.objsize) {	/* Process when fptr is not on the eof */
+#if FF_USE_FASTSEEK
+		clmt_release(fp);
+#endif
 		if (fp->fptr == 0) {	/* When set file size to zero, remove entire cluster chain */
 			res = remove_chain(&fp->obj, fp->obj.sclust, 0);
 			fp->obj.sclust = 0;
@@ -5156,6 +5991,9 @@ FRESULT f_unlink (
 		}
 		if (res == FR_OK) {		/* It is ready to remove the object */
 			res = dir_remove(&dj);				/* Remove the directory entry */
+#if DIR_INDEX
+			if (res == FR_OK && (dj.obj.attr & AM_DIR)) didx_drop(fs, dclst);	/* Its cluster may be reused by another directory */
+#endif
 			if (res == FR_OK && dclst != 0) {	/* Remove the cluster chain if exist */
 #if FF_FS_EXFAT
 				res = remove_chain(&obj, dclst, 0);
@@ -5764,6 +6602,23 @@ FRESULT f_expand (
 			}
 		}
 	} else
+#endif
+#if CLUSTER_BITMAP
+	if (cbm_build(fs) == FR_OK) {
+		scl = cbm_find(fs, stcl, tcl);				/* Find a contiguous cluster block in the bitmap */
+		if (scl == 0) res = FR_DENIED;				/* No contiguous cluster block was found */
+		if (res == FR_OK) {	/* A contiguous free area is found */
+			if (opt) {		/* Allocate it now */
+				for (clst = scl, n = tcl; n; clst++, n--) {	/* Create a cluster chain on the FAT */
+					res = put_fat(fs, clst, (n == 1) ? 0xFFFFFFFF : clst + 1);
+					if (res != FR_OK) break;
+					lclst = clst;
+				}
+			} else {		/* Set it as suggested point for next allocation */
+				lclst = scl - 1;
+			}
+		}
+	} else
 #endif
 	{
 		scl = clst = stcl; ncl = 0;
@@ -6105,7 +6960,7 @@ FRESULT f_mkfs (
 	if (sz_buf == 0) return FR_NOT_ENOUGH_CORE;
 	buf = (BYTE*)work;		/* Working buffer */
 #if FF_USE_LFN == 3
-	if (!buf) buf = ff_memalloc(sz_buf * ss);	/* Use heap memory for working buffer */
+	if (!buf) buf = (BYTE*) ff_memalloc(sz_buf * ss);	/* Use heap memory for working buffer */
 #endif
 	if (!buf) return FR_NOT_ENOUGH_CORE;
 
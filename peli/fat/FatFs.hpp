@@ -21,6 +21,7 @@
 #pragma once
 
 #include "../cmn/Types.hpp"
+#include "../host/Config.h"
 #include "Config.hpp"
 
 namespace peli::fat {
@@ -117,6 +118,8 @@ typedef struct {
 
 /* Filesystem object structure (FATFS) */
 
+struct DIRIDX;
+
 struct FATFS {
   BYTE fs_type;   /* Filesystem type (0:not mounted) */
   BYTE pdrv;      /* Physical drive that holds this volume */
@@ -156,10 +159,38 @@ struct FATFS {
   FFXCWDS xcwds2; /* Working buffer to follow the path */
 #endif
 #endif
-  BYTE win[FF_MAX_SS]; /* Disk access window for directory, FAT (and file data
-                          in tiny cfg) */
+  alignas(32) BYTE win[FF_MAX_SS]; /* Disk access window for directory, FAT
+                                      (and file data in tiny cfg) */
+#if !FF_FS_READONLY
+  DWORD fc_dirty;  /* FAT cache dirty slots (bitmap) */
+  DWORD fc_writes; /* FAT write requests since mount (statistics) */
+#endif
+  DWORD fc_tick; /* FAT cache use counter */
+  BYTE fc_last;  /* FAT cache slot used last */
+  LBA_t fc_sect[PELI_FAT_TABLE_CACHE_SECTORS]; /* Sector in each slot */
+  DWORD fc_use[PELI_FAT_TABLE_CACHE_SECTORS];  /* Last use of each slot */
+  alignas(32) BYTE fc_buf[PELI_FAT_TABLE_CACHE_SECTORS]
+                         [FF_MAX_SS]; /* FAT sector cache */
+#if FF_USE_LFN == 3 && !FF_FS_READONLY && PELI_FAT_CLUSTER_BITMAP_SIZE > 0
+  DWORD *cbm;    /* Cluster in-use bitmap on FAT volumes (0:not built) */
+  BYTE cbm_stat; /* Cluster bitmap could not be allocated or read */
+#endif
+#if FF_USE_LFN == 3 && PELI_FAT_DIR_INDEX_COUNT > 0
+  DIRIDX *didx[PELI_FAT_DIR_INDEX_COUNT]; /* Indexes of large directories */
+  DWORD didx_tick;                        /* Directory index use counter */
+#endif
+#if FF_USE_LFN == 3
+  WCHAR lfn_pool[FF_MAX_LFN + 1]; /* LFN working buffer (lfnbuf) */
+#if FF_FS_EXFAT
+  BYTE dir_pool[(FF_MAX_LFN + 44U) / 15 * 32]; /* Directory entry block
+                                                  buffer (dirbuf) */
+#endif
+#endif
 };
 
+static_assert(PELI_FAT_TABLE_CACHE_SECTORS >= 1 &&
+              PELI_FAT_TABLE_CACHE_SECTORS <= 32);
+
 /* Object ID and allocation information (FFOBJID) */
 
 struct FFOBJID {
@@ -206,9 +237,12 @@ struct FIL {
 #if FF_USE_FASTSEEK
   DWORD *cltbl; /* Pointer to the cluster link map table (nulled on open; set by
                    application) */
+  DWORD *clmap; /* Automatic link map table taken from the pool (0:none) */
+  BYTE clfail;  /* Automatic link map didn't fit, don't try again until
+                   the chain changes */
 #endif
 #if !FF_FS_TINY
-  BYTE buf[FF_MAX_SS]; /* File private data read/write window */
+  alignas(32) BYTE buf[FF_MAX_SS]; /* File private data read/write window */
 #endif
 };
 
@@ -378,6 +412,10 @@ DWORD ff_wtoupper(DWORD uni);         /* Unicode upper-case conversion */
 void *ff_memalloc(UINT msize); /* Allocate memory block */
 void ff_memfree(void *mblock); /* Free memory block */
 #endif
+#if FF_USE_FASTSEEK               /* Automatic link map tables */
+DWORD *ff_linkmap_alloc(void);    /* Take a table from the pool */
+void ff_linkmap_free(DWORD *tbl); /* Return a table to the pool */
+#endif
 #if FF_FS_REENTRANT            /* Sync functions */
 int ff_mutex_create(int vol);  /* Create a sync object */
 void ff_mutex_delete(int vol); /* Delete a sync object */
@@ -2,4 +2,217 @@
 //   Written by mkwcat
 //
 // Copyright (c) 2025 mkwcat
-// SPDX-License-Identifier: MIT
\ No newline at end of file
+// SPDX-License-Identifier: MIT
+
+#include "IO.hpp"
+#include "../host/Config.h"
+#include "../host/Host.hpp"
+#include "../util/Address.hpp"
+
+namespace peli::fat {
+
+namespace {
+
+constexpr UINT BounceSize = PELI_FAT_BOUNCE_SIZE;
+constexpr UINT BounceSectors = BounceSize / FF_MAX_SS;
+
+struct Drive {
+  disk::AsyncDeviceTable device;
+  disk::DeviceInfo info;
+  size_t alignment;
+  u8 *bounce;
+  bool registered;
+  bool initialized;
+};
+
+constinit Drive s_drives[FF_VOLUMES] = {};
+
+Drive *getDrive(BYTE pdrv) noexcept {
+  return pdrv < FF_VOLUMES && s_drives[pdrv].registered ? &s_drives[pdrv]
+                                                        : nullptr;
+}
+
+// Transfer straight to or from `buffer`, in as few requests as the device
+// allows and with as many in flight as its queue takes
+int transfer(Drive &drive, u8 *buffer, LBA_t sector, UINT count,
+             bool is_write) noexcept {
+  return drive.device.Device_BlockTransfer(size_t(sector), count, buffer,
+                                           is_write);
+}
+
+DRESULT readWrite(BYTE pdrv, u8 *buffer, LBA_t sector, UINT count,
+                  bool is_write) noexcept {
+  Drive *drive = getDrive(pdrv);
+  if (!drive || !drive->initialized) {
+    return RES_NOTRDY;
+  }
+
+  if (util::IsAligned(drive->alignment, buffer)) {
+    return transfer(*drive, buffer, sector, count, is_write) == 0 ? RES_OK
+                                                                  : RES_ERROR;
+  }
+
+  // Unaligned memory goes through the bounce buffer
+  if (!drive->bounce) {
+    return RES_ERROR;
+  }
+
+  while (count != 0) {
+    const UINT blocks = count < BounceSectors ? count : BounceSectors;
+    if (is_write) {
+      __builtin_memcpy(drive->bounce, buffer, blocks * FF_MAX_SS);
+    }
+    if (transfer(*drive, drive->bounce, sector, blocks, is_write) != 0) {
+      return RES_ERROR;
+    }
+    if (!is_write) {
+      __builtin_memcpy(buffer, drive->bounce, blocks * FF_MAX_SS);
+    }
+
+    buffer += blocks * FF_MAX_SS;
+    sector += blocks;
+    count -= blocks;
+  }
+  return RES_OK;
+}
+
+} // namespace
+
+bool Disk::Register(BYTE pdrv, const disk::AsyncDeviceTable &device) noexcept {
+  if (pdrv >= FF_VOLUMES || s_drives[pdrv].registered) {
+    return false;
+  }
+
+  s_drives[pdrv] = {
+      .device = device,
+      .info = {},
+      .alignment = 32,
+      .bounce = nullptr,
+      .registered = true,
+      .initialized = false,
+  };
+  return true;
+}
+
+void Disk::Deregister(BYTE pdrv) noexcept {
+  Drive *drive = getDrive(pdrv);
+  if (!drive) {
+    return;
+  }
+
+  if (drive->initialized && drive->info.can_flush) {
+    disk::BlockRequest request = {.op = disk::BlockOp::Flush};
+    drive->device.Execute(request);
+  }
+
+  if (drive->bounce) {
+    host::Free(drive->bounce, BounceSize);
+  }
+  *drive = {};
+}
+
+DSTATUS disk_initialize(BYTE pdrv) {
+  Drive *drive = getDrive(pdrv);
+  if (!drive) {
+    return STA_NOINIT | STA_NODISK;
+  }
+
+  if (!drive->device.Available()) {
+    return STA_NOINIT | STA_NODISK;
+  }
+
+  if (!drive->initialized) {
+    if (drive->device.Init() != 0) {
+      return STA_NOINIT;
+    }
+
+    drive->info = drive->device.GetInfo();
+    if (drive->info.block_size != FF_MAX_SS) {
+      return STA_NOINIT;
+    }
+
+    // At least a cache line, so FatFs buffers can't share one with anything
+    // else during DMA
+    drive->alignment = drive->info.alignment > 32 ? drive->info.alignment : 32;
+    drive->initialized = true;
+  }
+
+  if (!drive->bounce) {
+    // Only needed for unaligned transfers, failing here isn't fatal
+    drive->bounce =
+        static_cast<u8 *>(host::Alloc(drive->alignment, BounceSize));
+  }
+  return 0;
+}
+
+DSTATUS disk_status(BYTE pdrv) {
+  Drive *drive = getDrive(pdrv);
+  if (!drive) {
+    return STA_NOINIT | STA_NODISK;
+  }
+  return drive->initialized ? 0 : STA_NOINIT;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count) {
+  return readWrite(pdrv, buff, sector, count, false);
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count) {
+  return readWrite(pdrv, const_cast<BYTE *>(buff), sector, count, true);
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+  Drive *drive = getDrive(pdrv);
+  if (!drive || !drive->initialized) {
+    return RES_NOTRDY;
+  }
+
+  switch (cmd) {
+  case CTRL_SYNC: {
+    if (!drive->info.can_flush) {
+      return RES_OK;
+    }
+    disk::BlockRequest request = {.op = disk::BlockOp::Flush};
+    return drive->device.Execute(request) == 0 ? RES_OK : RES_ERROR;
+  }
+
+  case GET_SECTOR_COUNT:
+    if (drive->info.block_count == 0) {
+      return RES_ERROR;
+    }
+    *static_cast<LBA_t *>(buff) = LBA_t(drive->info.block_count);
+    return RES_OK;
+
+  case GET_SECTOR_SIZE:
+    *static_cast<WORD *>(buff) = WORD(drive->info.block_size);
+    return RES_OK;
+
+  case GET_BLOCK_SIZE: {
+    // Erase block size in sectors, the preferred transfer size is the closest
+    // thing devices report
+    const size_t size = drive->info.preferred_transfer;
+    *static_cast<DWORD *>(buff) =
+        size != 0 && (size & (size - 1)) == 0 ? DWORD(size) : 1;
+    return RES_OK;
+  }
+
+  case CTRL_TRIM: {
+    if (!drive->info.can_trim) {
+      return RES_OK;
+    }
+    // Inclusive start and end sectors
+    const LBA_t *range = static_cast<const LBA_t *>(buff);
+    disk::BlockRequest request = {
+        .op = disk::BlockOp::Trim,
+        .first = range[0],
+        .count = range[1] - range[0] + 1,
+    };
+    return drive->device.Execute(request) == 0 ? RES_OK : RES_ERROR;
+  }
+
+  default:
+    return RES_PARERR;
+  }
+}
+
+} // namespace peli::fat
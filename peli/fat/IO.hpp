@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "../disk/AsyncDeviceTable.hpp"
 #include "FatFs.hpp"
 
 namespace peli::fat {
@@ -29,6 +30,26 @@ DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count);
 DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff);
 
+/**
+ * Devices backing the physical drives, drive N being "N:" in FatFs paths.
+ */
+class Disk {
+public:
+  /**
+   * Attach a device to a drive. The device must stay valid until it is
+   * deregistered. Devices with only the synchronous DeviceTable interface can
+   * be wrapped in a disk::SyncDeviceAdapter.
+   */
+  static bool Register(BYTE pdrv,
+                       const disk::AsyncDeviceTable &device) noexcept;
+
+  /**
+   * Detach the device from a drive, flushing it first so nothing it holds
+   * back is lost. Unmount the volume before calling this.
+   */
+  static void Deregister(BYTE pdrv) noexcept;
+};
+
 /* Disk Status Bits (DSTATUS) */
 
 #define STA_NOINIT 0x01  /* Drive not initialized */
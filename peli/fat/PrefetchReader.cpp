@@ -0,0 +1,264 @@
+// peli/fat/PrefetchReader.cpp - Read-ahead file reader for streaming
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "PrefetchReader.hpp"
+#include "../host/Host.hpp"
+#include "../rt/Thread.hpp"
+
+namespace peli::fat {
+
+FRESULT PrefetchReader::Open(const TCHAR *path, u32 chunks) noexcept {
+  if (IsOpen()) {
+    return FR_DENIED;
+  }
+  if (chunks < 2 || chunks > MaxChunks) {
+    return FR_INVALID_PARAMETER;
+  }
+
+  if (FRESULT result = f_open(&m_file, path, FA_READ); result != FR_OK) {
+    return result;
+  }
+
+  m_buffers = static_cast<u8 *>(host::Alloc(32, chunks * ChunkSize));
+  if (!m_buffers) {
+    f_close(&m_file);
+    return FR_NOT_ENOUGH_CORE;
+  }
+
+  for (u32 i = 0; i < chunks; i++) {
+    m_chunks[i] = {.data = m_buffers + i * ChunkSize};
+  }
+  m_chunk_count = chunks;
+  m_outstanding = 0;
+  m_generation = 0;
+  m_current = NoChunk;
+  m_current_pos = 0;
+  m_pos = 0;
+  m_read_size = MinReadSize;
+  m_active = false;
+  m_end = false;
+
+  m_thread = new rt::Thread(threadEntry, this, nullptr, StackSize,
+                            PELI_FAT_PREFETCH_PRIORITY, false);
+  if (FRESULT result = start(); result != FR_OK) {
+    Close();
+    return result;
+  }
+  return FR_OK;
+}
+
+FRESULT PrefetchReader::Close() noexcept {
+  if (!IsOpen()) {
+    return FR_OK;
+  }
+
+  Cancel();
+  m_requests.Send(StopMessage);
+  m_thread->Join();
+  delete m_thread;
+  m_thread = nullptr;
+
+  host::Free(m_buffers, m_chunk_count * ChunkSize);
+  m_buffers = nullptr;
+  return f_close(&m_file);
+}
+
+void *PrefetchReader::threadEntry(void *arg) noexcept {
+  static_cast<PrefetchReader *>(arg)->threadMain();
+  return nullptr;
+}
+
+void PrefetchReader::threadMain() noexcept {
+  for (;;) {
+    const u32 index = m_requests.Receive();
+    if (index == StopMessage) {
+      return;
+    }
+
+    // Chunks queued before a seek or cancel go straight back
+    Chunk &chunk = m_chunks[index];
+    chunk.size = 0;
+    chunk.result = FR_OK;
+    if (chunk.generation == m_generation) {
+      chunk.offset = f_tell(&m_file);
+      chunk.result = f_read(&m_file, chunk.data, chunk.request, &chunk.size);
+    }
+    m_filled.Send(index);
+  }
+}
+
+void PrefetchReader::issue(u32 index) noexcept {
+  Chunk &chunk = m_chunks[index];
+  chunk.request = m_read_size;
+  chunk.generation = m_generation;
+  m_outstanding++;
+  m_requests.Send(index);
+}
+
+FRESULT PrefetchReader::start() noexcept {
+  // The I/O thread is idle, so the file can be touched from here
+  if (FRESULT result = f_lseek(&m_file, m_pos); result != FR_OK) {
+    return result;
+  }
+
+  m_active = true;
+  m_end = false;
+  for (u32 i = 0; i < m_chunk_count; i++) {
+    issue(i);
+  }
+  return FR_OK;
+}
+
+FRESULT PrefetchReader::nextChunk() noexcept {
+  // The finished chunk is refilled after the others
+  if (m_current != NoChunk) {
+    const u32 index = m_current;
+    m_current = NoChunk;
+    if (!m_end) {
+      issue(index);
+    }
+  }
+
+  if (!m_active) {
+    if (FRESULT result = start(); result != FR_OK) {
+      return result;
+    }
+  }
+
+  if (m_outstanding == 0) {
+    // End of file
+    return FR_OK;
+  }
+
+  u32 index;
+  if (!m_filled.TryReceive(index)) {
+    // The consumer caught up with the device, read more at once
+    m_read_size = m_read_size < ChunkSize / 2 ? m_read_size * 2 : ChunkSize;
+    index = m_filled.Receive();
+  }
+  m_outstanding--;
+
+  const Chunk &chunk = m_chunks[index];
+  if (chunk.result != FR_OK) {
+    // Start over from the current position on the next read
+    const FRESULT result = chunk.result;
+    Cancel();
+    return result;
+  }
+
+  // A short read is the end of the file, nothing after it needs reading
+  if (chunk.size < chunk.request) {
+    m_end = true;
+  }
+  m_current = index;
+  m_current_pos = 0;
+  return FR_OK;
+}
+
+FRESULT PrefetchReader::fill() noexcept {
+  while (m_current == NoChunk || m_current_pos == m_chunks[m_current].size) {
+    if (FRESULT result = nextChunk(); result != FR_OK) {
+      return result;
+    }
+    if (m_current == NoChunk) {
+      break;
+    }
+  }
+  return FR_OK;
+}
+
+FRESULT PrefetchReader::Read(void *data, UINT size, UINT *read) noexcept {
+  *read = 0;
+  if (!IsOpen()) {
+    return FR_INVALID_OBJECT;
+  }
+
+  u8 *dst = static_cast<u8 *>(data);
+  while (size != 0) {
+    if (FRESULT result = fill(); result != FR_OK) {
+      return result;
+    }
+    if (m_current == NoChunk) {
+      break;
+    }
+
+    const Chunk &chunk = m_chunks[m_current];
+    const UINT left = chunk.size - m_current_pos;
+    const UINT copy = size < left ? size : left;
+    __builtin_memcpy(dst, chunk.data + m_current_pos, copy);
+
+    m_current_pos += copy;
+    m_pos += copy;
+    *read += copy;
+    dst += copy;
+    size -= copy;
+  }
+  return FR_OK;
+}
+
+FRESULT PrefetchReader::Acquire(const void **data, UINT *size) noexcept {
+  *data = nullptr;
+  *size = 0;
+  if (!IsOpen()) {
+    return FR_INVALID_OBJECT;
+  }
+
+  if (FRESULT result = fill(); result != FR_OK) {
+    return result;
+  }
+  if (m_current == NoChunk) {
+    return FR_OK;
+  }
+
+  const Chunk &chunk = m_chunks[m_current];
+  *data = chunk.data + m_current_pos;
+  *size = chunk.size - m_current_pos;
+  m_current_pos = chunk.size;
+  m_pos += *size;
+  return FR_OK;
+}
+
+FRESULT PrefetchReader::Seek(FSIZE_t offset) noexcept {
+  if (!IsOpen()) {
+    return FR_INVALID_OBJECT;
+  }
+
+  // f_lseek() stops at the end of a file opened for reading
+  if (offset > Size()) {
+    offset = Size();
+  }
+
+  if (m_current != NoChunk) {
+    const Chunk &chunk = m_chunks[m_current];
+    if (offset >= chunk.offset && offset - chunk.offset <= chunk.size) {
+      m_current_pos = UINT(offset - chunk.offset);
+      m_pos = offset;
+      return FR_OK;
+    }
+  }
+
+  Cancel();
+  m_pos = offset;
+  return FR_OK;
+}
+
+void PrefetchReader::Cancel() noexcept {
+  if (!m_active) {
+    return;
+  }
+
+  m_generation++;
+  m_current = NoChunk;
+  for (; m_outstanding != 0; m_outstanding--) {
+    m_filled.Receive();
+  }
+
+  m_active = false;
+  m_end = false;
+  m_read_size = MinReadSize;
+}
+
+} // namespace peli::fat
@@ -0,0 +1,145 @@
+// peli/fat/PrefetchReader.hpp - Read-ahead file reader for streaming
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Types.hpp"
+#include "../host/Config.h"
+#include "../host/MessageQueue.hpp"
+#include "FatFs.hpp"
+
+namespace peli::rt {
+class Thread;
+}
+
+namespace peli::fat {
+
+/**
+ * Reads a file ahead of its consumer on an I/O thread, for audio and video
+ * streams.
+ *
+ * The file is read into a ring of aligned chunk buffers. Whenever the consumer
+ * is done with a chunk it goes back to the I/O thread to be refilled with the
+ * data that follows the others, so Read() only has to wait for the device when
+ * the consumer is faster than it. Acquire() hands out the chunk memory directly
+ * instead of copying.
+ *
+ * Reads start small after Open() and every seek, so the first data arrives
+ * quickly, and double in size each time the consumer has to wait, up to the
+ * chunk size. Cancel() and Seek() drop the read-ahead; chunks still queued come
+ * back without being read, so they only wait for the read in progress.
+ *
+ * One consumer thread at a time.
+ */
+class PrefetchReader {
+public:
+  static constexpr UINT ChunkSize = PELI_FAT_PREFETCH_CHUNK_SIZE;
+  static constexpr UINT MinReadSize = 0x4000;
+  static constexpr u32 DefaultChunks = 4;
+  static constexpr u32 MaxChunks = 16;
+  static constexpr u32 StackSize = 0x2000;
+
+  static_assert(ChunkSize % FF_MAX_SS == 0 && ChunkSize >= MinReadSize);
+
+  PrefetchReader() noexcept = default;
+  ~PrefetchReader() noexcept { Close(); }
+
+  PrefetchReader(const PrefetchReader &) = delete;
+  PrefetchReader &operator=(const PrefetchReader &) = delete;
+
+  /**
+   * Open `path` for reading and start reading ahead with `chunks` buffers, 2 to
+   * MaxChunks.
+   */
+  FRESULT Open(const TCHAR *path, u32 chunks = DefaultChunks) noexcept;
+
+  /**
+   * Stop the I/O thread and close the file. Does nothing if the file isn't
+   * open.
+   */
+  FRESULT Close() noexcept;
+
+  /**
+   * Copy up to `size` bytes from the current position. `read` is less than
+   * `size` only at the end of the file.
+   */
+  FRESULT Read(void *data, UINT size, UINT *read) noexcept;
+
+  /**
+   * Take the data buffered at the current position without copying it, and
+   * move past it. `size` is 0 at the end of the file. The memory stays valid
+   * until the next call on the reader.
+   */
+  FRESULT Acquire(const void **data, UINT *size) noexcept;
+
+  /**
+   * Move the read position. A position inside the chunk being consumed keeps
+   * the read-ahead, anything else starts it over from there.
+   */
+  FRESULT Seek(FSIZE_t offset) noexcept;
+
+  /**
+   * Drop the read-ahead and leave the device idle. The next read starts it
+   * again from the current position.
+   */
+  void Cancel() noexcept;
+
+  bool IsOpen() const noexcept { return m_thread != nullptr; }
+  FSIZE_t Tell() const noexcept { return m_pos; }
+  FSIZE_t Size() const noexcept { return f_size(&m_file); }
+
+  /**
+   * Current read size, for tuning the chunk count and size.
+   */
+  UINT GetReadSize() const noexcept { return m_read_size; }
+
+private:
+  static constexpr u32 NoChunk = ~u32(0);
+  static constexpr u32 StopMessage = ~u32(0);
+
+  struct Chunk {
+    u8 *data = nullptr;
+    FSIZE_t offset = 0;
+    UINT request = 0;
+    UINT size = 0;
+    FRESULT result = FR_OK;
+    u32 generation = 0;
+  };
+
+  static void *threadEntry(void *arg) noexcept;
+  void threadMain() noexcept;
+
+  void issue(u32 index) noexcept;
+  FRESULT start() noexcept;
+  FRESULT nextChunk() noexcept;
+  FRESULT fill() noexcept;
+
+  FIL m_file = {};
+  rt::Thread *m_thread = nullptr;
+  u8 *m_buffers = nullptr;
+
+  Chunk m_chunks[MaxChunks] = {};
+  u32 m_chunk_count = 0;
+
+  // Chunk indices to the I/O thread to fill, and back once filled, in order
+  host::MessageQueue<u32, MaxChunks + 1> m_requests;
+  host::MessageQueue<u32, MaxChunks> m_filled;
+  u32 m_outstanding = 0;
+
+  // Bumped to make the I/O thread skip chunks queued before a seek or cancel
+  u32 m_generation = 0;
+
+  // Chunk being consumed
+  u32 m_current = NoChunk;
+  UINT m_current_pos = 0;
+
+  FSIZE_t m_pos = 0;
+  UINT m_read_size = MinReadSize;
+  bool m_active = false;
+  bool m_end = false;
+};
+
+} // namespace peli::fat
@@ -0,0 +1,677 @@
+// peli/fat/StdIo.cpp - Newlib device for FAT volumes
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "StdIo.hpp"
+
+#if defined(PELI_NEWLIB)
+
+#include "../host/Host.hpp"
+#include "../util/Address.hpp"
+#include "../util/String.hpp"
+#include "IO.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/iosupport.h>
+#include <sys/reent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+namespace peli::fat {
+
+namespace {
+
+constexpr size_t PathSize = 0x200;
+constexpr size_t NameSize = 16;
+
+// Appended to the name of a file being replaced by rename() until it's done
+constexpr char AsideSuffix[] = ".~replaced";
+
+// Cache line aligned, so FatFs can transfer straight from the stdio buffer
+constexpr size_t BufferAlignment = 32;
+
+struct Volume {
+  devoptab_t table;
+  char name[NameSize];
+  FATFS fs;
+  BYTE pdrv;
+  bool registered;
+};
+
+constinit Volume s_volumes[FF_VOLUMES] = {};
+
+// newlib allocates the file and directory states with plain malloc, so the
+// FatFs objects, which hold cache line aligned sector buffers, are allocated
+// apart. aligned_alloc() wants the size to be a multiple of the alignment.
+constexpr size_t ObjectAlignment = 32;
+constexpr size_t FileObjectSize = util::AlignUp(ObjectAlignment, sizeof(FIL));
+constexpr size_t DirObjectSize = util::AlignUp(ObjectAlignment, sizeof(DIR));
+
+struct FileState {
+  FIL *file;
+  bool append;
+
+  // stdio buffer from StdIo::SetBuffer()
+  u8 *buffer;
+  u32 buffer_size;
+};
+
+struct DirState {
+  DIR *dir;
+};
+
+int toErrno(FRESULT result) noexcept {
+  switch (result) {
+  case FR_NO_FILE:
+  case FR_NO_PATH:
+    return ENOENT;
+  case FR_INVALID_NAME:
+  case FR_INVALID_PARAMETER:
+    return EINVAL;
+  case FR_DENIED:
+    return EACCES;
+  case FR_EXIST:
+    return EEXIST;
+  case FR_INVALID_OBJECT:
+    return EBADF;
+  case FR_WRITE_PROTECTED:
+    return EROFS;
+  case FR_INVALID_DRIVE:
+  case FR_NOT_ENABLED:
+  case FR_NO_FILESYSTEM:
+    return ENODEV;
+  case FR_TIMEOUT:
+  case FR_LOCKED:
+    return EBUSY;
+  case FR_NOT_ENOUGH_CORE:
+    return ENOMEM;
+  case FR_TOO_MANY_OPEN_FILES:
+    return EMFILE;
+  default:
+    return EIO;
+  }
+}
+
+int fail(struct _reent *r, FRESULT result) noexcept {
+  r->_errno = toErrno(result);
+  return -1;
+}
+
+int fail(struct _reent *r, int error) noexcept {
+  r->_errno = error;
+  return -1;
+}
+
+// Turn "sd:/dir/file" into the FatFs path "1:/dir/file". Returns false if the
+// device isn't one of ours or the path is too long.
+bool fatPath(char (&out)[PathSize], const char *path) noexcept {
+  const devoptab_t *table = ::GetDeviceOpTab(path);
+  if (!table || !table->deviceData) {
+    return false;
+  }
+  const Volume *volume = static_cast<const Volume *>(table->deviceData);
+
+  for (const char *c = path; *c != '\0'; c++) {
+    if (*c == ':') {
+      path = c + 1;
+      break;
+    }
+  }
+
+  out[0] = char('0' + volume->pdrv);
+  out[1] = ':';
+  size_t length = 2;
+  if (*path != '/') {
+    out[length++] = '/';
+  }
+  return util::StrCopy<PathSize>(out + length, path) < PathSize - length;
+}
+
+// Whether a FatFs path from fatPath() names the root directory, which
+// f_stat() can't be used on
+bool isRoot(const char *path) noexcept {
+  return path[2] == '/' && path[3] == '\0';
+}
+
+u32 bufferSize(const FATFS *fs) noexcept {
+  const u32 cluster = u32(fs->csize) * FF_MAX_SS;
+  return cluster < StdIo::MaxBuffer ? cluster : StdIo::MaxBuffer;
+}
+
+// Seconds since 1970 from a FAT timestamp, which has no time zone
+time_t toTime(WORD date, WORD time) noexcept {
+  if (date == 0) {
+    return 0;
+  }
+
+  // Days since the epoch, counting years from March so leap days come last
+  const int month = (date >> 5) & 15;
+  const int year = 1980 + (date >> 9) - (month <= 2);
+  const int day_of_year = (153 * ((month + 9) % 12) + 2) / 5 + (date & 31) - 1;
+  const long days = year * 365L + year / 4 - year / 100 + year / 400 +
+                    day_of_year - 719468;
+
+  return time_t(days) * 86400 + (time >> 11) * 3600 + ((time >> 5) & 63) * 60 +
+         (time & 31) * 2;
+}
+
+void fillStat(struct stat *st, const FILINFO &info, const FATFS *fs) noexcept {
+  *st = {};
+  st->st_mode = info.fattrib & AM_DIR ? S_IFDIR | 0777 : S_IFREG | 0666;
+  if (info.fattrib & AM_RDO) {
+    st->st_mode &= ~0222;
+  }
+  st->st_nlink = 1;
+  st->st_size = ::off_t(info.fsize);
+  // stdio sizes its buffer from this
+  st->st_blksize = bufferSize(fs);
+  st->st_blocks = decltype(st->st_blocks)((info.fsize + 511) / 512);
+  st->st_mtime = toTime(info.fdate, info.ftime);
+}
+
+FRESULT statPath(const char *path, FILINFO &info) noexcept {
+  if (isRoot(path)) {
+    info = {};
+    info.fattrib = AM_DIR;
+    return FR_OK;
+  }
+  return f_stat(path, &info);
+}
+
+int sysOpen(struct _reent *r, void *file_struct, const char *path, int flags,
+            [[maybe_unused]] int mode) {
+  char fat_path[PathSize];
+  if (!fatPath(fat_path, path)) {
+    return fail(r, ENAMETOOLONG);
+  }
+
+  BYTE fat_mode = (flags & O_ACCMODE) == O_RDONLY   ? FA_READ
+                  : (flags & O_ACCMODE) == O_WRONLY ? FA_WRITE
+                                                    : FA_READ | FA_WRITE;
+  if ((flags & O_CREAT) && (flags & O_EXCL)) {
+    fat_mode |= FA_CREATE_NEW;
+  } else if ((flags & O_CREAT) && (flags & O_TRUNC)) {
+    fat_mode |= FA_CREATE_ALWAYS;
+  } else if (flags & O_CREAT) {
+    fat_mode |= FA_OPEN_ALWAYS;
+  }
+
+  FileState *state = static_cast<FileState *>(file_struct);
+  *state = {};
+  state->append = (flags & O_APPEND) != 0;
+  state->file =
+      static_cast<FIL *>(host::Alloc(ObjectAlignment, FileObjectSize));
+  if (!state->file) {
+    return fail(r, ENOMEM);
+  }
+
+  FRESULT result = f_open(state->file, fat_path, fat_mode);
+
+  // Truncating an existing file without O_CREAT
+  if (result == FR_OK && (flags & O_TRUNC) && !(flags & O_CREAT) &&
+      (fat_mode & FA_WRITE)) {
+    result = f_truncate(state->file);
+    if (result != FR_OK) {
+      f_close(state->file);
+    }
+  }
+  if (result != FR_OK) {
+    host::Free(state->file, FileObjectSize);
+    state->file = nullptr;
+  }
+
+  if (result == FR_NO_FILE) {
+    // Directories can't be opened as files
+    FILINFO info;
+    if (statPath(fat_path, info) == FR_OK && (info.fattrib & AM_DIR)) {
+      return fail(r, EISDIR);
+    }
+  }
+  return result != FR_OK ? fail(r, result) : 0;
+}
+
+int sysClose(struct _reent *r, void *fd) {
+  FileState *state = static_cast<FileState *>(fd);
+  const FRESULT result = f_close(state->file);
+  host::Free(state->file, FileObjectSize);
+  state->file = nullptr;
+  if (state->buffer) {
+    host::Free(state->buffer, state->buffer_size);
+    state->buffer = nullptr;
+  }
+  return result != FR_OK ? fail(r, result) : 0;
+}
+
+::ssize_t sysRead(struct _reent *r, void *fd, char *ptr, size_t len) {
+  FileState *state = static_cast<FileState *>(fd);
+  UINT read;
+  if (FRESULT result = f_read(state->file, ptr, UINT(len), &read)) {
+    return fail(r, result);
+  }
+  return ::ssize_t(read);
+}
+
+::ssize_t sysWrite(struct _reent *r, void *fd, const char *ptr, size_t len) {
+  FileState *state = static_cast<FileState *>(fd);
+  if (state->append) {
+    if (FRESULT result = f_lseek(state->file, f_size(state->file))) {
+      return fail(r, result);
+    }
+  }
+
+  UINT written;
+  if (FRESULT result = f_write(state->file, ptr, UINT(len), &written)) {
+    return fail(r, result);
+  }
+  if (written == 0 && len != 0) {
+    return fail(r, ENOSPC);
+  }
+  return ::ssize_t(written);
+}
+
+::off_t sysSeek(struct _reent *r, void *fd, ::off_t pos, int dir) {
+  FileState *state = static_cast<FileState *>(fd);
+
+  FSIZE_t base;
+  switch (dir) {
+  case SEEK_SET:
+    base = 0;
+    break;
+  case SEEK_CUR:
+    base = f_tell(state->file);
+    break;
+  case SEEK_END:
+    base = f_size(state->file);
+    break;
+  default:
+    return fail(r, EINVAL);
+  }
+
+  if (pos < 0 && FSIZE_t(-pos) > base) {
+    return fail(r, EINVAL);
+  }
+  if (FRESULT result = f_lseek(state->file, base + FSIZE_t(pos))) {
+    return fail(r, result);
+  }
+  return ::off_t(f_tell(state->file));
+}
+
+int sysFstat([[maybe_unused]] struct _reent *r, void *fd, struct stat *st) {
+  FileState *state = static_cast<FileState *>(fd);
+
+  // The open file has no name to look the rest up by
+  FILINFO info = {};
+  info.fsize = f_size(state->file);
+  fillStat(st, info, state->file->obj.fs);
+  return 0;
+}
+
+int sysStat(struct _reent *r, const char *path, struct stat *st) {
+  char fat_path[PathSize];
+  if (!fatPath(fat_path, path)) {
+    return fail(r, ENAMETOOLONG);
+  }
+
+  FILINFO info;
+  if (FRESULT result = statPath(fat_path, info)) {
+    return fail(r, result);
+  }
+
+  const devoptab_t *table = ::GetDeviceOpTab(path);
+  fillStat(st, info, &static_cast<const Volume *>(table->deviceData)->fs);
+  return 0;
+}
+
+int sysUnlink(struct _reent *r, const char *name) {
+  char fat_path[PathSize];
+  if (!fatPath(fat_path, name)) {
+    return fail(r, ENAMETOOLONG);
+  }
+
+  // f_unlink() also removes empty directories
+  FILINFO info;
+  if (FRESULT result = statPath(fat_path, info)) {
+    return fail(r, result);
+  }
+  if (info.fattrib & AM_DIR) {
+    return fail(r, EISDIR);
+  }
+
+  FRESULT result = f_unlink(fat_path);
+  return result != FR_OK ? fail(r, result) : 0;
+}
+
+int sysRmdir(struct _reent *r, const char *name) {
+  char fat_path[PathSize];
+  if (!fatPath(fat_path, name)) {
+    return fail(r, ENAMETOOLONG);
+  }
+
+  FILINFO info;
+  if (FRESULT result = statPath(fat_path, info)) {
+    return fail(r, result);
+  }
+  if (!(info.fattrib & AM_DIR)) {
+    return fail(r, ENOTDIR);
+  }
+  if (isRoot(fat_path)) {
+    return fail(r, EBUSY);
+  }
+
+  // FR_DENIED here means the directory isn't empty
+  FRESULT result = f_unlink(fat_path);
+  if (result == FR_DENIED) {
+    return fail(r, ENOTEMPTY);
+  }
+  return result != FR_OK ? fail(r, result) : 0;
+}
+
+int sysRename(struct _reent *r, const char *old_name, const char *new_name) {
+  char from[PathSize], to[PathSize];
+  if (!fatPath(from, old_name) || !fatPath(to, new_name)) {
+    return fail(r, ENAMETOOLONG);
+  }
+
+  FRESULT result = f_rename(from, to);
+  if (result != FR_EXIST) {
+    return result != FR_OK ? fail(r, result) : 0;
+  }
+
+  // rename() replaces an existing file, FatFs refuses to
+  FILINFO from_info, to_info;
+  if (f_stat(from, &from_info) != FR_OK || f_stat(to, &to_info) != FR_OK ||
+      (from_info.fattrib & AM_DIR) || (to_info.fattrib & AM_DIR)) {
+    return fail(r, result);
+  }
+
+  // Move the target aside rather than deleting it, so it can be put back if
+  // the rename still fails
+  char aside[PathSize];
+  const size_t length = util::StrCopy<PathSize>(aside, to);
+  if (length + sizeof(AsideSuffix) > PathSize) {
+    return fail(r, ENAMETOOLONG);
+  }
+  util::StrCopy<sizeof(AsideSuffix)>(aside + length, AsideSuffix);
+
+  if (FRESULT aside_result = f_rename(to, aside)) {
+    return fail(r, aside_result);
+  }
+  if (result = f_rename(from, to); result != FR_OK) {
+    f_rename(aside, to);
+    return fail(r, result);
+  }
+
+  // The rename has happened, if the old target can't be deleted it stays
+  // under the aside name
+  f_unlink(aside);
+  return 0;
+}
+
+int sysMkdir(struct _reent *r, const char *path, [[maybe_unused]] int mode) {
+  char fat_path[PathSize];
+  if (!fatPath(fat_path, path)) {
+    return fail(r, ENAMETOOLONG);
+  }
+
+  FRESULT result = f_mkdir(fat_path);
+  return result != FR_OK ? fail(r, result) : 0;
+}
+
+DIR_ITER *sysDirOpen(struct _reent *r, DIR_ITER *dir_state, const char *path) {
+  char fat_path[PathSize];
+  if (!fatPath(fat_path, path)) {
+    fail(r, ENAMETOOLONG);
+    return nullptr;
+  }
+
+  DirState *state = static_cast<DirState *>(dir_state->dirStruct);
+  state->dir = static_cast<DIR *>(host::Alloc(ObjectAlignment, DirObjectSize));
+  if (!state->dir) {
+    fail(r, ENOMEM);
+    return nullptr;
+  }
+
+  if (FRESULT result = f_opendir(state->dir, fat_path)) {
+    host::Free(state->dir, DirObjectSize);
+    state->dir = nullptr;
+    fail(r, result == FR_NO_PATH ? FR_NO_FILE : result);
+    return nullptr;
+  }
+  return dir_state;
+}
+
+int sysDirReset(struct _reent *r, DIR_ITER *dir_state) {
+  DirState *state = static_cast<DirState *>(dir_state->dirStruct);
+  FRESULT result = f_rewinddir(state->dir);
+  return result != FR_OK ? fail(r, result) : 0;
+}
+
+int sysDirNext(struct _reent *r, DIR_ITER *dir_state, char *filename,
+               struct stat *filestat) {
+  DirState *state = static_cast<DirState *>(dir_state->dirStruct);
+
+  FILINFO info;
+  if (FRESULT result = f_readdir(state->dir, &info)) {
+    return fail(r, result);
+  }
+  if (info.fname[0] == '\0') {
+    return fail(r, ENOENT);
+  }
+
+  // FF_LFN_BUF is no longer than NAME_MAX
+  util::StrCopy<FF_LFN_BUF + 1>(filename, info.fname);
+  if (filestat) {
+    fillStat(filestat, info, state->dir->obj.fs);
+  }
+  return 0;
+}
+
+int sysDirClose(struct _reent *r, DIR_ITER *dir_state) {
+  DirState *state = static_cast<DirState *>(dir_state->dirStruct);
+  FRESULT result = f_closedir(state->dir);
+  host::Free(state->dir, DirObjectSize);
+  state->dir = nullptr;
+  return result != FR_OK ? fail(r, result) : 0;
+}
+
+int sysStatVfs(struct _reent *r, const char *path, struct statvfs *buf) {
+  char fat_path[PathSize];
+  if (!fatPath(fat_path, path)) {
+    return fail(r, ENAMETOOLONG);
+  }
+  fat_path[2] = '\0';
+
+  DWORD free_clusters;
+  FATFS *fs;
+  if (FRESULT result = f_getfree(fat_path, &free_clusters, &fs)) {
+    return fail(r, result);
+  }
+
+  *buf = {};
+  buf->f_bsize = u32(fs->csize) * FF_MAX_SS;
+  buf->f_frsize = u32(fs->csize) * FF_MAX_SS;
+  buf->f_blocks = fs->n_fatent - 2;
+  buf->f_bfree = free_clusters;
+  buf->f_bavail = free_clusters;
+  buf->f_flag = ST_NOSUID;
+  buf->f_namemax = FF_MAX_LFN;
+  return 0;
+}
+
+int sysFtruncate(struct _reent *r, void *fd, ::off_t len) {
+  FileState *state = static_cast<FileState *>(fd);
+  FIL *file = state->file;
+  if (len < 0) {
+    return fail(r, EINVAL);
+  }
+
+  const FSIZE_t pos = f_tell(file);
+  const FSIZE_t size = f_size(file);
+  const FSIZE_t length = FSIZE_t(len);
+
+  FRESULT result;
+  if (length < size) {
+    result = f_lseek(file, length);
+    if (result == FR_OK) {
+      result = f_truncate(file);
+    }
+  } else {
+    // Seeking past the end would extend the file with whatever the clusters
+    // held, the new part has to read as zeros
+    static constexpr u8 Zero[FF_MAX_SS] = {};
+    result = f_lseek(file, size);
+    for (FSIZE_t left = length - size; result == FR_OK && left != 0;) {
+      const UINT chunk = left < sizeof(Zero) ? UINT(left) : sizeof(Zero);
+      UINT written;
+      result = f_write(file, Zero, chunk, &written);
+      if (result == FR_OK && written != chunk) {
+        return fail(r, ENOSPC);
+      }
+      left -= chunk;
+    }
+  }
+
+  // Keep the position, but not past the new end where FatFs would extend the
+  // file again
+  if (FRESULT seek = f_lseek(file, pos < length ? pos : length);
+      result == FR_OK) {
+    result = seek;
+  }
+  return result != FR_OK ? fail(r, result) : 0;
+}
+
+int sysFsync(struct _reent *r, void *fd) {
+  FRESULT result = f_sync(static_cast<FileState *>(fd)->file);
+  return result != FR_OK ? fail(r, result) : 0;
+}
+
+constinit const devoptab_t s_devoptab = {
+    .name = nullptr,
+    .structSize = sizeof(FileState),
+    .open_r = sysOpen,
+    .close_r = sysClose,
+    .write_r = sysWrite,
+    .read_r = sysRead,
+    .seek_r = sysSeek,
+    .fstat_r = sysFstat,
+    .stat_r = sysStat,
+    .link_r = nullptr,
+    .unlink_r = sysUnlink,
+    .chdir_r = nullptr,
+    .rename_r = sysRename,
+    .mkdir_r = sysMkdir,
+    .dirStateSize = sizeof(DirState),
+    .diropen_r = sysDirOpen,
+    .dirreset_r = sysDirReset,
+    .dirnext_r = sysDirNext,
+    .dirclose_r = sysDirClose,
+    .statvfs_r = sysStatVfs,
+    .ftruncate_r = sysFtruncate,
+    .fsync_r = sysFsync,
+    .deviceData = nullptr,
+    .chmod_r = nullptr,
+    .fchmod_r = nullptr,
+    .rmdir_r = sysRmdir,
+    .lstat_r = sysStat,
+    .utimes_r = nullptr,
+    .fpathconf_r = nullptr,
+    .pathconf_r = nullptr,
+    .symlink_r = nullptr,
+    .readlink_r = nullptr,
+};
+
+Volume *findVolume(const char *name) noexcept {
+  for (Volume &volume : s_volumes) {
+    if (volume.registered && __builtin_strcmp(volume.name, name) == 0) {
+      return &volume;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace
+
+bool StdIo::Register(BYTE pdrv, const char *name) noexcept {
+  if (pdrv >= FF_VOLUMES || util::StrLen(name) >= NameSize) {
+    return false;
+  }
+
+  Volume &volume = s_volumes[pdrv];
+  if (volume.registered || findVolume(name)) {
+    return false;
+  }
+
+  const char drive[3] = {char('0' + pdrv), ':', '\0'};
+  if (f_mount(&volume.fs, drive, 1) != FR_OK) {
+    return false;
+  }
+
+  util::StrCopy<NameSize>(volume.name, name);
+  volume.table = s_devoptab;
+  volume.table.name = volume.name;
+  volume.table.deviceData = &volume;
+  volume.pdrv = pdrv;
+  if (::AddDevice(&volume.table) < 0) {
+    f_unmount(drive);
+    return false;
+  }
+
+  volume.registered = true;
+  return true;
+}
+
+void StdIo::Deregister(const char *name) noexcept {
+  Volume *volume = findVolume(name);
+  if (!volume) {
+    return;
+  }
+
+  char device[NameSize + 1];
+  const size_t length = util::StrCopy<NameSize>(device, name);
+  device[length] = ':';
+  device[length + 1] = '\0';
+  ::RemoveDevice(device);
+
+  const char drive[3] = {char('0' + volume->pdrv), ':', '\0'};
+  f_unmount(drive);
+  disk_ioctl(volume->pdrv, CTRL_SYNC, nullptr);
+  volume->registered = false;
+}
+
+FILE *StdIo::Open(const char *path, const char *mode) noexcept {
+  FILE *file = ::fopen(path, mode);
+  if (file) {
+    SetBuffer(file);
+  }
+  return file;
+}
+
+bool StdIo::SetBuffer(FILE *file) noexcept {
+  if (!file) {
+    return false;
+  }
+
+  __handle *handle = ::__get_handle(::fileno(file));
+  if (!handle || devoptab_list[handle->device]->open_r != sysOpen) {
+    return false;
+  }
+
+  FileState *state = static_cast<FileState *>(handle->fileStruct);
+  if (!state->buffer) {
+    state->buffer_size = bufferSize(state->file->obj.fs);
+    state->buffer = static_cast<u8 *>(
+        host::Alloc(BufferAlignment, state->buffer_size));
+    if (!state->buffer) {
+      return false;
+    }
+  }
+
+  return ::setvbuf(file, reinterpret_cast<char *>(state->buffer), _IOFBF,
+                   state->buffer_size) == 0;
+}
+
+} // namespace peli::fat
+
+#endif // PELI_NEWLIB
@@ -0,0 +1,62 @@
+// peli/fat/StdIo.hpp - Newlib device for FAT volumes
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../host/Config.h"
+
+#if defined(PELI_NEWLIB)
+
+#include "../cmn/Types.hpp"
+#include "FatFs.hpp"
+#include <stdio.h>
+
+namespace peli::fat {
+
+/**
+ * Mounts FatFs volumes and registers them as newlib devices, so the C file API
+ * can reach them, e.g. fopen("sd:/apps/boot.dol", "rb") once drive 1 has been
+ * registered as "sd".
+ *
+ * fstat() reports the volume's cluster size (up to MaxBuffer) as the block
+ * size, so stdio buffers and transfers a cluster at a time rather than 1 KiB.
+ * stdio allocates that buffer with malloc, so open files with Open() (or call
+ * SetBuffer() after fopen()) to give it a cache line aligned one that FatFs
+ * can hand to the device without a bounce copy.
+ */
+class StdIo {
+public:
+  static constexpr u32 MaxBuffer = 0x10000;
+
+  /**
+   * Mount FatFs drive `pdrv` (see Disk::Register()) and register it as the
+   * newlib device `name`, which is copied. The name must be shorter than 16
+   * characters.
+   */
+  static bool Register(BYTE pdrv, const char *name = "sd") noexcept;
+
+  /**
+   * Remove the device, unmount its volume and flush the drive. Files still
+   * open on it become invalid.
+   */
+  static void Deregister(const char *name = "sd") noexcept;
+
+  /**
+   * fopen() followed by SetBuffer().
+   */
+  static FILE *Open(const char *path, const char *mode) noexcept;
+
+  /**
+   * Give a file opened on a FAT device an aligned stdio buffer of one cluster.
+   * Must be called before the first read or write. The buffer is freed when
+   * the file is closed.
+   */
+  static bool SetBuffer(FILE *file) noexcept;
+};
+
+} // namespace peli::fat
+
+#endif // PELI_NEWLIB
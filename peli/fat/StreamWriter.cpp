@@ -0,0 +1,142 @@
+// peli/fat/StreamWriter.cpp - Sequential writer for large FatFs files
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "StreamWriter.hpp"
+#include "../host/Host.hpp"
+
+namespace peli::fat {
+
+FRESULT StreamWriter::Open(const TCHAR *path, FSIZE_t reserve) noexcept {
+  if (IsOpen()) {
+    return FR_DENIED;
+  }
+
+  // Cache line aligned, so FatFs can hand it to the device without a bounce
+  m_buffer = static_cast<u8 *>(host::Alloc(32, BufferSize));
+  if (!m_buffer) {
+    return FR_NOT_ENOUGH_CORE;
+  }
+  m_staged = 0;
+  m_size = 0;
+  m_stats = {};
+
+  FRESULT result = f_open(&m_file, path, FA_CREATE_ALWAYS | FA_WRITE);
+  if (result == FR_OK && reserve != 0) {
+    result = f_expand(&m_file, reserve, 1);
+    m_stats.reserved = result == FR_OK;
+    if (result == FR_DENIED) {
+      // No contiguous block that large, grow as usual
+      result = FR_OK;
+    } else if (result != FR_OK) {
+      f_close(&m_file);
+    }
+  }
+
+  if (result != FR_OK) {
+    host::Free(m_buffer, BufferSize);
+    m_buffer = nullptr;
+  }
+  return result;
+}
+
+FRESULT StreamWriter::flush() noexcept {
+  if (m_staged == 0) {
+    return FR_OK;
+  }
+
+  UINT written;
+  const FRESULT result = f_write(&m_file, m_buffer, m_staged, &written);
+  m_stats.staged_writes++;
+
+  // Whatever reached the file leaves the buffer, so a retry doesn't repeat it
+  if (written != m_staged) {
+    __builtin_memmove(m_buffer, m_buffer + written, m_staged - written);
+  }
+  m_staged -= written;
+  if (result != FR_OK) {
+    return result;
+  }
+  if (m_staged != 0) {
+    return FR_DENIED; // Volume full
+  }
+  return FR_OK;
+}
+
+FRESULT StreamWriter::Write(const void *data, UINT size) noexcept {
+  if (!IsOpen()) {
+    return FR_INVALID_OBJECT;
+  }
+
+  const u8 *src = static_cast<const u8 *>(data);
+  while (size != 0) {
+    if (m_staged == 0 && size >= BufferSize) {
+      // Whole buffers' worth with nothing staged skip the copy
+      const UINT direct = size - size % BufferSize;
+      UINT written;
+      const FRESULT result = f_write(&m_file, src, direct, &written);
+      m_stats.direct_writes++;
+      m_size += written;
+      m_stats.bytes += written;
+      if (result != FR_OK) {
+        return result;
+      }
+      if (written != direct) {
+        return FR_DENIED;
+      }
+      src += direct;
+      size -= direct;
+      continue;
+    }
+
+    const UINT copy =
+        size < BufferSize - m_staged ? size : BufferSize - m_staged;
+    __builtin_memcpy(m_buffer + m_staged, src, copy);
+    m_staged += copy;
+    m_size += copy;
+    m_stats.bytes += copy;
+    src += copy;
+    size -= copy;
+
+    if (m_staged == BufferSize) {
+      if (FRESULT result = flush(); result != FR_OK) {
+        return result;
+      }
+    }
+  }
+  return FR_OK;
+}
+
+FRESULT StreamWriter::Sync() noexcept {
+  if (!IsOpen()) {
+    return FR_INVALID_OBJECT;
+  }
+
+  if (FRESULT result = flush(); result != FR_OK) {
+    return result;
+  }
+  return f_sync(&m_file);
+}
+
+FRESULT StreamWriter::Close() noexcept {
+  if (!IsOpen()) {
+    return FR_OK;
+  }
+
+  // The file position is at the end of the written data, so truncating there
+  // gives back the unused part of the reservation
+  FRESULT result = flush();
+  if (result == FR_OK) {
+    result = f_truncate(&m_file);
+  }
+  const FRESULT close_result = f_close(&m_file);
+
+  host::Free(m_buffer, BufferSize);
+  m_buffer = nullptr;
+  m_staged = 0;
+  return result != FR_OK ? result : close_result;
+}
+
+} // namespace peli::fat
@@ -0,0 +1,103 @@
+// peli/fat/StreamWriter.hpp - Sequential writer for large FatFs files
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Types.hpp"
+#include "../host/Config.h"
+#include "FatFs.hpp"
+
+namespace peli::fat {
+
+/**
+ * Writes a file from start to end in large, aligned pieces, for recordings,
+ * dumps and downloads.
+ *
+ * Open() can reserve the expected size up front with f_expand(), so the file
+ * is one contiguous block of clusters and its FAT chain is written once
+ * instead of growing cluster by cluster. Writes are collected in an aligned
+ * staging buffer, and each full buffer goes out in one f_write(), which
+ * FatFs turns into a single multi-block transfer per contiguous cluster run.
+ * Close() frees whatever part of the reservation was not written.
+ *
+ * Not thread safe. FatFs' file lock also counts the file as open until
+ * Close().
+ */
+class StreamWriter {
+public:
+  static constexpr UINT BufferSize = PELI_FAT_STREAM_BUFFER_SIZE;
+
+  struct Stats {
+    /**
+     * Bytes passed to Write().
+     */
+    u64 bytes;
+
+    /**
+     * f_write() calls made, from the staging buffer or straight from the
+     * caller's memory.
+     */
+    u32 staged_writes;
+    u32 direct_writes;
+
+    /**
+     * Whether Open() got a contiguous reservation.
+     */
+    bool reserved;
+  };
+
+  StreamWriter() noexcept = default;
+  ~StreamWriter() noexcept { Close(); }
+
+  StreamWriter(const StreamWriter &) = delete;
+  StreamWriter &operator=(const StreamWriter &) = delete;
+
+  /**
+   * Create `path`, replacing any existing file, and reserve `reserve` bytes of
+   * contiguous space for it. Running out of contiguous space isn't an error,
+   * the file then grows as it is written. Writing past the reservation is
+   * also fine.
+   */
+  FRESULT Open(const TCHAR *path, FSIZE_t reserve = 0) noexcept;
+
+  /**
+   * Append to the file. Data may stay in the staging buffer until the next
+   * write that fills it, Sync() or Close().
+   */
+  FRESULT Write(const void *data, UINT size) noexcept;
+
+  /**
+   * Write out the staging buffer and sync the file. A reservation still
+   * counts towards the file size until Close().
+   */
+  FRESULT Sync() noexcept;
+
+  /**
+   * Write out the staging buffer, cut the file at the written size and close
+   * it. Does nothing if the file isn't open.
+   */
+  FRESULT Close() noexcept;
+
+  bool IsOpen() const noexcept { return m_buffer != nullptr; }
+
+  /**
+   * Bytes written so far, including any still staged.
+   */
+  FSIZE_t Size() const noexcept { return m_size; }
+
+  const Stats &GetStats() const noexcept { return m_stats; }
+
+private:
+  FRESULT flush() noexcept;
+
+  FIL m_file = {};
+  u8 *m_buffer = nullptr;
+  UINT m_staged = 0;
+  FSIZE_t m_size = 0;
+  Stats m_stats = {};
+};
+
+} // namespace peli::fat
@@ -0,0 +1,125 @@
+// peli/fat/System.cpp - FatFs OS dependent functions
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "../host/Config.h"
+#include "../host/Host.hpp"
+#include "../host/Mutex.hpp"
+#include "../rt/RealTimeClock.hpp"
+#include "../util/Defer.hpp"
+#include "FatFs.hpp"
+
+namespace peli::fat {
+
+namespace {
+
+// One per volume, and one more for the file lock table
+constinit host::Mutex s_mutexes[FF_VOLUMES + 1];
+
+#if FF_USE_FASTSEEK
+
+static_assert(PELI_FAT_LINKMAP_COUNT <= 32);
+
+// Shared by every open file, a table is only held while its file is open
+constinit DWORD s_linkmaps[PELI_FAT_LINKMAP_COUNT][PELI_FAT_LINKMAP_SIZE] = {};
+constinit u32 s_linkmap_used = 0;
+constinit host::Mutex s_linkmap_mutex;
+
+#endif
+
+} // namespace
+
+#if FF_USE_LFN == 3
+
+void *ff_memalloc(UINT msize) { return host::Alloc(alignof(u32), msize); }
+
+void ff_memfree(void *mblock) {
+  if (mblock) {
+    host::Free(mblock, 0);
+  }
+}
+
+#endif
+
+#if FF_USE_FASTSEEK
+
+DWORD *ff_linkmap_alloc() {
+  s_linkmap_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_linkmap_mutex.Unlock(); });
+
+  for (u32 i = 0; i < PELI_FAT_LINKMAP_COUNT; i++) {
+    if (!(s_linkmap_used & (1u << i))) {
+      s_linkmap_used |= 1u << i;
+      return s_linkmaps[i];
+    }
+  }
+  return nullptr;
+}
+
+void ff_linkmap_free(DWORD *tbl) {
+  const u32 i = u32(tbl - s_linkmaps[0]) / PELI_FAT_LINKMAP_SIZE;
+  s_linkmap_mutex.Lock();
+  s_linkmap_used &= ~(1u << i);
+  s_linkmap_mutex.Unlock();
+}
+
+#endif
+
+#if !FF_FS_READONLY && !FF_FS_NORTC
+
+DWORD get_fattime() {
+  // The fixed date FatFs would use without a clock
+  constexpr DWORD NoClock = DWORD(FF_NORTC_YEAR - 1980) << 25 |
+                            DWORD(FF_NORTC_MON) << 21 |
+                            DWORD(FF_NORTC_MDAY) << 16;
+
+  const s64 now = rt::GetRealTime();
+  if (now < 0) {
+    return NoClock;
+  }
+
+  // Civil date from days since 2000-03-01, so leap days fall at the end of
+  // each year
+  const s64 days = now / 86400 - 60;
+  const u32 seconds = u32(now % 86400);
+  const s64 era = (days >= 0 ? days : days - 146096) / 146097;
+  const u32 day_of_era = u32(days - era * 146097);
+  const u32 year_of_era =
+      (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+       day_of_era / 146096) /
+      365;
+  const u32 day_of_year =
+      day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+  const u32 month_index = (5 * day_of_year + 2) / 153;
+  const u32 day = day_of_year - (153 * month_index + 2) / 5 + 1;
+  const u32 month = month_index < 10 ? month_index + 3 : month_index - 9;
+  const s64 year = 2000 + era * 400 + year_of_era + (month <= 2 ? 1 : 0);
+
+  if (year < 1980 || year > 2107) {
+    return NoClock;
+  }
+  return DWORD(year - 1980) << 25 | DWORD(month) << 21 | DWORD(day) << 16 |
+         DWORD(seconds / 3600) << 11 | DWORD(seconds / 60 % 60) << 5 |
+         DWORD(seconds % 60 / 2);
+}
+
+#endif
+
+#if FF_FS_REENTRANT
+
+int ff_mutex_create(int vol) { return vol >= 0 && vol <= FF_VOLUMES; }
+
+void ff_mutex_delete(int vol) { (void)vol; }
+
+int ff_mutex_take(int vol) {
+  s_mutexes[vol].Lock();
+  return 1;
+}
+
+void ff_mutex_give(int vol) { s_mutexes[vol].Unlock(); }
+
+#endif
+
+} // namespace peli::fat
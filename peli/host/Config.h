@@ -28,6 +28,150 @@ namespace peli::host {
  */
 #define PELI_CRT0_STACK_SIZE 0x8000
 
+/**
+ * Bytes of inline storage reserved in typed ioctl requests for outputs that are
+ * allocated by size (e.g. passing a u32 for a pointer output). Larger outputs
+ * fall back to the heap.
+ */
+#define PELI_IOS_VECTOR_INLINE_SIZE 256
+
+/**
+ * Number of handles tracked by ios::HandleCache, shared between device nodes
+ * and cached read-only files.
+ */
+#define PELI_IOS_HANDLE_CACHE_SIZE 16
+
+/**
+ * Number of idle read-only file handles ios::HandleCache keeps open for reuse.
+ * Set to 0 to close files on release.
+ */
+#define PELI_IOS_FILE_CACHE_SIZE 4
+
+/**
+ * Number of paths ios::fs::MetaCache keeps attributes, file sizes and directory
+ * listings for.
+ */
+#define PELI_IOS_META_CACHE_SIZE 32
+
+/**
+ * Largest directory listing, in bytes of packed names, ios::fs::MetaCache
+ * stores. Only the entry count is cached for larger directories.
+ */
+#define PELI_IOS_META_CACHE_LISTING_SIZE 0x400
+
+/**
+ * Largest single SD card transfer in bytes, and the size of each of the two
+ * DMA buffers reserved by ios::sdio::Card::ReserveBlockBuffer().
+ */
+#define PELI_SDIO_TRANSFER_SIZE 0x20000
+
+/**
+ * Number of block ranges ios::sdio::Card queues for erase in batching mode
+ * before sending them to the card.
+ */
+#define PELI_SDIO_ERASE_BATCH 16
+
+/**
+ * Number of blocks of pending writes held by a disk::Scheduler before they are
+ * written back.
+ */
+#define PELI_DISK_SCHEDULER_BLOCKS 64
+
+/**
+ * Default number of blocks held by a disk::BlockCache, allocated from the top
+ * of MEM2.
+ */
+#define PELI_DISK_CACHE_BLOCKS 256
+
+/**
+ * Number of blocks disk::BlockCache reads ahead once it sees sequential reads.
+ * Set to 0 to disable read-ahead.
+ */
+#define PELI_DISK_CACHE_READ_AHEAD 16
+
+/**
+ * Size of the per-drive bounce buffer FatFs transfers to and from unaligned
+ * memory go through. FatFs reads and writes whole contiguous cluster runs at
+ * once, so this sets the transfer size for unaligned buffers.
+ */
+#define PELI_FAT_BOUNCE_SIZE 0x10000
+
+/**
+ * Number of FAT sectors each mounted FatFs volume caches, apart from the
+ * window it uses for directories. Dirty sectors are written back, together
+ * with their copies in the second FAT, when the volume is synced. 1 to 32.
+ */
+#define PELI_FAT_TABLE_CACHE_SECTORS 8
+
+/**
+ * Largest in-memory cluster bitmap a mounted FAT12/16/32 volume may allocate,
+ * in bytes (one bit per cluster). Volumes needing more search the FAT for
+ * free clusters. 0 disables the bitmap.
+ */
+#define PELI_FAT_CLUSTER_BITMAP_SIZE 0x40000
+
+/**
+ * Number of directories each mounted FatFs volume keeps a hashed name index
+ * of, least recently used first out. 0 disables the index.
+ */
+#define PELI_FAT_DIR_INDEX_COUNT 4
+
+/**
+ * A directory gets an index once a lookup in it passes over this many
+ * entries.
+ */
+#define PELI_FAT_DIR_INDEX_MIN 64
+
+/**
+ * Most records a directory index can hold, a power of 2 no larger than
+ * 0x8000. Names with an LFN on FAT take two. Larger directories are searched
+ * linearly.
+ */
+#define PELI_FAT_DIR_INDEX_ENTRIES 4096
+
+/**
+ * Number of cluster link map tables shared by all open FatFs files. A file
+ * without one falls back to following the FAT chain.
+ */
+#define PELI_FAT_LINKMAP_COUNT 8
+
+/**
+ * Size of each cluster link map table in DWORDs. A file needs two per
+ * fragment plus two, so 256 covers 127 fragments.
+ */
+#define PELI_FAT_LINKMAP_SIZE 256
+
+/**
+ * Files at least this many bytes get a cluster link map built automatically on
+ * their first seek.
+ */
+#define PELI_FAT_LINKMAP_THRESHOLD 0x100000
+
+/**
+ * Staging buffer size of a fat::StreamWriter. Each full buffer is written in
+ * one f_write(), so this should be a multiple of the cluster size.
+ */
+#define PELI_FAT_STREAM_BUFFER_SIZE 0x40000
+
+/**
+ * Size of each read-ahead buffer of a fat::PrefetchReader, and so the largest
+ * single read it makes. A multiple of the sector size.
+ */
+#define PELI_FAT_PREFETCH_CHUNK_SIZE 0x20000
+
+/**
+ * Priority of the fat::PrefetchReader I/O threads. The thread spends nearly all
+ * of its time waiting on the device, so one step above the main thread (16)
+ * keeps requests queued without taking CPU time from the consumer.
+ */
+#define PELI_FAT_PREFETCH_PRIORITY 15
+
+/**
+ * Build the software IOS loopback (see peli/ios/low/Loopback.hpp). Once
+ * installed, IPC requests are serviced by it instead of the hardware mailbox.
+ */
+// #define PELI_IOS_LOOPBACK
+
 /**
  * Override for the default memory allocation function.
  */
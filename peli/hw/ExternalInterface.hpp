@@ -0,0 +1,146 @@
+// peli/hw/ExternalInterface.hpp
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Macro.h"
+#include "../cmn/Types.hpp"
+#include "Namespace.hpp"
+#include "Register.hpp"
+
+namespace peli::hw {
+
+struct ExternalInterface {
+  struct Csr {
+    using Size = u32;
+
+    /* 14-31 */ u32 : 18;
+
+    /**
+     * Disable the IPL ROM scrambler (channel 0 only).
+     */
+    /* 13 */ volatile u32 ROMDIS : 1 = 0;
+
+    /**
+     * Device connected.
+     */
+    /* 12 */ volatile u32 EXT : 1 = 0;
+
+    /**
+     * External insertion interrupt status and mask.
+     */
+    /* 11 */ volatile u32 EXTINT : 1 = 0;
+    /* 10 */ volatile u32 EXTINTMASK : 1 = 0;
+
+    /**
+     * Chip select, one bit per device.
+     */
+    /* 7-9 */ volatile u32 CS : 3 = 0;
+
+    /**
+     * Clock frequency, 1 MHz << CLK.
+     */
+    /* 4-6 */ volatile u32 CLK : 3 = 0;
+
+    /**
+     * Transfer complete interrupt status and mask.
+     */
+    /* 3 */ volatile u32 TCINT : 1 = 0;
+    /* 2 */ volatile u32 TCINTMASK : 1 = 0;
+
+    /**
+     * EXI interrupt status and mask.
+     */
+    /* 1 */ volatile u32 EXIINT : 1 = 0;
+    /* 0 */ volatile u32 EXIINTMASK : 1 = 0;
+  };
+
+  struct Cr {
+    using Size = u32;
+
+    /* 6-31 */ u32 : 26;
+
+    /**
+     * Immediate transfer length in bytes, minus one.
+     */
+    /* 4-5 */ volatile u32 TLEN : 2 = 0;
+
+    /**
+     * 0: read, 1: write, 2: read/write.
+     */
+    /* 2-3 */ volatile u32 RW : 2 = 0;
+
+    /**
+     * DMA instead of an immediate transfer.
+     */
+    /* 1 */ volatile u32 DMA : 1 = 0;
+
+    /**
+     * Start the transfer. Cleared by hardware when it completes.
+     */
+    /* 0 */ volatile u32 TSTART : 1 = 0;
+  };
+
+  struct Channel {
+    /**
+     * Channel Parameter Register.
+     *
+     * Address: 0x0D006800 + channel * 0x14
+     * Size: u32
+     */
+    Register<Csr> CSR;
+
+    /**
+     * DMA Start Address.
+     *
+     * Address: 0x0D006804 + channel * 0x14
+     * Size: u32
+     */
+    volatile u32 MAR;
+
+    /**
+     * DMA Transfer Length.
+     *
+     * Address: 0x0D006808 + channel * 0x14
+     * Size: u32
+     */
+    volatile u32 LENGTH;
+
+    /**
+     * Control Register.
+     *
+     * Address: 0x0D00680C + channel * 0x14
+     * Size: u32
+     */
+    Register<Cr> CR;
+
+    /**
+     * Immediate Data, left aligned.
+     *
+     * Address: 0x0D006810 + channel * 0x14
+     * Size: u32
+     */
+    volatile u32 DATA;
+  };
+
+  Channel CHANNEL[3];
+
+  _PELI_PAD(0x3C, 0x40);
+};
+
+static_assert(sizeof(ExternalInterface) == 0x40);
+
+namespace ppc {
+inline ExternalInterface *const EXI =
+    reinterpret_cast<ExternalInterface *>(0xCD006800);
+}
+namespace iop {
+inline ExternalInterface *const EXI =
+    reinterpret_cast<ExternalInterface *>(0xCD806800);
+}
+using PELI_HW_HOST_NAME::EXI;
+
+} // namespace peli::hw
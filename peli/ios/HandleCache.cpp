@@ -0,0 +1,239 @@
+// peli/ios/HandleCache.cpp - Shared IOS device and file handles
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "HandleCache.hpp"
+#include "../host/Mutex.hpp"
+#include "../util/Defer.hpp"
+#include "../util/Memory.hpp"
+#include "../util/String.hpp"
+#include "Error.hpp"
+#include "fs/Types.hpp"
+#include "low/Ipc.hpp"
+
+namespace peli::ios {
+
+namespace {
+
+constexpr u32 MaxEntries = PELI_IOS_HANDLE_CACHE_SIZE;
+constexpr u32 MaxIdleFiles = PELI_IOS_FILE_CACHE_SIZE;
+
+struct Entry {
+  char path[low::PathSize];
+  s32 handle;
+  u32 flags;
+  u32 refs;
+  u32 last_use;
+  bool used;
+  bool is_device;
+};
+
+constinit host::Mutex s_mutex;
+constinit Entry s_entries[MaxEntries] = {};
+constinit u32 s_tick = 0;
+
+bool isDevice(const char *path) noexcept {
+  return util::StrLen(path) > 5 && util::MemoryEqual(path, "/dev/", 5);
+}
+
+bool pathEquals(const char *a, const char *b) noexcept {
+  const size_t length = util::StrLen(a);
+  return length == util::StrLen(b) && util::MemoryEqual(a, b, length);
+}
+
+// Matches the path itself or anything below it
+bool pathUnder(const char *path, const char *prefix) noexcept {
+  const size_t length = util::StrLen(prefix);
+  return util::StrLen(path) >= length &&
+         util::MemoryEqual(path, prefix, length) &&
+         (path[length] == '\0' || path[length] == '/');
+}
+
+void close(Entry &entry) noexcept {
+  low::IOS_Close(entry.handle);
+  entry.used = false;
+}
+
+// Expects the mutex to be held. Closes the least recently used idle handle,
+// preferring files over devices.
+bool evictOne() noexcept {
+  Entry *victim = nullptr;
+  for (Entry &entry : s_entries) {
+    if (!entry.used || entry.refs != 0) {
+      continue;
+    }
+    if (!victim || (victim->is_device && !entry.is_device) ||
+        (victim->is_device == entry.is_device &&
+         entry.last_use < victim->last_use)) {
+      victim = &entry;
+    }
+  }
+
+  if (!victim) {
+    return false;
+  }
+  close(*victim);
+  return true;
+}
+
+// Expects the mutex to be held
+void trimIdleFiles() noexcept {
+  while (true) {
+    u32 idle_count = 0;
+    Entry *oldest = nullptr;
+    for (Entry &entry : s_entries) {
+      if (!entry.used || entry.is_device || entry.refs != 0) {
+        continue;
+      }
+      idle_count++;
+      if (!oldest || entry.last_use < oldest->last_use) {
+        oldest = &entry;
+      }
+    }
+
+    if (idle_count <= MaxIdleFiles) {
+      return;
+    }
+    close(*oldest);
+  }
+}
+
+// Expects the mutex to be held
+s32 open(const char *path, u32 flags) noexcept {
+  while (true) {
+    s32 handle = low::IOS_Open(path, flags);
+    if ((handle != IOSError::IOS_ERROR_MAX &&
+         handle != IOSError::ISFS_ERROR_MAXFD) ||
+        !evictOne()) {
+      return handle;
+    }
+  }
+}
+
+// Expects the mutex to be held
+Entry *freeEntry() noexcept {
+  for (Entry &entry : s_entries) {
+    if (!entry.used) {
+      return &entry;
+    }
+  }
+  return evictOne() ? freeEntry() : nullptr;
+}
+
+// Expects the mutex to be held
+void evict(const char *path) noexcept {
+  for (Entry &entry : s_entries) {
+    if (entry.used && !entry.is_device && entry.refs == 0 &&
+        pathUnder(entry.path, path)) {
+      close(entry);
+    }
+  }
+}
+
+} // namespace
+
+s32 HandleCache::Acquire(const char *path, u32 flags) noexcept {
+  if (util::StrLen(path) >= low::PathSize) {
+    return IOSError::IOS_ERROR_INVALID;
+  }
+
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  const bool is_device = isDevice(path);
+  if (!is_device &&
+      (MaxIdleFiles == 0 || flags != static_cast<u32>(fs::OpenMode::Read))) {
+    // Not shared, but an idle read handle could still block this open
+    evict(path);
+    return open(path, flags);
+  }
+
+  const u32 tick = ++s_tick;
+  for (Entry &entry : s_entries) {
+    if (!entry.used || entry.flags != flags || !pathEquals(entry.path, path)) {
+      continue;
+    }
+
+    if (is_device) {
+      entry.refs++;
+      entry.last_use = tick;
+      return entry.handle;
+    }
+
+    if (entry.refs == 0) {
+      // Rewind so the handle looks freshly opened
+      if (low::IOS_Seek(entry.handle, 0, 0) != 0) {
+        close(entry);
+        continue;
+      }
+      entry.refs = 1;
+      entry.last_use = tick;
+      return entry.handle;
+    }
+  }
+
+  s32 handle = open(path, flags);
+  if (handle < 0) {
+    return handle;
+  }
+
+  // If the table is full, the handle is simply not tracked and Release()
+  // closes it
+  if (Entry *entry = freeEntry()) {
+    *entry = {
+        .path = {},
+        .handle = handle,
+        .flags = flags,
+        .refs = 1,
+        .last_use = tick,
+        .used = true,
+        .is_device = is_device,
+    };
+    util::StrCopy<low::PathSize>(entry->path, path);
+  }
+  return handle;
+}
+
+void HandleCache::Release(s32 handle) noexcept {
+  if (handle < 0) {
+    return;
+  }
+
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  for (Entry &entry : s_entries) {
+    if (!entry.used || entry.handle != handle) {
+      continue;
+    }
+
+    if (entry.refs > 0 && --entry.refs == 0 && !entry.is_device) {
+      trimIdleFiles();
+    }
+    return;
+  }
+
+  low::IOS_Close(handle);
+}
+
+void HandleCache::Evict(const char *path) noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  evict(path);
+}
+
+void HandleCache::Flush() noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  for (Entry &entry : s_entries) {
+    if (entry.used && entry.refs == 0) {
+      close(entry);
+    }
+  }
+}
+
+} // namespace peli::ios
@@ -0,0 +1,60 @@
+// peli/ios/HandleCache.hpp - Shared IOS device and file handles
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Types.hpp"
+#include "../host/Config.h"
+
+namespace peli::ios {
+
+/**
+ * Process-wide cache of IOS handles, to avoid an open and close round trip for
+ * every short-lived Resource.
+ *
+ * - Device nodes (paths under /dev/) are opened once and shared between all
+ *   users with the same flags. Handles are reference counted and stay open
+ *   while idle.
+ * - Files opened read-only get their own handle each, but on release the
+ *   handle is parked in a small LRU instead of being closed. A later open of
+ *   the same path reuses it, rewound to the start of the file.
+ * - Anything else is opened and closed as normal.
+ *
+ * IOS only has a small number of handles to go around, so when an open fails
+ * because none are left, idle handles are closed (files first, oldest first)
+ * and the open is retried. All functions are thread safe.
+ */
+class HandleCache {
+public:
+  /**
+   * Tag for Resource constructors that go through the cache.
+   */
+  struct Shared {};
+
+  /**
+   * Open a path through the cache. Returns the handle or an IOS error.
+   */
+  static s32 Acquire(const char *path, u32 flags = 0) noexcept;
+
+  /**
+   * Release a handle obtained from Acquire(). Handles the cache doesn't track
+   * are closed.
+   */
+  static void Release(s32 handle) noexcept;
+
+  /**
+   * Close idle file handles for a path, or for anything under it if it is a
+   * directory. ISFS won't delete or rename a file that has a handle open.
+   */
+  static void Evict(const char *path) noexcept;
+
+  /**
+   * Close every idle handle, devices included.
+   */
+  static void Flush() noexcept;
+};
+
+} // namespace peli::ios
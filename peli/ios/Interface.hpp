@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../cmn/Types.hpp"
+#include "../host/Config.h"
 #include "../host/Host.hpp"
 #include "../util/Address.hpp"
 #include "../util/Concept.hpp"
@@ -72,25 +73,37 @@ protected:
     static constexpr size_t ExpectedParamCount = TInCount + TOutPtrCount;
     static constexpr size_t OutPtrCount = TOutPtrCount;
 
-    u8 *m_v_stack_ptr;
-    size_t m_alloc_size;
+    // Output pointers supplied as a size are backed by this storage. Sizes up
+    // to PELI_IOS_VECTOR_INLINE_SIZE live in the request object itself, so
+    // only unusually large outputs go to the heap.
+    static constexpr size_t InlineSize = PELI_IOS_VECTOR_INLINE_SIZE;
+
+    size_t m_alloc_size = 0;
+    u8 *m_v_heap_ptr = nullptr;
+    alignas(low::Alignment) u8 m_v_inline[InlineSize > 0 ? InlineSize : 1];
 
     constexpr Vector() = default;
 
     template <class... TDefaults>
     constexpr Vector(size_t alloc_size, low::IOVector *,
-                     const TDefaults &...) noexcept {
-      m_alloc_size = alloc_size;
-      m_v_stack_ptr =
-          alloc_size > 0
-              ? static_cast<u8 *>(host::Alloc(low::Alignment, alloc_size))
-              : nullptr;
-    }
+                     const TDefaults &...) noexcept
+        : m_alloc_size(alloc_size),
+          m_v_heap_ptr(alloc_size > InlineSize
+                           ? static_cast<u8 *>(
+                                 host::Alloc(low::Alignment, alloc_size))
+                           : nullptr) {}
 
     constexpr ~Vector() noexcept {
-      if (m_v_stack_ptr) {
-        host::Free(m_v_stack_ptr, m_alloc_size);
+      if (m_v_heap_ptr) {
+        host::Free(m_v_heap_ptr, m_alloc_size);
+      }
+    }
+
+    constexpr u8 *Data() noexcept {
+      if (m_alloc_size == 0) {
+        return nullptr;
       }
+      return m_v_heap_ptr ? m_v_heap_ptr : m_v_inline;
     }
 
     // Custom placement new here to remove dependency on <new>
@@ -201,7 +214,7 @@ protected:
       static_assert(IsOutput,
                     "Input pointer cannot be allocated by passing size");
       if (alloc_size_in > 0) {
-        vec[VecIndex].data = Base::m_v_stack_ptr + alloc_size;
+        vec[VecIndex].data = Base::Data() + alloc_size;
         vec[VecIndex].size = alloc_size_in;
       } else {
         vec[VecIndex].data = nullptr;
@@ -451,7 +464,7 @@ public:
 
       template <size_t TOutputIndex = 0> constexpr auto GetOutput() {
         if constexpr (OrderedTypes::Vector::OutPtrCount > 0) {
-          return *static_cast<const OutType *>(m_stack.m_v_stack_ptr);
+          return *static_cast<const OutType *>(m_stack.Data());
         } else {
           return m_stack.template Get<
               OutputVecIndex<Reversed, sizeof...(TInTypes),
@@ -9,7 +9,11 @@
 
 namespace peli::ios {
 
+template <u32 TCapacity> class RequestSet;
+
 class Request {
+  template <u32 TCapacity> friend class RequestSet;
+
 public:
   class Open;
   class Close;
@@ -0,0 +1,118 @@
+// peli/ios/RequestSet.hpp - Wait on several outstanding requests at once
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Types.hpp"
+#include "../host/MessageQueue.hpp"
+#include "../ppc/Msr.hpp"
+#include "Request.hpp"
+#include "low/Ipc.hpp"
+
+namespace peli::ios {
+
+/**
+ * A set of in-flight requests that complete into one shared queue, so a single
+ * thread can block until whichever of them finishes first.
+ *
+ * IOS has no way to abort a request once it has been sent, so requests still
+ * in the set when it is cancelled or destroyed are waited for and their results
+ * discarded. The request objects must outlive their membership in the set.
+ */
+template <u32 TCapacity = 8> class RequestSet {
+public:
+  RequestSet() noexcept = default;
+  RequestSet(const RequestSet &) = delete;
+
+  ~RequestSet() noexcept { Cancel(); }
+
+  /**
+   * Add an in-flight request to the set. Returns false if the set is full or
+   * the request has already been synced.
+   */
+  bool Add(Request &request) noexcept {
+    if (m_count == TCapacity || request.m_synced) {
+      return false;
+    }
+
+    // The reply handler reads the queue pointer out of the command block, so
+    // redirecting it must be atomic with respect to the reply arriving
+    ppc::Msr::NoInterruptsScope guard;
+
+    m_requests[m_count++] = &request;
+
+    low::IPCCommandBlock *reply;
+    if (request.m_queue.TryReceive(reply)) {
+      // Already completed, forward the reply
+      m_queue.Send(reply);
+    } else {
+      request.m_cmd_block.queue = &m_queue;
+    }
+    return true;
+  }
+
+  /**
+   * Block until any request in the set completes, then remove it from the set
+   * and return it. The returned request is synced, so its result and outputs
+   * can be read directly. Returns null if the set is empty.
+   */
+  Request *WaitAny() noexcept {
+    if (m_count == 0) {
+      return nullptr;
+    }
+    return complete(m_queue.Receive());
+  }
+
+  /**
+   * Same as WaitAny(), but returns null instead of blocking if no request has
+   * completed yet.
+   */
+  Request *TryWaitAny() noexcept {
+    low::IPCCommandBlock *reply;
+    if (m_count == 0 || !m_queue.TryReceive(reply)) {
+      return nullptr;
+    }
+    return complete(reply);
+  }
+
+  /**
+   * Wait for every remaining request and discard the results.
+   */
+  void Cancel() noexcept {
+    while (WaitAny()) {
+    }
+  }
+
+  u32 GetCount() const noexcept { return m_count; }
+  bool IsEmpty() const noexcept { return m_count == 0; }
+
+private:
+  Request *complete(low::IPCCommandBlock *reply) noexcept {
+    for (u32 i = 0; i < m_count; i++) {
+      Request *request = m_requests[i];
+      if (&request->m_cmd_block != reply) {
+        continue;
+      }
+
+      m_requests[i] = m_requests[--m_count];
+
+      // Hand the reply back to the request's own queue so Sync() keeps working
+      reply->queue = &request->m_queue;
+      request->m_queue.Send(reply);
+      request->m_synced = true;
+      return request;
+    }
+
+    _PELI_ASSERT(false, "Reply does not belong to the request set");
+    return nullptr;
+  }
+
+  Request *m_requests[TCapacity] = {};
+  u32 m_count = 0;
+  host::MessageQueue<low::IPCCommandBlock *, TCapacity> m_queue;
+};
+
+} // namespace peli::ios
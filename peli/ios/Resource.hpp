@@ -2,6 +2,7 @@
 
 #include "../cmn/Types.hpp"
 #include "Error.hpp"
+#include "HandleCache.hpp"
 #include "Interface.hpp"
 #include "Request.hpp"
 #include "low/Ipc.hpp"
@@ -12,19 +13,33 @@ template <class TInterfaceType = void> class Resource;
 
 template <> class Resource<void> {
   const s32 m_handle = IOSError::IOS_ERROR_NOEXISTS;
+  const bool m_cached = false;
 
 public:
   constexpr Resource() noexcept = default;
   constexpr Resource(const Resource &) = delete;
-  constexpr Resource(Resource &&other) noexcept : m_handle(other.m_handle) {}
+  constexpr Resource(Resource &&other) noexcept
+      : m_handle(other.m_handle), m_cached(other.m_cached) {}
 
   Resource(const char *path, u32 flags = 0) noexcept
       : m_handle(low::IOS_Open(path, flags)) {}
 
+  /**
+   * Open the path through the HandleCache. The handle is released back to the
+   * cache on destruction instead of being closed.
+   */
+  Resource(HandleCache::Shared, const char *path, u32 flags = 0) noexcept
+      : m_handle(HandleCache::Acquire(path, flags)), m_cached(true) {}
+
   constexpr Resource(s32 handle) noexcept : m_handle(handle) {}
 
   ~Resource() noexcept {
-    if (m_handle >= 0) {
+    if (m_handle < 0) {
+      return;
+    }
+    if (m_cached) {
+      HandleCache::Release(m_handle);
+    } else {
       low::IOS_Close(m_handle);
     }
   }
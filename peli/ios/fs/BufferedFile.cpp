@@ -0,0 +1,350 @@
+// peli/ios/fs/BufferedFile.cpp - Buffered stream over an ISFS file
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "BufferedFile.hpp"
+#include "../../host/Host.hpp"
+#include "../../util/Address.hpp"
+#include "../low/Ipc.hpp"
+#include "MetaCache.hpp"
+
+namespace peli::ios::fs {
+
+namespace {
+
+constexpr u32 min(u32 a, u32 b) noexcept { return a < b ? a : b; }
+
+} // namespace
+
+// Each buffer has room for a second block, so Peek() can append the start of
+// the next block when the requested range straddles the two
+BufferedFile::BufferedFile(const char *path, OpenMode mode,
+                           u32 block_size) noexcept
+    : m_file(path, mode),
+      m_block_size(util::AlignUp(low::Alignment, block_size)), m_buffers{} {
+  if (!m_file.IsValid()) {
+    m_error = static_cast<IOSError>(m_file.GetHandle());
+    return;
+  }
+
+  for (u8 *&buffer : m_buffers) {
+    buffer =
+        static_cast<u8 *>(host::Alloc(low::Alignment, m_block_size * 2));
+  }
+  if (!m_buffers[0] || !m_buffers[1]) {
+    m_error = IOSError::IOS_ERROR_FAIL_ALLOC;
+  }
+}
+
+BufferedFile::~BufferedFile() noexcept {
+  Flush();
+  if (m_ahead_pending) {
+    m_ahead.Sync();
+  }
+  m_write.Sync();
+
+  for (u8 *buffer : m_buffers) {
+    if (buffer) {
+      host::Free(buffer, m_block_size * 2);
+    }
+  }
+}
+
+s32 BufferedFile::Read(void *data, u32 size) noexcept {
+  if (!IsValid()) {
+    return m_error;
+  }
+  if (m_state == State::Writing) {
+    if (IOSError error = toIdle()) {
+      return error;
+    }
+  }
+  m_state = State::Reading;
+  m_error = IOSError::IOS_ERROR_OK;
+
+  u32 copied = 0;
+  while (copied < size) {
+    if (m_offset == m_length && !advance()) {
+      break;
+    }
+
+    const u32 count = min(size - copied, m_length - m_offset);
+    __builtin_memcpy(static_cast<u8 *>(data) + copied,
+                     m_buffers[0] + m_offset, count);
+    m_offset += count;
+    copied += count;
+  }
+
+  return copied == 0 && m_error ? s32(m_error) : s32(copied);
+}
+
+s32 BufferedFile::Write(const void *data, u32 size) noexcept {
+  if (!IsValid()) {
+    return m_error;
+  }
+  if (m_state == State::Reading) {
+    if (IOSError error = toIdle()) {
+      return error;
+    }
+  }
+  m_state = State::Writing;
+  m_eof = false;
+
+  u32 copied = 0;
+  while (copied < size) {
+    const u32 count = min(size - copied, m_block_size - m_offset);
+    __builtin_memcpy(m_buffers[0] + m_offset,
+                     static_cast<const u8 *>(data) + copied, count);
+    m_offset += count;
+    copied += count;
+    if (m_offset > m_length) {
+      m_length = m_offset;
+    }
+
+    if (m_offset == m_block_size && !flushBlock()) {
+      return m_error;
+    }
+  }
+
+  return s32(copied);
+}
+
+const u8 *BufferedFile::Peek(u32 size) noexcept {
+  if (!IsValid() || size > m_block_size) {
+    return nullptr;
+  }
+  if (m_state == State::Writing && toIdle()) {
+    return nullptr;
+  }
+  m_state = State::Reading;
+
+  if (m_offset == m_length && !advance()) {
+    return nullptr;
+  }
+
+  if (m_length - m_offset < size) {
+    // The range runs into the next block. Copy the start of the read-ahead to
+    // the end of this buffer; advance() skips what was copied.
+    if (!m_ahead_pending) {
+      return nullptr;
+    }
+    s32 result = m_ahead.Sync().GetResult();
+    if (result < 0) {
+      m_error = static_cast<IOSError>(result);
+      return nullptr;
+    }
+
+    const u32 count = min(size - (m_length - m_offset),
+                          u32(result) - m_ahead_skip);
+    __builtin_memcpy(m_buffers[0] + m_length, m_buffers[1] + m_ahead_skip,
+                     count);
+    m_length += count;
+    m_ahead_skip += count;
+
+    if (m_length - m_offset < size) {
+      return nullptr;
+    }
+  }
+
+  return m_buffers[0] + m_offset;
+}
+
+s32 BufferedFile::Seek(s32 where, s32 whence) noexcept {
+  if (!IsValid()) {
+    return m_error;
+  }
+
+  s64 target;
+  switch (whence) {
+  case 0:
+    target = where;
+    break;
+
+  case 1:
+    target = s64(Tell()) + where;
+    break;
+
+  case 2: {
+    if (IOSError error = Flush()) {
+      return error;
+    }
+    s32 size;
+    if (IOSError error = m_file.GetSize(size)) {
+      return error;
+    }
+    target = s64(size) + where;
+    break;
+  }
+
+  default:
+    return IOSError::ISFS_ERROR_INVALID;
+  }
+
+  if (target < 0 || target > 0x7FFFFFFF) {
+    return IOSError::ISFS_ERROR_INVALID;
+  }
+
+  // Stay within the current buffer if possible
+  if (m_state == State::Reading && target >= m_base &&
+      target <= m_base + m_length) {
+    m_offset = u32(target - m_base);
+    return s32(target);
+  }
+
+  if (IOSError error = toIdle(false)) {
+    return error;
+  }
+
+  s32 result = m_file.Seek(s32(target), 0).Sync().GetResult();
+  if (result < 0) {
+    return m_error = static_cast<IOSError>(result);
+  }
+  m_base = u32(target);
+  return s32(target);
+}
+
+IOSError BufferedFile::Flush() noexcept {
+  if (m_state != State::Writing) {
+    return IOSError::IOS_ERROR_OK;
+  }
+
+  if (m_length != 0 && !flushBlock()) {
+    return m_error;
+  }
+  if (!syncWrite()) {
+    return m_error;
+  }
+
+  m_state = State::Idle;
+  return IOSError::IOS_ERROR_OK;
+}
+
+// Move on to the next block. Returns false at the end of the file or on error.
+bool BufferedFile::advance() noexcept {
+  if (m_ahead_pending) {
+    m_ahead_pending = false;
+    s32 result = m_ahead.Sync().GetResult();
+    if (result < 0) {
+      m_error = static_cast<IOSError>(result);
+      return false;
+    }
+
+    u8 *buffer = m_buffers[0];
+    m_buffers[0] = m_buffers[1];
+    m_buffers[1] = buffer;
+
+    m_base = m_ahead_base;
+    m_length = u32(result);
+    m_offset = m_ahead_skip;
+    m_ahead_skip = 0;
+  } else {
+    if (m_eof) {
+      return false;
+    }
+
+    m_base += m_length;
+    m_offset = 0;
+    m_length = 0;
+
+    s32 result =
+        m_file.Read(m_buffers[0], s32(m_block_size)).Sync().GetResult();
+    if (result < 0) {
+      m_error = static_cast<IOSError>(result);
+      return false;
+    }
+    m_length = u32(result);
+  }
+
+  if (m_length < m_block_size) {
+    m_eof = true;
+  } else {
+    issueReadAhead();
+  }
+
+  if (m_offset == m_length) {
+    // Everything in this block was already copied by Peek()
+    return advance();
+  }
+  return true;
+}
+
+void BufferedFile::issueReadAhead() noexcept {
+  m_ahead_base = m_base + m_length;
+  m_ahead.New(m_file.GetHandle(), m_buffers[1], s32(m_block_size));
+  m_ahead_pending = true;
+}
+
+// Send the current buffer and continue filling the other one
+bool BufferedFile::flushBlock() noexcept {
+  if (!syncWrite()) {
+    return false;
+  }
+
+  MetaCache::InvalidateSize(m_file.GetPath());
+  m_write.New(m_file.GetHandle(), m_buffers[0], s32(m_length));
+  m_write_pending = true;
+
+  u8 *buffer = m_buffers[0];
+  m_buffers[0] = m_buffers[1];
+  m_buffers[1] = buffer;
+
+  m_base += m_length;
+  m_length = 0;
+  m_offset = 0;
+  return true;
+}
+
+bool BufferedFile::syncWrite() noexcept {
+  if (!m_write_pending) {
+    return true;
+  }
+  m_write_pending = false;
+
+  s32 result = m_write.Sync().GetResult();
+  if (result < 0) {
+    m_error = static_cast<IOSError>(result);
+    return false;
+  }
+  if (result != m_write.GetSize()) {
+    // ISFS only writes short when the NAND is full
+    m_error = IOSError::ISFS_ERROR_MAXBLOCKS;
+    return false;
+  }
+  return true;
+}
+
+// Drop buffered state so the IOS file position can be used directly. If
+// `reposition` is set, the IOS file position is moved to Tell() first.
+IOSError BufferedFile::toIdle(bool reposition) noexcept {
+  if (m_state == State::Writing) {
+    return Flush();
+  }
+  if (m_state != State::Reading) {
+    return IOSError::IOS_ERROR_OK;
+  }
+
+  const u32 position = m_base + m_offset;
+  if (m_ahead_pending) {
+    m_ahead.Sync();
+    m_ahead_pending = false;
+    m_ahead_skip = 0;
+  }
+
+  m_state = State::Idle;
+  m_eof = false;
+  m_base = position;
+  m_length = 0;
+  m_offset = 0;
+
+  if (reposition) {
+    s32 result = m_file.Seek(s32(position), 0).Sync().GetResult();
+    if (result < 0) {
+      return m_error = static_cast<IOSError>(result);
+    }
+  }
+  return IOSError::IOS_ERROR_OK;
+}
+
+} // namespace peli::ios::fs
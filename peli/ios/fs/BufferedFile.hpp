@@ -0,0 +1,127 @@
+// peli/ios/fs/BufferedFile.hpp - Buffered stream over an ISFS file
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../../cmn/Types.hpp"
+#include "../Error.hpp"
+#include "../Request.hpp"
+#include "File.hpp"
+#include "Types.hpp"
+
+namespace peli::ios::fs {
+
+/**
+ * Buffered stream over an ISFS file, for parsers that want to read or write a
+ * few bytes at a time without an IPC round trip for each.
+ *
+ * Two aligned buffers of the block size are kept. While reading, the next
+ * block is requested as soon as the current one is filled, so it is usually
+ * ready by the time the caller gets to it. While writing, a full block is sent
+ * asynchronously and filling continues in the other buffer. Switching between
+ * reading and writing, or seeking outside the current block, flushes first.
+ */
+class BufferedFile {
+public:
+  /**
+   * One NAND cluster, which is also the most efficient transfer size for ISFS.
+   */
+  static constexpr u32 DefaultBlockSize = ClusterSize;
+
+  BufferedFile(const char *path, OpenMode mode,
+               u32 block_size = DefaultBlockSize) noexcept;
+  ~BufferedFile() noexcept;
+
+  BufferedFile(const BufferedFile &) = delete;
+  BufferedFile(BufferedFile &&) = delete;
+
+  bool IsValid() const noexcept {
+    return m_file.IsValid() && m_buffers[0] && m_buffers[1];
+  }
+
+  /**
+   * Get the error that stopped the last operation short, if any.
+   */
+  IOSError GetError() const noexcept { return m_error; }
+
+  /**
+   * Read up to `size` bytes. Returns the number of bytes read, which is only
+   * short at the end of the file, or an error if nothing could be read.
+   */
+  s32 Read(void *data, u32 size) noexcept;
+
+  /**
+   * Write `size` bytes. Returns the number of bytes accepted into the buffer
+   * or an error. Errors from write-behind are reported by a later Write() or
+   * Flush().
+   */
+  s32 Write(const void *data, u32 size) noexcept;
+
+  /**
+   * Get a pointer to the next `size` bytes in the buffer without copying or
+   * consuming them. `size` can be up to the block size. Returns null if fewer
+   * than `size` bytes are left in the file.
+   */
+  const u8 *Peek(u32 size) noexcept;
+
+  /**
+   * Advance past bytes previously returned by Peek().
+   */
+  void Consume(u32 size) noexcept {
+    m_offset = m_offset + size < m_length ? m_offset + size : m_length;
+  }
+
+  /**
+   * Seek like IOS_Seek. Returns the new position or an error.
+   */
+  s32 Seek(s32 where, s32 whence) noexcept;
+
+  s32 Tell() const noexcept { return s32(m_base + m_offset); }
+
+  /**
+   * Write out buffered data and wait for it to complete.
+   */
+  IOSError Flush() noexcept;
+
+private:
+  enum class State : u8 {
+    Idle,
+    Reading,
+    Writing,
+  };
+
+  bool advance() noexcept;
+  bool flushBlock() noexcept;
+  bool syncWrite() noexcept;
+  IOSError toIdle(bool reposition = true) noexcept;
+  void issueReadAhead() noexcept;
+
+  File m_file;
+  u32 m_block_size;
+  u8 *m_buffers[2];
+
+  State m_state = State::Idle;
+  bool m_eof = false;
+  IOSError m_error = IOSError::IOS_ERROR_OK;
+
+  // File offset of the start of the current buffer, number of valid bytes in
+  // it, and the caller's position within it
+  u32 m_base = 0;
+  u32 m_length = 0;
+  u32 m_offset = 0;
+
+  // Read-ahead into the other buffer
+  Request::Read m_ahead{util::NoConstruct{}};
+  bool m_ahead_pending = false;
+  u32 m_ahead_base = 0;
+  u32 m_ahead_skip = 0;
+
+  // Write-behind from the other buffer
+  Request::Write m_write{util::NoConstruct{}};
+  bool m_write_pending = false;
+};
+
+} // namespace peli::ios::fs
@@ -7,8 +7,10 @@
 #pragma once
 
 #include "../../cmn/Types.hpp"
+#include "../../util/String.hpp"
 #include "../Resource.hpp"
 #include "Interface.hpp"
+#include "MetaCache.hpp"
 #include "Types.hpp"
 
 namespace peli::ios::fs {
@@ -16,7 +18,11 @@ namespace peli::ios::fs {
 class File : Resource<Interface>, public Interface {
 public:
   File(const char *path, OpenMode mode)
-      : Resource(path, static_cast<u32>(mode)) {}
+      : Resource(HandleCache::Shared{}, path, static_cast<u32>(mode)) {
+    if (util::StrLen(path) < PathSize) {
+      util::StrCopy<PathSize>(m_path, path);
+    }
+  }
 
   ~File() noexcept = default;
 
@@ -29,24 +35,60 @@ public:
   using Resource::Read;
   using Resource::Resource;
   using Resource::Seek;
-  using Resource::Write;
+
+  /**
+   * Path the file was opened with, or empty if it was constructed from a
+   * handle.
+   */
+  const char *GetPath() const noexcept { return m_path; }
+
+  /**
+   * Write request that drops the cached file size again once it's done. A
+   * request has always completed by the time it's destroyed, so this catches
+   * any size cached by GetFileStats while the write was in flight.
+   */
+  class WriteRequest : public Request::Write {
+  public:
+    WriteRequest(s32 fd, void *data, s32 size, const char *path) noexcept
+        : Request::Write(fd, data, size), m_path(path) {}
+
+    ~WriteRequest() noexcept { MetaCache::InvalidateSize(m_path); }
+
+  private:
+    const char *m_path;
+  };
+
+  WriteRequest Write(void *data, s32 size) noexcept {
+    MetaCache::InvalidateSize(m_path);
+    return WriteRequest(GetHandle(), data, size, m_path);
+  }
 
   IOSError GetFileStats(FileStats &stats) noexcept {
-    return GetFileStats::Request(GetHandle())
-        .Sync()
-        .CopyOutput(stats)
-        .GetError();
+    IOSError error = GetFileStats::Request(GetHandle())
+                         .Sync()
+                         .CopyOutput(stats)
+                         .GetError();
+    if (error == IOSError::ISFS_ERROR_OK && m_path[0] != '\0') {
+      MetaCache::PutSize(m_path, stats.size);
+    }
+    return error;
   }
 
   IOSError GetFileStats(s32 &size, s32 &pos) noexcept {
-    auto request = GetFileStats::Request(GetHandle()).Sync();
-    FileStats stats = request.GetOutput();
+    FileStats stats = {};
+    IOSError error = GetFileStats(stats);
     size = stats.size;
     pos = stats.pos;
-    return request.GetError();
+    return error;
   }
 
   IOSError GetSize(s32 &size) noexcept {
+    u32 cached_size;
+    if (m_path[0] != '\0' && MetaCache::GetSize(m_path, cached_size)) {
+      size = cached_size;
+      return IOSError::ISFS_ERROR_OK;
+    }
+
     s32 pos;
     return GetFileStats(size, pos);
   }
@@ -55,6 +97,9 @@ public:
     s32 size;
     return GetFileStats(size, pos);
   }
+
+private:
+  Path m_path = {};
 };
 
 } // namespace peli::ios::fs
\ No newline at end of file
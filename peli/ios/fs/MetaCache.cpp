@@ -0,0 +1,309 @@
+// peli/ios/fs/MetaCache.cpp - NAND metadata cache
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "MetaCache.hpp"
+#include "../../host/Host.hpp"
+#include "../../host/Mutex.hpp"
+#include "../../util/Defer.hpp"
+#include "../../util/Memory.hpp"
+#include "../../util/String.hpp"
+
+namespace peli::ios::fs {
+
+namespace {
+
+constexpr u32 MaxEntries = PELI_IOS_META_CACHE_SIZE;
+constexpr u32 MaxListingSize = PELI_IOS_META_CACHE_LISTING_SIZE;
+
+enum Flags : u8 {
+  HasAttr = 1 << 0,
+  HasSize = 1 << 1,
+  HasCount = 1 << 2,
+  HasNames = 1 << 3,
+};
+
+struct Entry {
+  Path path;
+  u32 hash;
+  u32 last_use;
+  u8 flags;
+  Attr attr;
+  u32 size;
+
+  // Directory listing: total entry count, and the first `name_count` names
+  // packed as READ_DIR returns them
+  u32 total;
+  u32 name_count;
+  u32 names_size;
+  char *names;
+};
+
+constinit host::Mutex s_mutex;
+constinit Entry s_entries[MaxEntries] = {};
+constinit u32 s_tick = 0;
+
+// FNV-1a, to skip most path comparisons
+u32 hashPath(const char *path) noexcept {
+  u32 hash = 0x811C9DC5;
+  for (; *path != '\0'; path++) {
+    hash = (hash ^ u8(*path)) * 0x01000193;
+  }
+  return hash;
+}
+
+bool pathEquals(const char *a, const char *b) noexcept {
+  const size_t length = util::StrLen(a);
+  return length == util::StrLen(b) && util::MemoryEqual(a, b, length);
+}
+
+// Matches the path itself or anything below it
+bool pathUnder(const char *path, const char *prefix) noexcept {
+  const size_t length = util::StrLen(prefix);
+  if (util::StrLen(path) < length || !util::MemoryEqual(path, prefix, length)) {
+    return false;
+  }
+  return path[length] == '\0' || path[length] == '/' ||
+         (length != 0 && prefix[length - 1] == '/');
+}
+
+// Size of the first `count` packed names
+u32 namesSize(const char *names, u32 count) noexcept {
+  const char *name = names;
+  for (u32 i = 0; i < count; i++) {
+    name += util::StrLen(name) + 1;
+  }
+  return name - names;
+}
+
+// Expects the mutex to be held
+void dropNames(Entry &entry) noexcept {
+  if (entry.names) {
+    host::Free(entry.names, entry.names_size);
+    entry.names = nullptr;
+  }
+  entry.names_size = 0;
+  entry.name_count = 0;
+  entry.flags &= ~(HasNames | HasCount);
+}
+
+// Expects the mutex to be held
+void drop(Entry &entry) noexcept {
+  dropNames(entry);
+  entry.flags = 0;
+}
+
+// Expects the mutex to be held
+Entry *find(const char *path) noexcept {
+  const u32 hash = hashPath(path);
+  for (Entry &entry : s_entries) {
+    if (entry.flags != 0 && entry.hash == hash &&
+        pathEquals(entry.path, path)) {
+      entry.last_use = ++s_tick;
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+// Expects the mutex to be held. Finds the entry for a path, replacing the least
+// recently used one if there is none.
+Entry *findOrCreate(const char *path) noexcept {
+  if (util::StrLen(path) >= PathSize) {
+    return nullptr;
+  }
+  if (Entry *entry = find(path)) {
+    return entry;
+  }
+
+  Entry *victim = &s_entries[0];
+  for (Entry &entry : s_entries) {
+    if (entry.flags == 0) {
+      victim = &entry;
+      break;
+    }
+    if (entry.last_use < victim->last_use) {
+      victim = &entry;
+    }
+  }
+
+  drop(*victim);
+  util::StrCopy<PathSize>(victim->path, path);
+  victim->hash = hashPath(path);
+  victim->last_use = ++s_tick;
+  return victim;
+}
+
+} // namespace
+
+bool MetaCache::GetAttr(const char *path, Attr &attr) noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  Entry *entry = find(path);
+  if (!entry || !(entry->flags & HasAttr)) {
+    return false;
+  }
+  attr = entry->attr;
+  return true;
+}
+
+void MetaCache::PutAttr(const char *path, const Attr &attr) noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  if (Entry *entry = findOrCreate(path)) {
+    entry->attr = attr;
+    entry->flags |= HasAttr;
+  }
+}
+
+bool MetaCache::GetSize(const char *path, u32 &size) noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  Entry *entry = find(path);
+  if (!entry || !(entry->flags & HasSize)) {
+    return false;
+  }
+  size = entry->size;
+  return true;
+}
+
+void MetaCache::PutSize(const char *path, u32 size) noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  if (Entry *entry = findOrCreate(path)) {
+    entry->size = size;
+    entry->flags |= HasSize;
+  }
+}
+
+bool MetaCache::GetDirCount(const char *path, u32 &count) noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  Entry *entry = find(path);
+  if (!entry || !(entry->flags & HasCount)) {
+    return false;
+  }
+  count = entry->total;
+  return true;
+}
+
+void MetaCache::PutDirCount(const char *path, u32 count) noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  if (Entry *entry = findOrCreate(path)) {
+    if ((entry->flags & HasCount) && entry->total != count) {
+      // The listing is out of date
+      dropNames(*entry);
+    }
+    entry->total = count;
+    entry->flags |= HasCount;
+  }
+}
+
+bool MetaCache::GetDir(const char *path, u32 max_entries, NodeName *entries,
+                       u32 &total) noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  Entry *entry = find(path);
+  if (!entry || !(entry->flags & HasNames)) {
+    return false;
+  }
+
+  const u32 count = max_entries < entry->total ? max_entries : entry->total;
+  if (count > entry->name_count) {
+    return false;
+  }
+
+  __builtin_memcpy(entries, entry->names, namesSize(entry->names, count));
+  total = entry->total;
+  return true;
+}
+
+void MetaCache::PutDir(const char *path, const NodeName *entries, u32 count,
+                       u32 total) noexcept {
+  const char *names = *entries;
+  const u32 size = namesSize(names, count);
+
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  Entry *entry = findOrCreate(path);
+  if (!entry) {
+    return;
+  }
+
+  dropNames(*entry);
+  entry->total = total;
+  entry->flags |= HasCount;
+
+  if (size > MaxListingSize || count == 0) {
+    if (count == 0 && total == 0) {
+      // Empty directory, nothing to store
+      entry->flags |= HasNames;
+    }
+    return;
+  }
+
+  entry->names = static_cast<char *>(host::Alloc(alignof(char), size));
+  if (!entry->names) {
+    return;
+  }
+  __builtin_memcpy(entry->names, names, size);
+  entry->names_size = size;
+  entry->name_count = count;
+  entry->flags |= HasNames;
+}
+
+void MetaCache::Invalidate(const char *path) noexcept {
+  Path parent = {};
+  util::StrCopy<PathSize>(parent, path);
+  for (size_t i = util::StrLen(static_cast<const char *>(parent)); i-- > 0;) {
+    if (parent[i] == '/') {
+      parent[i == 0 ? 1 : i] = '\0';
+      break;
+    }
+  }
+
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  for (Entry &entry : s_entries) {
+    if (entry.flags == 0) {
+      continue;
+    }
+    if (pathUnder(entry.path, path)) {
+      drop(entry);
+    } else if (pathEquals(entry.path, parent)) {
+      dropNames(entry);
+    }
+  }
+}
+
+void MetaCache::InvalidateSize(const char *path) noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  if (Entry *entry = find(path)) {
+    entry->flags &= ~HasSize;
+  }
+}
+
+void MetaCache::Flush() noexcept {
+  s_mutex.Lock();
+  auto defer_unlock = util::Defer([]() { s_mutex.Unlock(); });
+
+  for (Entry &entry : s_entries) {
+    drop(entry);
+  }
+}
+
+} // namespace peli::ios::fs
@@ -0,0 +1,68 @@
+// peli/ios/fs/MetaCache.hpp - NAND metadata cache
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../../cmn/Types.hpp"
+#include "../../host/Config.h"
+#include "Types.hpp"
+
+namespace peli::ios::fs {
+
+/**
+ * Process-wide cache of NAND metadata: attributes, file sizes and directory
+ * listings, keyed by path. Nand and File consult it before asking IOS and fill
+ * it with the answers, so repeated stat-type queries don't need a round trip.
+ *
+ * Changes made through Nand and File invalidate the affected entries. Changes
+ * made any other way (raw requests, another process, ES installing a title)
+ * are not seen, so call Invalidate() or Flush() after them. All functions are
+ * thread safe.
+ */
+class MetaCache {
+public:
+  static bool GetAttr(const char *path, Attr &attr) noexcept;
+  static void PutAttr(const char *path, const Attr &attr) noexcept;
+
+  static bool GetSize(const char *path, u32 &size) noexcept;
+  static void PutSize(const char *path, u32 size) noexcept;
+
+  static bool GetDirCount(const char *path, u32 &count) noexcept;
+  static void PutDirCount(const char *path, u32 count) noexcept;
+
+  /**
+   * Copy a cached listing in the format READ_DIR returns it. Misses if fewer
+   * than min(max_entries, total) names were cached.
+   */
+  static bool GetDir(const char *path, u32 max_entries, NodeName *entries,
+                     u32 &total) noexcept;
+
+  /**
+   * Cache a listing of `count` packed names out of `total`. Listings larger
+   * than PELI_IOS_META_CACHE_LISTING_SIZE only have their count cached.
+   */
+  static void PutDir(const char *path, const NodeName *entries, u32 count,
+                     u32 total) noexcept;
+
+  /**
+   * Drop everything cached for a path and anything under it, and the listing
+   * of its parent directory. Use after creating, deleting, renaming or
+   * changing the attributes of a node.
+   */
+  static void Invalidate(const char *path) noexcept;
+
+  /**
+   * Drop the cached size of a file whose contents are being written.
+   */
+  static void InvalidateSize(const char *path) noexcept;
+
+  /**
+   * Drop everything.
+   */
+  static void Flush() noexcept;
+};
+
+} // namespace peli::ios::fs
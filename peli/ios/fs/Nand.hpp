@@ -7,15 +7,17 @@
 #pragma once
 
 #include "../Error.hpp"
+#include "../HandleCache.hpp"
 #include "../Resource.hpp"
 #include "../low/Ipc.hpp"
 #include "Interface.hpp"
+#include "MetaCache.hpp"
 
 namespace peli::ios::fs {
 
 class Nand : Resource<Interface>, public Interface {
 public:
-  Nand() : Resource("/dev/fs", 0) {}
+  Nand() : Resource(HandleCache::Shared{}, "/dev/fs", 0) {}
 
   constexpr s32 GetHandle() const noexcept { return Resource::GetHandle(); }
   constexpr bool IsValid() const noexcept { return Resource::IsValid(); }
@@ -28,45 +30,79 @@ public:
   }
 
   IOSError CreateDir(Attr attr) const noexcept {
-    return CreateDir::Request(GetHandle(), attr) //
-        .Sync()
-        .GetError();
+    IOSError error = CreateDir::Request(GetHandle(), attr) //
+                         .Sync()
+                         .GetError();
+    MetaCache::Invalidate(attr.path);
+    return error;
   }
 
   IOSError ReadDirCount(const char *path, u32 &count) const noexcept {
-    return ReadDirCount::Request(GetHandle(), path) //
-        .Sync()
-        .CopyOutput<0>(count)
-        .GetError();
+    if (MetaCache::GetDirCount(path, count)) {
+      return IOSError::ISFS_ERROR_OK;
+    }
+
+    IOSError error = ReadDirCount::Request(GetHandle(), path) //
+                         .Sync()
+                         .CopyOutput<0>(count)
+                         .GetError();
+    if (error == IOSError::ISFS_ERROR_OK) {
+      MetaCache::PutDirCount(path, count);
+    }
+    return error;
   }
 
   IOSError ReadDir(const char *path, u32 max_entries, NodeName *entries,
                    u32 &total_count) const noexcept {
-    return ReadDir::Request(
-               GetHandle(), path, max_entries,
-               low::IOVector{entries, sizeof(NodeName) * max_entries}) //
-        .Sync()
-        .CopyOutput<1>(total_count)
-        .GetError();
+    if (MetaCache::GetDir(path, max_entries, entries, total_count)) {
+      return IOSError::ISFS_ERROR_OK;
+    }
+
+    IOSError error =
+        ReadDir::Request(
+            GetHandle(), path, max_entries,
+            low::IOVector{entries, sizeof(NodeName) * max_entries}) //
+            .Sync()
+            .CopyOutput<1>(total_count)
+            .GetError();
+    if (error == IOSError::ISFS_ERROR_OK) {
+      MetaCache::PutDir(path, entries,
+                        max_entries < total_count ? max_entries : total_count,
+                        total_count);
+    }
+    return error;
   }
 
   IOSError SetAttr(Attr attr) const noexcept {
-    return SetAttr::Request(GetHandle(), attr) //
-        .Sync()
-        .GetError();
+    IOSError error = SetAttr::Request(GetHandle(), attr) //
+                         .Sync()
+                         .GetError();
+    MetaCache::Invalidate(attr.path);
+    return error;
   }
 
   IOSError GetAttr(const char *path, Attr &attr) const noexcept {
-    return GetAttr::Request(GetHandle(), path) //
-        .Sync()
-        .CopyOutput<0>(attr)
-        .GetError();
+    if (MetaCache::GetAttr(path, attr)) {
+      return IOSError::ISFS_ERROR_OK;
+    }
+
+    IOSError error = GetAttr::Request(GetHandle(), path) //
+                         .Sync()
+                         .CopyOutput<0>(attr)
+                         .GetError();
+    if (error == IOSError::ISFS_ERROR_OK) {
+      MetaCache::PutAttr(path, attr);
+    }
+    return error;
   }
 
   IOSError Delete(const char *path) const noexcept {
-    return Delete::Request(GetHandle(), path) //
-        .Sync()
-        .GetError();
+    HandleCache::Evict(path);
+    IOSError error = Delete::Request(GetHandle(), path) //
+                         .Sync()
+                         .GetError();
+    MetaCache::Invalidate(path);
+    return error;
   }
 
   IOSError Rename(const char *from, const char *to) const noexcept {
@@ -76,15 +112,22 @@ public:
     };
     ::strncpy(paths.from, from, PathSize);
     ::strncpy(paths.to, to, PathSize);
-    return Rename::Request(GetHandle(), paths) //
-        .Sync()
-        .GetError();
+    HandleCache::Evict(paths.from);
+    HandleCache::Evict(paths.to);
+    IOSError error = Rename::Request(GetHandle(), paths) //
+                         .Sync()
+                         .GetError();
+    MetaCache::Invalidate(paths.from);
+    MetaCache::Invalidate(paths.to);
+    return error;
   }
 
   IOSError CreateFile(Attr attr) const noexcept {
-    return CreateFile::Request(GetHandle(), attr) //
-        .Sync()
-        .GetError();
+    IOSError error = CreateFile::Request(GetHandle(), attr) //
+                         .Sync()
+                         .GetError();
+    MetaCache::Invalidate(attr.path);
+    return error;
   }
 
   IOSError GetUsage(const char *path, u32 &used_clusters,
@@ -116,9 +159,13 @@ public:
     }
     vec[TPathCount].data = size_buffer;
     vec[TPathCount].size = sizeof(u32) * TPathCount;
-    return static_cast<IOSError>(low::IOS_Ioctlv(
+    IOSError error = static_cast<IOSError>(low::IOS_Ioctlv(
         GetHandle(), static_cast<u32>(Ioctl::CREATE_MULTIPLE_FILES), TPathCount,
         0, vec));
+    for (size_t i = 0; i < TPathCount; ++i) {
+      MetaCache::Invalidate(path_buffer[i]);
+    }
+    return error;
   }
 
   IOSError CreateMultipleFiles(const char *const *paths, const u32 *sizes,
@@ -144,6 +191,9 @@ public:
     IOSError error = static_cast<IOSError>(low::IOS_Ioctlv(
         GetHandle(), static_cast<u32>(Ioctl::CREATE_MULTIPLE_FILES), count, 0,
         vec));
+    for (u32 i = 0; i < count; ++i) {
+      MetaCache::Invalidate(&path_buffer[i * PathSize]);
+    }
     ::free(buffer);
     return error;
   }
@@ -0,0 +1,289 @@
+// peli/ios/fs/TreeWalker.cpp - Pipelined NAND directory tree walker
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "TreeWalker.hpp"
+#include "../../host/Host.hpp"
+#include "../../util/String.hpp"
+#include "../low/Ipc.hpp"
+
+namespace peli::ios::fs {
+
+namespace {
+
+// Initial READ_DIR buffer size per slot, in entries. Grown on demand.
+constexpr u32 InitialNameCapacity = 32;
+
+} // namespace
+
+TreeWalker::~TreeWalker() noexcept {
+  for (Slot &slot : m_slots) {
+    if (slot.names) {
+      host::Free(slot.names, slot.capacity * NodeNameSize);
+    }
+  }
+  if (m_pending) {
+    host::Free(m_pending, sizeof(Node) * m_pending_capacity);
+  }
+}
+
+IOSError TreeWalker::Walk(const char *root, Callback callback,
+                          void *arg) noexcept {
+  if (!m_nand.IsValid()) {
+    return static_cast<IOSError>(m_nand.GetHandle());
+  }
+
+  m_error = IOSError::IOS_ERROR_OK;
+  m_stop = false;
+  m_pending_head = 0;
+  m_pending_count = 0;
+  if (!push(root, nullptr, 0)) {
+    // A root too long for ISFS is rejected the same way IOS would
+    return m_stop ? m_error : IOSError::ISFS_ERROR_INVALID;
+  }
+
+  Set set;
+  while (true) {
+    for (Slot &slot : m_slots) {
+      if (m_stop) {
+        break;
+      }
+      if (!slot.active && pop(slot.node)) {
+        issue(slot, set);
+      }
+    }
+
+    Request *request = set.WaitAny();
+    if (!request) {
+      break;
+    }
+
+    for (Slot &slot : m_slots) {
+      if (request == &slot.attr || request == &slot.dir) {
+        if (--slot.waiting == 0) {
+          finish(slot, set, callback, arg);
+        }
+        break;
+      }
+    }
+  }
+
+  return m_error;
+}
+
+void TreeWalker::issue(Slot &slot, Set &set) noexcept {
+  slot.active = true;
+  slot.waiting = 0;
+
+  // The root itself is not reported, so its attributes are not needed
+  if (slot.node.depth != 0) {
+    slot.attr.New(m_nand.GetHandle(),
+                  static_cast<const char *>(slot.node.path));
+    set.Add(slot.attr);
+    slot.waiting++;
+  }
+
+  issueReadDir(slot, set);
+}
+
+void TreeWalker::issueReadDir(Slot &slot, Set &set) noexcept {
+  if (!slot.names) {
+    slot.capacity = InitialNameCapacity;
+    slot.names = static_cast<char *>(
+        host::Alloc(low::Alignment, slot.capacity * NodeNameSize));
+    if (!slot.names) {
+      slot.capacity = 0;
+    }
+  }
+
+  slot.dir.New(m_nand.GetHandle(), static_cast<const char *>(slot.node.path),
+               slot.capacity,
+               low::IOVector{slot.names, slot.capacity * NodeNameSize});
+  set.Add(slot.dir);
+  slot.waiting++;
+}
+
+void TreeWalker::finish(Slot &slot, Set &set, Callback callback,
+                        void *arg) noexcept {
+  const Node &node = slot.node;
+  const s32 dir_result = slot.dir.GetResult();
+  u32 count = 0;
+
+  if (dir_result >= 0) {
+    const u32 total = slot.dir.GetOutput<1>();
+    if (total > slot.capacity && !m_stop) {
+      // Grow the buffer and list the directory again. The attributes are
+      // still held in the other request.
+      char *names = static_cast<char *>(
+          host::Alloc(low::Alignment, total * NodeNameSize));
+      if (names) {
+        if (slot.names) {
+          host::Free(slot.names, slot.capacity * NodeNameSize);
+        }
+        slot.names = names;
+        slot.capacity = total;
+        issueReadDir(slot, set);
+        return;
+      }
+    }
+    count = total < slot.capacity ? total : slot.capacity;
+  }
+
+  slot.active = false;
+  if (m_stop) {
+    return;
+  }
+
+  if (node.depth == 0) {
+    if (dir_result < 0) {
+      m_error = static_cast<IOSError>(dir_result);
+      m_stop = true;
+      return;
+    }
+  } else {
+    const s32 attr_result = slot.attr.GetResult();
+    if (attr_result == IOSError::ISFS_ERROR_NOEXISTS) {
+      return;
+    }
+    if (attr_result < 0) {
+      m_error = static_cast<IOSError>(attr_result);
+      m_stop = true;
+      return;
+    }
+
+    // A file can't be listed, and a directory without read permission can't
+    // either but is still a directory
+    const bool is_dir = dir_result >= 0 ||
+                        dir_result == IOSError::ISFS_ERROR_ACCESS;
+    if (!is_dir && dir_result != IOSError::ISFS_ERROR_INVALID) {
+      if (dir_result != IOSError::ISFS_ERROR_NOEXISTS) {
+        m_error = static_cast<IOSError>(dir_result);
+        m_stop = true;
+      }
+      return;
+    }
+
+    const char *name = node.path;
+    for (const char *c = node.path; *c != '\0'; c++) {
+      if (*c == '/') {
+        name = c + 1;
+      }
+    }
+
+    Action action = callback(
+        Entry{
+            .path = node.path,
+            .name = name,
+            .depth = node.depth,
+            .is_dir = is_dir,
+            .attr = slot.attr.GetOutput(),
+        },
+        arg);
+    if (action == Action::Stop) {
+      m_stop = true;
+      return;
+    }
+    if (action == Action::Skip) {
+      return;
+    }
+  }
+
+  // IOS packs the names back to back, each null terminated
+  const char *name = slot.names;
+  u32 pushed = 0;
+  for (u32 i = 0; i < count; i++) {
+    if (push(node.path, name, node.depth + 1)) {
+      pushed++;
+    } else if (m_stop) {
+      return;
+    }
+    name += util::StrLen(name) + 1;
+  }
+
+  if (m_order == Order::DepthFirst) {
+    // The back of the queue is taken first, so reverse the children to visit
+    // them in listing order
+    for (u32 i = 0; i < pushed / 2; i++) {
+      Node &a = m_pending[(m_pending_head + m_pending_count - pushed + i) %
+                         m_pending_capacity];
+      Node &b = m_pending[(m_pending_head + m_pending_count - 1 - i) %
+                         m_pending_capacity];
+      Node temp = a;
+      a = b;
+      b = temp;
+    }
+  }
+}
+
+// Returns false without setting m_stop if the path is too long to exist
+bool TreeWalker::push(const char *parent, const char *name,
+                      u32 depth) noexcept {
+  if (m_pending_count == m_pending_capacity) {
+    const u32 capacity = m_pending_capacity ? m_pending_capacity * 2 : 32;
+    Node *pending = static_cast<Node *>(
+        host::Alloc(alignof(Node), sizeof(Node) * capacity));
+    if (!pending) {
+      m_error = IOSError::IOS_ERROR_FAIL_ALLOC;
+      m_stop = true;
+      return false;
+    }
+
+    for (u32 i = 0; i < m_pending_count; i++) {
+      pending[i] = m_pending[(m_pending_head + i) % m_pending_capacity];
+    }
+    if (m_pending) {
+      host::Free(m_pending, sizeof(Node) * m_pending_capacity);
+    }
+    m_pending = pending;
+    m_pending_capacity = capacity;
+    m_pending_head = 0;
+  }
+
+  Node &node =
+      m_pending[(m_pending_head + m_pending_count) % m_pending_capacity];
+  node.depth = depth;
+
+  size_t length = util::StrLen(parent);
+  if (length >= PathSize) {
+    return false;
+  }
+  util::StrCopy<PathSize>(node.path, parent);
+
+  if (name) {
+    // Avoid a double slash when listing the root directory
+    if (length == 0 || node.path[length - 1] != '/') {
+      if (length + 1 >= PathSize) {
+        return false;
+      }
+      node.path[length++] = '/';
+    }
+
+    const size_t name_length = util::StrLen(name);
+    if (length + name_length >= PathSize) {
+      return false;
+    }
+    util::StrCopy<PathSize>(node.path + length, name);
+  }
+
+  m_pending_count++;
+  return true;
+}
+
+bool TreeWalker::pop(Node &node) noexcept {
+  if (m_pending_count == 0) {
+    return false;
+  }
+
+  m_pending_count--;
+  if (m_order == Order::DepthFirst) {
+    node = m_pending[(m_pending_head + m_pending_count) % m_pending_capacity];
+  } else {
+    node = m_pending[m_pending_head];
+    m_pending_head = (m_pending_head + 1) % m_pending_capacity;
+  }
+  return true;
+}
+
+} // namespace peli::ios::fs
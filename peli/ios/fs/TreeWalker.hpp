@@ -0,0 +1,141 @@
+// peli/ios/fs/TreeWalker.hpp - Pipelined NAND directory tree walker
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../../cmn/Types.hpp"
+#include "../../util/Constructor.hpp"
+#include "../Error.hpp"
+#include "../RequestSet.hpp"
+#include "Interface.hpp"
+#include "Nand.hpp"
+#include "Types.hpp"
+
+namespace peli::ios::fs {
+
+/**
+ * Recursively enumerates a NAND directory tree with several requests in flight
+ * at once.
+ *
+ * Each node is probed with a GET_ATTR and a READ_DIR issued together. The
+ * READ_DIR result tells whether the node is a directory (ISFS refuses to list a
+ * file with ISFS_ERROR_INVALID) and lists its children in the same round trip,
+ * so no separate entry count is needed. Up to MaxInFlight nodes are probed
+ * concurrently, and entries are passed to the callback as each probe completes.
+ */
+class TreeWalker {
+public:
+  /**
+   * Number of nodes probed concurrently. Each uses two IOS requests.
+   */
+  static constexpr u32 MaxInFlight = 8;
+
+  enum class Order {
+    /**
+     * Descend into a directory before visiting the rest of its siblings.
+     */
+    DepthFirst,
+
+    /**
+     * Visit every entry at one depth before descending.
+     */
+    BreadthFirst,
+  };
+
+  enum class Action {
+    Continue,
+
+    /**
+     * Don't descend into this directory.
+     */
+    Skip,
+
+    /**
+     * End the walk. Requests already in flight are waited for and discarded.
+     */
+    Stop,
+  };
+
+  struct Entry {
+    /**
+     * Full path of the entry.
+     */
+    const char *path;
+
+    /**
+     * Name of the entry, pointing into `path`.
+     */
+    const char *name;
+
+    /**
+     * 1 for direct children of the root.
+     */
+    u32 depth;
+
+    bool is_dir;
+    Attr attr;
+  };
+
+  using Callback = Action (*)(const Entry &entry, void *arg);
+
+  explicit TreeWalker(const Nand &nand,
+                      Order order = Order::DepthFirst) noexcept
+      : m_nand(nand), m_order(order) {}
+
+  ~TreeWalker() noexcept;
+
+  TreeWalker(const TreeWalker &) = delete;
+
+  /**
+   * Walk everything below `root`, which is not itself passed to the callback.
+   * Returns the first error that stopped the walk, if any. Entries that vanish
+   * while the walk is in progress are skipped, and directories that can't be
+   * listed are reported but not descended into. A root path too long for ISFS
+   * returns ISFS_ERROR_INVALID.
+   */
+  IOSError Walk(const char *root, Callback callback, void *arg) noexcept;
+
+private:
+  struct Node {
+    Path path;
+    u32 depth;
+  };
+
+  struct Slot {
+    Node node;
+    bool active;
+    u32 waiting;
+    Interface::GetAttr::Request attr{util::NoConstruct{}};
+    Interface::ReadDir::Request dir{util::NoConstruct{}};
+    char *names;
+    u32 capacity;
+  };
+
+  using Set = RequestSet<MaxInFlight * 2>;
+
+  void issue(Slot &slot, Set &set) noexcept;
+  void issueReadDir(Slot &slot, Set &set) noexcept;
+  void finish(Slot &slot, Set &set, Callback callback, void *arg) noexcept;
+
+  bool push(const char *parent, const char *name, u32 depth) noexcept;
+  bool pop(Node &node) noexcept;
+
+  const Nand &m_nand;
+  Order m_order;
+  IOSError m_error = IOSError::IOS_ERROR_OK;
+  bool m_stop = false;
+
+  Slot m_slots[MaxInFlight] = {};
+
+  // Nodes waiting to be probed, as a ring buffer. Depth-first takes from the
+  // back, breadth-first from the front.
+  Node *m_pending = nullptr;
+  u32 m_pending_capacity = 0;
+  u32 m_pending_head = 0;
+  u32 m_pending_count = 0;
+};
+
+} // namespace peli::ios::fs
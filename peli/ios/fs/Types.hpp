@@ -17,6 +17,11 @@ enum class OpenMode {
   ReadWrite = 1 | 2,
 };
 
+/**
+ * NAND cluster size, the unit ISFS allocates and transfers in.
+ */
+constexpr u32 ClusterSize = 0x4000;
+
 constexpr size_t PathSize = 64; // Includes null terminator
 using Path = char[PathSize];
 
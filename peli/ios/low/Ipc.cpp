@@ -16,6 +16,7 @@
 #include "../../util/CpuCache.hpp"
 #include "../../util/String.hpp"
 #include "../Error.hpp"
+#include "Loopback.hpp"
 
 namespace peli::ios::low {
 
@@ -161,6 +162,13 @@ void handleReply() {
 void ipcAsync(IPCCommandBlock *request) {
   ppc::Msr::NoInterruptsScope guard;
 
+#if defined(PELI_IOS_LOOPBACK)
+  if (Loopback::IsInstalled()) {
+    Loopback::Submit(request);
+    return;
+  }
+#endif
+
   if (!s_waiting_ack) {
     // Send the request on this thread
     ipcAcrSend(request);
@@ -88,7 +88,7 @@ s32 IOS_Open(const char *path, u32 flags) noexcept;
 s32 IOS_Close(s32 fd) noexcept;
 s32 IOS_Read(s32 fd, void *data, s32 size) noexcept;
 s32 IOS_Write(s32 fd, void *data, s32 size) noexcept;
-s32 IOS_Seek(s32 fd, s64 where, u32 whence) noexcept;
+s32 IOS_Seek(s32 fd, s32 where, s32 whence) noexcept;
 s32 IOS_Ioctl(s32 fd, u32 cmd, void *in, u32 in_size, void *out,
               u32 out_size) noexcept;
 s32 IOS_Ioctlv(s32 fd, u32 cmd, u32 in_count, u32 out_count,
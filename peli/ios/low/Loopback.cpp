@@ -0,0 +1,788 @@
+// peli/ios/low/Loopback.cpp - Software IOS stand-in for the IPC stack
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "Loopback.hpp"
+
+#if defined(PELI_IOS_LOOPBACK)
+
+#include "../../host/Host.hpp"
+#include "../../ppc/Msr.hpp"
+#include "../../rt/Thread.hpp"
+#include "../../util/Address.hpp"
+#include "../../util/Constructor.hpp"
+#include "../../util/String.hpp"
+#include "../../util/Time.hpp"
+#include "../Error.hpp"
+#include "../fs/Interface.hpp"
+#include "../fs/Types.hpp"
+#include "../sdio/Ioctl.hpp"
+#include "../sdio/Types.hpp"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace peli::ios::low {
+
+constinit bool Loopback::s_installed = false;
+
+namespace {
+
+constexpr u32 MaxDescriptors = 32;
+constexpr u32 QueueCount = 16;
+constexpr u32 WorkerStackSize = 0x4000;
+constexpr u32 HostPathSize = 256;
+constexpr u32 NandClusterSize = 0x4000;
+constexpr u16 CardAddress = 0x0001;
+
+enum class Node : u8 {
+  None,
+  Fs,
+  File,
+  Sdio,
+};
+
+struct Descriptor {
+  Node node;
+  int host_fd;
+};
+
+constinit Loopback::Config s_config = {};
+constinit Loopback::Stats s_stats = {};
+constinit Descriptor s_descriptors[MaxDescriptors] = {};
+constinit host::MessageQueue<IPCCommandBlock *, QueueCount> s_queue =
+    util::NoConstruct{};
+constinit rt::Thread s_thread;
+constinit u8 *s_thread_stack = nullptr;
+
+constinit int s_sd_image = -1;
+constinit u8 s_hc_regs[0x100] = {};
+
+bool pathEquals(const char *path, const char *node) noexcept {
+  const size_t length = util::StrLen(node);
+  return util::StrLen(path) == length &&
+         __builtin_memcmp(path, node, length) == 0;
+}
+
+/**
+ * Resolve an ISFS path against the NAND root. The ISFS path is copied first, as
+ * the fixed size buffers in requests are not guaranteed to be terminated.
+ */
+bool hostPath(char (&out)[HostPathSize], const char *path) noexcept {
+  fs::Path isfs_path;
+  const size_t path_length = util::StrCopy<fs::PathSize>(isfs_path, path);
+  if (path_length == fs::PathSize || isfs_path[0] != '/' ||
+      !s_config.nand_root) {
+    return false;
+  }
+
+  const size_t root_length = util::StrLen(s_config.nand_root);
+  if (root_length + path_length >= HostPathSize) {
+    return false;
+  }
+
+  __builtin_memcpy(out, s_config.nand_root, root_length);
+  __builtin_memcpy(out + root_length, isfs_path, path_length + 1);
+  return true;
+}
+
+IOSError isfsError() noexcept {
+  switch (errno) {
+  case ENOENT:
+  case ENOTDIR:
+    return IOSError::ISFS_ERROR_NOEXISTS;
+  case EEXIST:
+    return IOSError::ISFS_ERROR_EXISTS;
+  case EACCES:
+  case EPERM:
+  case EROFS:
+  case EBADF:
+    return IOSError::ISFS_ERROR_ACCESS;
+  case ENOTEMPTY:
+    return IOSError::ISFS_ERROR_NOTEMPTY;
+  case ENOSPC:
+    return IOSError::ISFS_ERROR_MAXBLOCKS;
+  case EMFILE:
+  case ENFILE:
+    return IOSError::ISFS_ERROR_MAXFD;
+  default:
+    return IOSError::ISFS_ERROR_INVALID;
+  }
+}
+
+Descriptor *getDescriptor(s32 fd, Node node) noexcept {
+  if (fd < 0 || u32(fd) >= MaxDescriptors) {
+    return nullptr;
+  }
+  Descriptor &desc = s_descriptors[fd];
+  return desc.node == node ? &desc : nullptr;
+}
+
+// Delay the reply to approximate the time real IOS would take. Yields rather
+// than blocking so the caller can keep queueing requests in the meantime.
+void injectLatency(u32 size) noexcept {
+  const u64 us =
+      s_config.latency_us + u64(s_config.latency_per_kib_us) * size / 1024;
+  if (us == 0) {
+    return;
+  }
+
+  const u64 ticks = us * (util::BusClock / 4 / 1000000);
+  const u64 start = util::GetTime();
+  while (util::GetTime() - start < ticks) {
+    rt::Thread::Yield();
+  }
+}
+
+s32 handleOpen(const char *path, u32 flags) noexcept {
+  s32 fd = 0;
+  while (u32(fd) < MaxDescriptors && s_descriptors[fd].node != Node::None) {
+    fd++;
+  }
+  if (u32(fd) == MaxDescriptors) {
+    return IOSError::IOS_ERROR_MAX;
+  }
+
+  Descriptor &desc = s_descriptors[fd];
+  if (pathEquals(path, "/dev/fs") && s_config.nand_root) {
+    desc = {Node::Fs, -1};
+    return fd;
+  }
+  if (pathEquals(path, sdio::Slot0)) {
+    desc = {Node::Sdio, -1};
+    return fd;
+  }
+
+  char host_path[HostPathSize];
+  if (__builtin_memcmp(path, "/dev/", 5) == 0 || !hostPath(host_path, path)) {
+    return IOSError::IOS_ERROR_NOEXISTS;
+  }
+
+  int oflag;
+  switch (fs::OpenMode(flags)) {
+  case fs::OpenMode::Read:
+    oflag = O_RDONLY;
+    break;
+  case fs::OpenMode::Write:
+    oflag = O_WRONLY;
+    break;
+  case fs::OpenMode::ReadWrite:
+    oflag = O_RDWR;
+    break;
+  default:
+    return IOSError::ISFS_ERROR_INVALID;
+  }
+
+  int host_fd = ::open(host_path, oflag);
+  if (host_fd < 0) {
+    return isfsError();
+  }
+
+  desc = {Node::File, host_fd};
+  return fd;
+}
+
+s32 handleClose(s32 fd) noexcept {
+  if (fd < 0 || u32(fd) >= MaxDescriptors ||
+      s_descriptors[fd].node == Node::None) {
+    return IOSError::IOS_ERROR_INVALID;
+  }
+
+  Descriptor &desc = s_descriptors[fd];
+  if (desc.node == Node::File) {
+    ::close(desc.host_fd);
+  }
+  desc = {Node::None, -1};
+  return IOSError::IOS_ERROR_OK;
+}
+
+s32 handleReadWrite(s32 fd, void *data, u32 size, bool is_write) noexcept {
+  Descriptor *desc = getDescriptor(fd, Node::File);
+  if (!desc) {
+    return IOSError::IOS_ERROR_INVALID;
+  }
+
+  ssize_t result = is_write ? ::write(desc->host_fd, data, size)
+                            : ::read(desc->host_fd, data, size);
+  if (result < 0) {
+    return isfsError();
+  }
+
+  (is_write ? s_stats.bytes_written : s_stats.bytes_read) += u64(result);
+  return s32(result);
+}
+
+s32 handleSeek(s32 fd, s32 where, s32 whence) noexcept {
+  Descriptor *desc = getDescriptor(fd, Node::File);
+  if (!desc) {
+    return IOSError::IOS_ERROR_INVALID;
+  }
+
+  off_t result = ::lseek(desc->host_fd, where, whence);
+  return result < 0 ? s32(IOSError::ISFS_ERROR_INVALID) : s32(result);
+}
+
+s32 fsFillAttr(const char *path, fs::Attr &attr) noexcept {
+  char host_path[HostPathSize];
+  struct stat st;
+  if (!hostPath(host_path, path)) {
+    return IOSError::ISFS_ERROR_INVALID;
+  }
+  if (::stat(host_path, &st) != 0) {
+    return isfsError();
+  }
+
+  attr = {};
+  util::StrCopy<fs::PathSize>(attr.path, path);
+  attr.perm_owner = attr.perm_group = attr.perm_other =
+      u8(fs::OpenMode::ReadWrite);
+  return IOSError::ISFS_ERROR_OK;
+}
+
+s32 fsCreate(const fs::Attr &attr, bool is_dir) noexcept {
+  char host_path[HostPathSize];
+  if (!hostPath(host_path, attr.path)) {
+    return IOSError::ISFS_ERROR_INVALID;
+  }
+
+  if (is_dir) {
+    return ::mkdir(host_path, 0777) == 0 ? s32(IOSError::ISFS_ERROR_OK)
+                                         : s32(isfsError());
+  }
+
+  int host_fd = ::open(host_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (host_fd < 0) {
+    return isfsError();
+  }
+  ::close(host_fd);
+  return IOSError::ISFS_ERROR_OK;
+}
+
+s32 fsDelete(const char *path) noexcept {
+  char host_path[HostPathSize];
+  struct stat st;
+  if (!hostPath(host_path, path)) {
+    return IOSError::ISFS_ERROR_INVALID;
+  }
+  if (::stat(host_path, &st) != 0) {
+    return isfsError();
+  }
+
+  int result = S_ISDIR(st.st_mode) ? ::rmdir(host_path) : ::unlink(host_path);
+  return result == 0 ? s32(IOSError::ISFS_ERROR_OK) : s32(isfsError());
+}
+
+s32 fsRename(const fs::RenamePaths &paths) noexcept {
+  char host_from[HostPathSize], host_to[HostPathSize];
+  if (!hostPath(host_from, paths.from) || !hostPath(host_to, paths.to)) {
+    return IOSError::ISFS_ERROR_INVALID;
+  }
+
+  return ::rename(host_from, host_to) == 0 ? s32(IOSError::ISFS_ERROR_OK)
+                                           : s32(isfsError());
+}
+
+// Usage is counted the way ISFS does: one inode per node, and every file
+// rounded up to whole clusters.
+void fsCountUsage(char (&host_path)[HostPathSize], fs::Usage &usage) noexcept {
+  DIR *dir = ::opendir(host_path);
+  if (!dir) {
+    return;
+  }
+
+  const size_t length = util::StrLen(static_cast<const char *>(host_path));
+  while (dirent *entry = ::readdir(dir)) {
+    const char *name = entry->d_name;
+    if (pathEquals(name, ".") || pathEquals(name, "..")) {
+      continue;
+    }
+
+    const size_t name_length = util::StrLen(name);
+    if (length + 1 + name_length >= HostPathSize) {
+      continue;
+    }
+    host_path[length] = '/';
+    __builtin_memcpy(host_path + length + 1, name, name_length + 1);
+
+    struct stat st;
+    if (::stat(host_path, &st) == 0) {
+      usage.used_inodes++;
+      if (S_ISDIR(st.st_mode)) {
+        fsCountUsage(host_path, usage);
+      } else {
+        usage.used_clusters +=
+            util::AlignUp(NandClusterSize, u32(st.st_size)) / NandClusterSize;
+      }
+    }
+    host_path[length] = '\0';
+  }
+
+  ::closedir(dir);
+}
+
+s32 fsReadDir(const char *path, fs::NodeName *entries, u32 max_entries,
+              u32 &count) noexcept {
+  char host_path[HostPathSize];
+  if (!hostPath(host_path, path)) {
+    return IOSError::ISFS_ERROR_INVALID;
+  }
+
+  DIR *dir = ::opendir(host_path);
+  if (!dir) {
+    // IOS refuses to list a file as an invalid argument
+    return errno == ENOTDIR ? IOSError::ISFS_ERROR_INVALID : isfsError();
+  }
+
+  // IOS packs the names back to back, each null terminated
+  char *out = entries ? *entries : nullptr;
+  count = 0;
+  while (dirent *entry = ::readdir(dir)) {
+    if (pathEquals(entry->d_name, ".") || pathEquals(entry->d_name, "..")) {
+      continue;
+    }
+
+    if (out && count < max_entries) {
+      // StrCopy returns the buffer size when the name had to be truncated
+      const size_t length = util::StrCopy<fs::NodeNameSize>(out, entry->d_name);
+      out += length == fs::NodeNameSize ? length : length + 1;
+    }
+    count++;
+  }
+
+  ::closedir(dir);
+  return IOSError::ISFS_ERROR_OK;
+}
+
+template <class T> T *buffer(void *data, u32 size) noexcept {
+  return size >= sizeof(T) ? static_cast<T *>(data) : nullptr;
+}
+
+s32 handleFsIoctl(u32 cmd, void *in, u32 in_size, void *out,
+                  u32 out_size) noexcept {
+  switch (fs::Ioctl(cmd)) {
+  case fs::Ioctl::GET_STATS:
+    if (auto *stats = buffer<fs::Stats>(out, out_size)) {
+      // Fixed values resembling a stock NAND
+      *stats = {
+          .cluster_size = NandClusterSize,
+          .free_clusters = 0x6000,
+          .used_clusters = 0x1A00,
+          .bad_clusters = 0,
+          .reserved_clusters = 0x600,
+          .free_inodes = 0x1000,
+          .used_inodes = 0x0A00,
+      };
+      return IOSError::ISFS_ERROR_OK;
+    }
+    break;
+
+  case fs::Ioctl::CREATE_DIR:
+  case fs::Ioctl::CREATE_FILE:
+    if (auto *attr = buffer<fs::Attr>(in, in_size)) {
+      return fsCreate(*attr, fs::Ioctl(cmd) == fs::Ioctl::CREATE_DIR);
+    }
+    break;
+
+  case fs::Ioctl::SET_ATTR:
+    // Permissions and ownership are not emulated, only check the path exists
+    if (auto *attr = buffer<fs::Attr>(in, in_size)) {
+      fs::Attr current;
+      return fsFillAttr(attr->path, current);
+    }
+    break;
+
+  case fs::Ioctl::GET_ATTR:
+    if (buffer<fs::Path>(in, in_size) && buffer<fs::Attr>(out, out_size)) {
+      return fsFillAttr(static_cast<const char *>(in),
+                        *static_cast<fs::Attr *>(out));
+    }
+    break;
+
+  case fs::Ioctl::DELETE:
+    if (buffer<fs::Path>(in, in_size)) {
+      return fsDelete(static_cast<const char *>(in));
+    }
+    break;
+
+  case fs::Ioctl::RENAME:
+    if (auto *paths = buffer<fs::RenamePaths>(in, in_size)) {
+      return fsRename(*paths);
+    }
+    break;
+
+  case fs::Ioctl::SHUTDOWN:
+    return IOSError::ISFS_ERROR_OK;
+
+  default:
+    break;
+  }
+
+  return IOSError::ISFS_ERROR_INVALID;
+}
+
+s32 handleFsIoctlv(u32 cmd, u32 in_count, u32 out_count,
+                   IOVector *vec) noexcept {
+  switch (fs::Ioctl(cmd)) {
+  case fs::Ioctl::READ_DIR:
+    if (in_count == 1 && out_count == 1 && vec[1].size >= sizeof(u32)) {
+      return fsReadDir(static_cast<const char *>(vec[0].data), nullptr, 0,
+                       *static_cast<u32 *>(vec[1].data));
+    }
+    if (in_count == 2 && out_count == 2 && vec[1].size >= sizeof(u32) &&
+        vec[3].size >= sizeof(u32)) {
+      u32 max_entries = *static_cast<u32 *>(vec[1].data);
+      if (vec[2].size < max_entries * fs::NodeNameSize) {
+        return IOSError::ISFS_ERROR_INVALID;
+      }
+      return fsReadDir(static_cast<const char *>(vec[0].data),
+                       static_cast<fs::NodeName *>(vec[2].data), max_entries,
+                       *static_cast<u32 *>(vec[3].data));
+    }
+    break;
+
+  case fs::Ioctl::GET_USAGE:
+    if (in_count == 1 && out_count == 2 && vec[1].size >= sizeof(u32) &&
+        vec[2].size >= sizeof(u32)) {
+      char host_path[HostPathSize];
+      struct stat st;
+      if (!hostPath(host_path, static_cast<const char *>(vec[0].data))) {
+        return IOSError::ISFS_ERROR_INVALID;
+      }
+      if (::stat(host_path, &st) != 0) {
+        return isfsError();
+      }
+
+      fs::Usage usage = {};
+      fsCountUsage(host_path, usage);
+      *static_cast<u32 *>(vec[1].data) = usage.used_clusters;
+      *static_cast<u32 *>(vec[2].data) = usage.used_inodes;
+      return IOSError::ISFS_ERROR_OK;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  return IOSError::ISFS_ERROR_INVALID;
+}
+
+s32 handleFileIoctl(Descriptor &desc, u32 cmd, void *out,
+                    u32 out_size) noexcept {
+  if (fs::Ioctl(cmd) != fs::Ioctl::GET_FILE_STATS ||
+      out_size < sizeof(fs::FileStats)) {
+    return IOSError::ISFS_ERROR_INVALID;
+  }
+
+  struct stat st;
+  if (::fstat(desc.host_fd, &st) != 0) {
+    return isfsError();
+  }
+
+  *static_cast<fs::FileStats *>(out) = {
+      .size = u32(st.st_size),
+      .pos = u32(::lseek(desc.host_fd, 0, SEEK_CUR)),
+  };
+  return IOSError::ISFS_ERROR_OK;
+}
+
+s32 handleSdioIoctl(u32 cmd, void *in, u32 in_size, void *out,
+                    u32 out_size) noexcept {
+  switch (sdio::Ioctl(cmd)) {
+  case sdio::Ioctl::SD_IOWHCREG:
+  case sdio::Ioctl::SD_IORHCREG: {
+    if (in_size < sizeof(sdio::HcRegOp)) {
+      return IOSError::IOS_ERROR_INVALID;
+    }
+    const sdio::HcRegOp &op = *static_cast<sdio::HcRegOp *>(in);
+    if (op.size > 4 || op.reg + op.size > sizeof(s_hc_regs)) {
+      return IOSError::IOS_ERROR_INVALID;
+    }
+
+    // Big endian, matching how the registers appear to the PPC
+    if (sdio::Ioctl(cmd) == sdio::Ioctl::SD_IOWHCREG) {
+      for (u32 i = 0; i < op.size; i++) {
+        s_hc_regs[op.reg + i] = u8(op.value >> ((op.size - 1 - i) * 8));
+      }
+      return IOSError::SD_ERROR_OK;
+    }
+
+    if (out_size < sizeof(u32)) {
+      return IOSError::IOS_ERROR_INVALID;
+    }
+    u32 value = 0;
+    for (u32 i = 0; i < op.size; i++) {
+      value = (value << 8) | s_hc_regs[op.reg + i];
+    }
+    *static_cast<u32 *>(out) = value;
+    return IOSError::SD_ERROR_OK;
+  }
+
+  case sdio::Ioctl::SD_RESET:
+    if (out_size < sizeof(u32)) {
+      return IOSError::IOS_ERROR_INVALID;
+    }
+    *static_cast<u32 *>(out) = u32(CardAddress) << 16;
+    return s_sd_image >= 0 ? s32(IOSError::SD_ERROR_OK)
+                           : s32(IOSError::SD_ERROR_REMOVE);
+
+  case sdio::Ioctl::SD_GET_STATUS:
+    if (out_size < sizeof(sdio::Status)) {
+      return IOSError::IOS_ERROR_INVALID;
+    }
+    *static_cast<sdio::Status *>(out) =
+        s_sd_image >= 0 ? sdio::Status::Inserted | sdio::Status::TypeMemory |
+                              sdio::Status::TypeSdhc
+                        : sdio::Status();
+    return IOSError::SD_ERROR_OK;
+
+  case sdio::Ioctl::SD_GET_OCR:
+    if (out_size < sizeof(u32)) {
+      return IOSError::IOS_ERROR_INVALID;
+    }
+    // Powered up, high capacity, 2.7-3.6V
+    *static_cast<u32 *>(out) = 0xC0FF8000;
+    return IOSError::SD_ERROR_OK;
+
+  case sdio::Ioctl::SD_SETCLK:
+    return IOSError::SD_ERROR_OK;
+
+  case sdio::Ioctl::SD_CMD:
+    // Commands without data only change card state, which isn't emulated
+    if (out_size != 0) {
+      __builtin_memset(out, 0, out_size);
+    }
+    return s_sd_image >= 0 ? s32(IOSError::SD_ERROR_OK)
+                           : s32(IOSError::SD_ERROR_REMOVE);
+
+  default:
+    return IOSError::IOS_ERROR_INVALID;
+  }
+}
+
+s32 handleSdioIoctlv(u32 cmd, u32 in_count, u32 out_count,
+                     IOVector *vec) noexcept {
+  if (sdio::Ioctl(cmd) != sdio::Ioctl::SD_CMD || in_count != 2 ||
+      out_count != 1 || vec[0].size < sizeof(sdio::Command)) {
+    return IOSError::IOS_ERROR_INVALID;
+  }
+  if (s_sd_image < 0) {
+    return IOSError::SD_ERROR_REMOVE;
+  }
+
+  const sdio::Command &command = *static_cast<sdio::Command *>(vec[0].data);
+  if (vec[2].size != 0) {
+    __builtin_memset(vec[2].data, 0, vec[2].size);
+  }
+
+  bool is_write;
+  switch (command.cmd) {
+  case sdio::Cmd::SD_CMD17_BLK_RD:
+  case sdio::Cmd::SD_CMD18_MBLK_RD:
+    is_write = false;
+    break;
+  case sdio::Cmd::SD_CMD24_BLK_WR:
+  case sdio::Cmd::SD_CMD25_MBLK_WR:
+    is_write = true;
+    break;
+  default:
+    return IOSError::SD_ERROR_OK;
+  }
+
+  const u32 size = command.block_count * command.block_size;
+  if (size == 0 || vec[1].size < size) {
+    return IOSError::IOS_ERROR_INVALID;
+  }
+
+  // The card reports itself as SDHC, so the argument is a block address
+  const off_t offset = off_t(command.arg) * command.block_size;
+  if (::lseek(s_sd_image, offset, SEEK_SET) != offset) {
+    return IOSError::SD_ERROR_FAIL;
+  }
+
+  ssize_t result = is_write ? ::write(s_sd_image, vec[1].data, size)
+                            : ::read(s_sd_image, vec[1].data, size);
+  if (result != ssize_t(size)) {
+    return IOSError::SD_ERROR_FAIL;
+  }
+
+  (is_write ? s_stats.bytes_written : s_stats.bytes_read) += size;
+  return IOSError::SD_ERROR_OK;
+}
+
+// Pointers in the command block were converted to physical addresses by the
+// IOS_*Async functions. No cache maintenance is needed as nothing here is DMA.
+u32 toEffective(IPCCommandBlock *block) noexcept {
+  switch (block->cmd) {
+  case IOS_CMD_OPEN:
+    block->open.path = util::Effective(block->open.path);
+    return 0;
+  case IOS_CMD_READ:
+  case IOS_CMD_WRITE:
+    block->read.data = util::Effective(block->read.data);
+    return block->read.size;
+  case IOS_CMD_IOCTL:
+    block->ioctl.in = util::Effective(block->ioctl.in);
+    block->ioctl.out = util::Effective(block->ioctl.out);
+    return block->ioctl.in_size + block->ioctl.out_size;
+  case IOS_CMD_IOCTLV: {
+    u32 size = 0;
+    block->ioctlv.vec = util::Effective(block->ioctlv.vec);
+    for (u32 i = 0; i < block->ioctlv.in_count + block->ioctlv.out_count;
+         i++) {
+      if (block->ioctlv.vec[i].size != 0) {
+        block->ioctlv.vec[i].data = util::Effective(block->ioctlv.vec[i].data);
+        size += block->ioctlv.vec[i].size;
+      }
+    }
+    return size;
+  }
+  default:
+    return 0;
+  }
+}
+
+s32 dispatch(IPCCommandBlock &block) noexcept {
+  switch (block.cmd) {
+  case IOS_CMD_OPEN:
+    return handleOpen(block.open.path, block.open.flags);
+  case IOS_CMD_CLOSE:
+    return handleClose(block.fd);
+  case IOS_CMD_READ:
+  case IOS_CMD_WRITE:
+    return handleReadWrite(block.fd, block.read.data, block.read.size,
+                           block.cmd == IOS_CMD_WRITE);
+  case IOS_CMD_SEEK:
+    return handleSeek(block.fd, block.seek.where, block.seek.whence);
+  default:
+    break;
+  }
+
+  if (block.fd < 0 || u32(block.fd) >= MaxDescriptors) {
+    return IOSError::IOS_ERROR_INVALID;
+  }
+
+  Descriptor &desc = s_descriptors[block.fd];
+  if (block.cmd == IOS_CMD_IOCTL) {
+    const auto &ioctl = block.ioctl;
+    switch (desc.node) {
+    case Node::Fs:
+      return handleFsIoctl(ioctl.cmd, ioctl.in, ioctl.in_size, ioctl.out,
+                           ioctl.out_size);
+    case Node::File:
+      return handleFileIoctl(desc, ioctl.cmd, ioctl.out, ioctl.out_size);
+    case Node::Sdio:
+      return handleSdioIoctl(ioctl.cmd, ioctl.in, ioctl.in_size, ioctl.out,
+                             ioctl.out_size);
+    default:
+      return IOSError::IOS_ERROR_INVALID;
+    }
+  }
+
+  if (block.cmd == IOS_CMD_IOCTLV) {
+    const auto &ioctlv = block.ioctlv;
+    switch (desc.node) {
+    case Node::Fs:
+      return handleFsIoctlv(ioctlv.cmd, ioctlv.in_count, ioctlv.out_count,
+                            ioctlv.vec);
+    case Node::Sdio:
+      return handleSdioIoctlv(ioctlv.cmd, ioctlv.in_count, ioctlv.out_count,
+                              ioctlv.vec);
+    default:
+      return IOSError::IOS_ERROR_INVALID;
+    }
+  }
+
+  return IOSError::IOS_ERROR_INVALID;
+}
+
+void *workerMain(void *) {
+  while (true) {
+    IPCCommandBlock *block = s_queue.Receive();
+    if (!block) {
+      // Sentinel from Uninstall
+      return nullptr;
+    }
+
+    injectLatency(toEffective(block));
+
+    block->result = dispatch(*block);
+    s_stats.requests++;
+
+    // The queue may be redirected (see ios::RequestSet), so read it with
+    // interrupts disabled the same way the IPC interrupt handler does
+    ppc::Msr::NoInterruptsScope guard;
+    if (block->queue) {
+      block->queue->Send(block);
+    }
+  }
+}
+
+} // namespace
+
+Loopback::Stats Loopback::GetStats() noexcept { return s_stats; }
+
+void Loopback::ResetStats() noexcept { s_stats = {}; }
+
+bool Loopback::Install(const Config &config) noexcept {
+  if (s_installed) {
+    return false;
+  }
+
+  // rt::Thread has no way to report a failed stack allocation, so provide the
+  // stack here
+  s_thread_stack = static_cast<u8 *>(host::Alloc(32, WorkerStackSize));
+  if (!s_thread_stack) {
+    return false;
+  }
+
+  s_config = config;
+  for (Descriptor &desc : s_descriptors) {
+    desc = {Node::None, -1};
+  }
+  __builtin_memset(s_hc_regs, 0, sizeof(s_hc_regs));
+
+  s_sd_image = config.sd_image ? ::open(config.sd_image, O_RDWR) : -1;
+
+  util::Construct(s_queue);
+  util::Construct(s_thread, workerMain, nullptr, s_thread_stack,
+                  WorkerStackSize, config.priority, false);
+
+  s_installed = true;
+  return true;
+}
+
+void Loopback::Uninstall() noexcept {
+  if (!s_installed) {
+    return;
+  }
+
+  // Requests already queued are serviced before the sentinel
+  s_queue.Send(nullptr);
+  s_thread.Join();
+  s_thread.~Thread();
+  host::Free(s_thread_stack, WorkerStackSize);
+  s_thread_stack = nullptr;
+  s_installed = false;
+
+  for (s32 fd = 0; u32(fd) < MaxDescriptors; fd++) {
+    handleClose(fd);
+  }
+  if (s_sd_image >= 0) {
+    ::close(s_sd_image);
+    s_sd_image = -1;
+  }
+}
+
+void Loopback::Submit(IPCCommandBlock *block) noexcept {
+  s_queue.Send(block);
+}
+
+} // namespace peli::ios::low
+
+#endif // PELI_IOS_LOOPBACK
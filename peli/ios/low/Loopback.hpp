@@ -0,0 +1,99 @@
+// peli/ios/low/Loopback.hpp - Software IOS stand-in for the IPC stack
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../../cmn/Types.hpp"
+#include "../../host/Config.h"
+#include "Ipc.hpp"
+
+#if defined(PELI_IOS_LOOPBACK)
+
+namespace peli::ios::low {
+
+/**
+ * Software stand-in for IOS. While installed, every request made through the
+ * IOS_* functions (and so ios::Request, ios::Resource and the typed interfaces)
+ * is handed to a worker thread instead of the IPC mailbox. The worker services
+ * the IPCCommandBlock and replies to its queue exactly like IOS would.
+ *
+ * The following nodes are implemented:
+ * - /dev/fs and absolute ISFS paths, backed by a directory accessed through the
+ *   C file API (so any mounted devoptab on console, or the host filesystem).
+ * - /dev/sdio/slot0, backed by a raw disk image file.
+ *
+ * Opening anything else returns IOS_ERROR_NOEXISTS.
+ */
+class Loopback {
+public:
+  struct Config {
+    /**
+     * Directory that ISFS paths are resolved against, without a trailing
+     * slash, e.g. "sd:/nand". Null disables /dev/fs and ISFS paths.
+     */
+    const char *nand_root = nullptr;
+
+    /**
+     * Disk image backing /dev/sdio/slot0. Null reports no card inserted.
+     */
+    const char *sd_image = nullptr;
+
+    /**
+     * Fixed latency added to every request, in microseconds.
+     */
+    u32 latency_us = 0;
+
+    /**
+     * Additional latency per KiB of data transferred, in microseconds.
+     */
+    u32 latency_per_kib_us = 0;
+
+    /**
+     * Priority of the worker thread.
+     */
+    u8 priority = 8;
+  };
+
+  struct Stats {
+    u32 requests;
+    u64 bytes_read;
+    u64 bytes_written;
+  };
+
+  /**
+   * Start the worker thread and begin routing IPC requests to it. Returns false
+   * if the loopback is already installed or the worker could not be created.
+   */
+  static bool Install(const Config &config) noexcept;
+
+  /**
+   * Wait for queued requests to finish, close all descriptors and route IPC
+   * requests back to the hardware.
+   */
+  static void Uninstall() noexcept;
+
+  static bool IsInstalled() noexcept { return s_installed; }
+
+  /**
+   * Queue a command block for the worker. Called from the IOS_*Async functions
+   * after the block has been filled out.
+   */
+  static void Submit(IPCCommandBlock *block) noexcept;
+
+  /**
+   * Get the number of requests serviced and bytes moved by file and SD
+   * transfers since install or the last ResetStats().
+   */
+  static Stats GetStats() noexcept;
+  static void ResetStats() noexcept;
+
+private:
+  static bool s_installed;
+};
+
+} // namespace peli::ios::low
+
+#endif // PELI_IOS_LOOPBACK
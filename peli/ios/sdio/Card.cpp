@@ -81,89 +81,438 @@ IOSError Card::Device_Init() noexcept {
   return IOSError::SD_ERROR_OK;
 }
 
+Card::~Card() {
+  drain();
+  FlushErase();
+  waitErase();
+  m_request.Sync();
+  for (BufCommand::Request &request : m_transfer) {
+    request.Sync();
+  }
+
+  for (void *buffer : m_block_buffers) {
+    if (buffer) {
+      host::Free(buffer, MaxTransferSize * SectorSize);
+    }
+  }
+}
+
 IOSError Card::Device_BlockTransfer(size_t first, size_t count, void *buffer,
                                     bool is_write) noexcept {
   if (count == 0) {
     return IOSError::SD_ERROR_OK;
   }
 
-  m_request.Sync();
-  Select(m_request);
-
-  Command command = {
-      .cmd = is_write ? Cmd::SD_CMD25_MBLK_WR : Cmd::SD_CMD18_MBLK_RD,
-      .cmd_type = 3,
-      .response_type = ResponseType::R1,
-      .arg = 0,
-      .block_size = Device_GetBlockSize(),
-  };
-  IOSError error = IOSError::IOS_ERROR_OK;
-  bool use_temp_buffer = false;
-  if (m_block_buffer) {
-    command.buffer = m_block_buffer;
-    use_temp_buffer = true;
-  } else if (util::IsAligned(DmaBlockSize, buffer)) {
-    command.buffer = buffer;
-  } else {
+  const bool use_temp_buffer = !util::IsAligned(DmaBlockSize, buffer);
+  if (use_temp_buffer && (!m_block_buffers[0] || !m_block_buffers[1])) {
     return IOSError::IOS_ERROR_INVALID;
   }
 
-  const bool high_capacity = m_high_capacity;
+  // The transfer requests are shared with the queued interface
+  drain();
+
+  // A queued erase of the range has to land before the new data does
+  if (is_write && eraseQueued(first, count)) {
+    FlushErase();
+  }
 
-  // Check error from Select request
-  if (error = m_request.Sync().GetError(); error) {
+  // A failed erase leaves the data as it was, so it isn't reported here
+  waitErase();
+
+  m_request.Sync();
+  if (IOSError error = Select(m_request).Sync().GetError()) {
     Deselect(m_request);
     return error;
   }
 
-  do {
-    command.block_count = count <= MaxTransferSize ? count : MaxTransferSize;
+  const u32 block_size = Device_GetBlockSize();
+  const bool high_capacity = m_high_capacity;
+  u8 *const data = static_cast<u8 *>(buffer);
 
-    if (is_write) {
-      if (use_temp_buffer) {
-        __builtin_memcpy(command.buffer, buffer,
-                         command.block_count * command.block_size);
-      }
+  // Chunks alternate between the two transfer requests (and DMA buffers). The
+  // next chunk is always issued before waiting on the current one, so IOS has
+  // it queued when the current one finishes and the copy in or out of one
+  // buffer overlaps the transfer of the other.
+  IOSError error = IOSError::IOS_ERROR_OK;
+  size_t issued = 0, done = 0;
+  u32 issued_chunks = 0, done_chunks = 0;
+  u32 chunk_blocks[2] = {};
+
+  while (done < count) {
+    while (error == IOSError::IOS_ERROR_OK && issued < count &&
+           issued_chunks - done_chunks < 2) {
+      const u32 slot = issued_chunks % 2;
+      const u32 blocks =
+          count - issued < MaxTransferSize ? count - issued : MaxTransferSize;
+      const u32 size = blocks * block_size;
+      u8 *user = data + issued * block_size;
+      void *dma = use_temp_buffer ? m_block_buffers[slot] : user;
+
+      if (is_write) {
+        if (use_temp_buffer) {
+          __builtin_memcpy(dma, user, size);
+        }
 #if defined(PELI_HOST_IOS)
-      util::CpuCache::DcFlush(command.buffer,
-                              command.block_count * command.block_size);
+        util::CpuCache::DcFlush(dma, size);
 #endif
+      }
+
+      const size_t sector = first + issued;
+      SendCommand(m_transfer[slot],
+                  {
+                      .cmd = is_write ? Cmd::SD_CMD25_MBLK_WR
+                                      : Cmd::SD_CMD18_MBLK_RD,
+                      .cmd_type = 3,
+                      .response_type = ResponseType::R1,
+                      .arg = u32(high_capacity ? sector : sector * block_size),
+                      .block_count = blocks,
+                      .block_size = block_size,
+                      .buffer = dma,
+                  });
+
+      chunk_blocks[slot] = blocks;
+      issued += blocks;
+      issued_chunks++;
     }
-    command.arg = high_capacity ? first * command.block_size : first;
 
-    if (error = SendCommand(m_request, command) //
-                    .Sync()
-                    .GetError();
-        error) {
+    if (done_chunks == issued_chunks) {
+      // Stopped issuing because of an error
       break;
     }
 
-    if (!is_write) {
+    const u32 slot = done_chunks % 2;
+    const u32 size = chunk_blocks[slot] * block_size;
+    if (IOSError result = m_transfer[slot].Sync().GetError();
+        result && !error) {
+      error = result;
+    }
+
+    if (!is_write && !error) {
+      u8 *user = data + done * block_size;
+      void *dma = use_temp_buffer ? m_block_buffers[slot] : user;
 #if defined(PELI_HOST_IOS)
-      util::CpuCache::DcInvalidate(use_temp_buffer ? command.buffer : buffer,
-                                   command.block_count * command.block_size);
+      util::CpuCache::DcInvalidate(dma, size);
 #endif
       if (use_temp_buffer) {
-        // Copy previous transfer's data
-        __builtin_memcpy(buffer, command.buffer,
-                         command.block_count * command.block_size);
+        __builtin_memcpy(user, dma, size);
       }
     }
 
-    buffer =
-        static_cast<u8 *>(buffer) + command.block_count * command.block_size;
-    if (!use_temp_buffer) {
-      command.buffer = buffer;
-    }
-  } while (--count);
+    done += chunk_blocks[slot];
+    done_chunks++;
+  }
 
   Deselect(m_request);
   return error;
 }
 
+void Card::Device_GetInfo(disk::DeviceInfo &info) noexcept {
+  info = {
+      .block_size = SectorSize,
+      .block_count = 0,
+      .max_transfer = MaxTransferSize,
+      .alignment = DmaBlockSize,
+      .preferred_transfer = MaxTransferSize,
+      .queue_depth = QueueDepth,
+      .can_flush = true,
+      .can_trim = true,
+  };
+}
+
+int Card::Device_Submit(disk::BlockRequest &request) noexcept {
+  if (request.op == disk::BlockOp::Flush ||
+      request.op == disk::BlockOp::Trim) {
+    // Ordered after every transfer submitted before it
+    drain();
+    request.result = request.op == disk::BlockOp::Flush
+                         ? Device_Flush()
+                         : Device_Trim(request.first, request.count);
+    m_done.Push(request);
+    return 0;
+  }
+
+  size_t covered = 0;
+  for (u32 i = 0; i < request.vector_count; i++) {
+    covered += request.vectors[i].size;
+  }
+  const u32 size = u32(request.count) * SectorSize;
+  if (request.count == 0 || request.count > MaxTransferSize ||
+      covered < size || m_in_flight == QueueDepth) {
+    return -1;
+  }
+
+  u32 slot = 0;
+  while (m_slot_request[slot]) {
+    slot++;
+  }
+
+  const bool is_write = request.op == disk::BlockOp::Write;
+  const bool direct = request.vector_count == 1 &&
+                      util::IsAligned(DmaBlockSize, request.vectors[0].data);
+  if (!direct && !m_block_buffers[slot]) {
+    // Nowhere to gather the vectors, so do them one at a time
+    drain();
+    request.result = disk::TransferVectors(*this, request, SectorSize);
+    m_done.Push(request);
+    return 0;
+  }
+
+  // A queued erase of the range has to land before the new data does
+  if (is_write && eraseQueued(request.first, request.count)) {
+    drain();
+    FlushErase();
+  }
+
+  if (!m_selected) {
+    // A failed erase leaves the data as it was, so it isn't reported here
+    waitErase();
+
+    m_request.Sync();
+    if (IOSError error = Select(m_request).Sync().GetError()) {
+      Deselect(m_request);
+      request.result = error;
+      m_done.Push(request);
+      return 0;
+    }
+    m_selected = true;
+  }
+
+  void *dma = direct ? request.vectors[0].data : m_block_buffers[slot];
+  if (is_write) {
+    if (!direct) {
+      u8 *out = static_cast<u8 *>(dma);
+      for (u32 i = 0; out != static_cast<u8 *>(dma) + size; i++) {
+        const size_t left = size_t(static_cast<u8 *>(dma) + size - out);
+        const size_t chunk =
+            request.vectors[i].size < left ? request.vectors[i].size : left;
+        __builtin_memcpy(out, request.vectors[i].data, chunk);
+        out += chunk;
+      }
+    }
+#if defined(PELI_HOST_IOS)
+    util::CpuCache::DcFlush(dma, size);
+#endif
+  }
+
+  SendCommand(m_transfer[slot],
+              {
+                  .cmd = is_write ? Cmd::SD_CMD25_MBLK_WR
+                                  : Cmd::SD_CMD18_MBLK_RD,
+                  .cmd_type = 3,
+                  .response_type = ResponseType::R1,
+                  .arg = u32(m_high_capacity ? request.first
+                                             : request.first * SectorSize),
+                  .block_count = u32(request.count),
+                  .block_size = SectorSize,
+                  .buffer = dma,
+              });
+  m_set.Add(m_transfer[slot]);
+
+  m_slot_request[slot] = &request;
+  m_slot_direct[slot] = direct;
+  m_in_flight++;
+  return 0;
+}
+
+disk::BlockRequest *Card::Device_Reap(bool wait) noexcept {
+  if (disk::BlockRequest *request = m_done.Pop()) {
+    return request;
+  }
+  if (m_in_flight == 0) {
+    return nullptr;
+  }
+
+  Request *command = wait ? m_set.WaitAny() : m_set.TryWaitAny();
+  return command ? complete(*command) : nullptr;
+}
+
+// Finish the queued interface request that `command` was sent for
+disk::BlockRequest *Card::complete(Request &command) noexcept {
+  u32 slot = 0;
+  while (static_cast<Request *>(&m_transfer[slot]) != &command) {
+    slot++;
+  }
+
+  disk::BlockRequest &request = *m_slot_request[slot];
+  m_slot_request[slot] = nullptr;
+  m_in_flight--;
+
+  request.result = command.GetError();
+  if (request.op == disk::BlockOp::Read && request.result == 0) {
+    const u32 size = u32(request.count) * SectorSize;
+    void *dma = m_slot_direct[slot] ? request.vectors[0].data
+                                    : m_block_buffers[slot];
+#if defined(PELI_HOST_IOS)
+    util::CpuCache::DcInvalidate(dma, size);
+#endif
+    if (!m_slot_direct[slot]) {
+      const u8 *in = static_cast<const u8 *>(dma);
+      for (u32 i = 0; in != static_cast<const u8 *>(dma) + size; i++) {
+        const size_t left = size_t(static_cast<const u8 *>(dma) + size - in);
+        const size_t chunk =
+            request.vectors[i].size < left ? request.vectors[i].size : left;
+        __builtin_memcpy(request.vectors[i].data, in, chunk);
+        in += chunk;
+      }
+    }
+  }
+
+  if (m_in_flight == 0) {
+    Deselect(m_request);
+    m_selected = false;
+  }
+  return &request;
+}
+
+// Wait for every queued interface transfer, keeping them for Device_Reap()
+void Card::drain() noexcept {
+  while (m_in_flight != 0) {
+    m_done.Push(*complete(*m_set.WaitAny()));
+  }
+}
+
+IOSError Card::issueErase(const EraseRange &range) noexcept {
+  const u32 block_size = Device_GetBlockSize();
+  const size_t last = range.first + range.count - 1;
+
+  // CMD38 erases whatever range the card last latched, so the select and
+  // both ends have to be accepted before it's sent
+  const Command commands[] = {
+      {
+          .cmd = Cmd::SD_CMD32_ERASE_WR_BLK_START,
+          .cmd_type = 3,
+          .response_type = ResponseType::R1,
+          .arg = u32(m_high_capacity ? range.first : range.first * block_size),
+      },
+      {
+          .cmd = Cmd::SD_CMD33_ERASE_WR_BLK_END,
+          .cmd_type = 3,
+          .response_type = ResponseType::R1,
+          .arg = u32(m_high_capacity ? last : last * block_size),
+      },
+  };
+  if (IOSError error = Select(m_request).Sync().GetError()) {
+    Deselect(m_request);
+    return error;
+  }
+  for (const Command &command : commands) {
+    if (IOSError error = SendCommand(m_request, command).Sync().GetError()) {
+      Deselect(m_request);
+      return error;
+    }
+  }
+
+  SendCommand(m_erase_request[0], {
+                                      .cmd = Cmd::SD_CMD38_ERASE,
+                                      .cmd_type = 3,
+                                      .response_type = ResponseType::R1B,
+                                      .arg = 0,
+                                  });
+  Deselect(m_erase_request[1]);
+  m_erase_in_flight = true;
+  return IOSError::SD_ERROR_OK;
+}
+
+IOSError Card::waitErase() noexcept {
+  if (!m_erase_in_flight) {
+    return IOSError::SD_ERROR_OK;
+  }
+  m_erase_in_flight = false;
+
+  IOSError error = IOSError::SD_ERROR_OK;
+  for (BufCommand::Request &request : m_erase_request) {
+    if (IOSError result = request.Sync().GetError(); result && !error) {
+      error = result;
+    }
+  }
+  return error;
+}
+
+bool Card::eraseQueued(size_t first, size_t count) const noexcept {
+  for (u32 i = 0; i < m_erase_count; i++) {
+    const EraseRange &queued = m_erase_queue[i];
+    if (first < queued.first + queued.count && queued.first < first + count) {
+      return true;
+    }
+  }
+  return false;
+}
+
+IOSError Card::Erase(size_t first, size_t count) noexcept {
+  if (count == 0) {
+    return IOSError::SD_ERROR_OK;
+  }
+
+  if (!m_erase_batching) {
+    drain();
+    waitErase();
+    m_request.Sync();
+    if (IOSError error = issueErase({first, count})) {
+      return error;
+    }
+    return waitErase();
+  }
+
+  // Merge with every queued range it overlaps or touches
+  EraseRange range = {first, count};
+  for (u32 i = 0; i < m_erase_count;) {
+    const EraseRange queued = m_erase_queue[i];
+    if (range.first > queued.first + queued.count ||
+        queued.first > range.first + range.count) {
+      i++;
+      continue;
+    }
+
+    const size_t end = range.first + range.count > queued.first + queued.count
+                           ? range.first + range.count
+                           : queued.first + queued.count;
+    range.first = range.first < queued.first ? range.first : queued.first;
+    range.count = end - range.first;
+    m_erase_queue[i] = m_erase_queue[--m_erase_count];
+  }
+
+  IOSError error = IOSError::SD_ERROR_OK;
+  if (m_erase_count == EraseBatch) {
+    error = FlushErase();
+  }
+  m_erase_queue[m_erase_count++] = range;
+  return error;
+}
+
+IOSError Card::FlushErase() noexcept {
+  if (m_erase_count == 0) {
+    return IOSError::SD_ERROR_OK;
+  }
+
+  // One erase in flight at a time, the last one keeps running after return
+  IOSError error = IOSError::SD_ERROR_OK;
+  drain();
+  m_request.Sync();
+  for (u32 i = 0; i < m_erase_count; i++) {
+    if (IOSError result = waitErase(); result && !error) {
+      error = result;
+    }
+    if (IOSError result = issueErase(m_erase_queue[i]); result && !error) {
+      error = result;
+    }
+  }
+  m_erase_count = 0;
+  return error;
+}
+
+void Card::SetEraseBatching(bool enable) noexcept {
+  if (!enable) {
+    FlushErase();
+  }
+  m_erase_batching = enable;
+}
+
 void Card::ReserveBlockBuffer() {
-  m_block_buffer =
-      host::Alloc(DmaBlockSize, MaxTransferSize * Device_GetBlockSize());
+  for (void *&buffer : m_block_buffers) {
+    if (!buffer) {
+      buffer = host::Alloc(DmaBlockSize, MaxTransferSize * SectorSize);
+    }
+  }
 }
 
 } // namespace peli::ios::sdio
\ No newline at end of file
@@ -6,8 +6,11 @@
 
 #pragma once
 
+#include "../../disk/AsyncDeviceTable.hpp"
+#include "../../host/Config.h"
 #include "../../util/Constructor.hpp"
 #include "../Error.hpp"
+#include "../RequestSet.hpp"
 #include "../Resource.hpp"
 #include "Interface.hpp"
 
@@ -15,16 +18,41 @@ namespace peli::ios::sdio {
 
 /**
  * Disk interface for interacting with an SD Card over IOS.
+ *
+ * Transfers are split into commands of up to MaxTransferSize sectors, with two
+ * commands in flight at a time. Aligned buffers are transferred into directly.
+ * Unaligned buffers need ReserveBlockBuffer() to have been called, and are
+ * bounced through two DMA buffers so the copy of one chunk overlaps the
+ * transfer of the next.
+ *
+ * Trimmed blocks are erased with CMD32/33/38, so the card can drop their
+ * contents instead of carrying them through later writes. By default erases
+ * are batched: they are queued, with adjacent and overlapping ranges merged,
+ * and sent when the queue fills, a write touches a queued range, or on flush.
+ * A filesystem freeing a fragmented file then erases it in a few large ranges.
+ * The commands run in the background until the card is next used.
+ *
+ * Through the queued interface, each request is one command and up to
+ * QueueDepth of them are in flight, completing from Device_Reap(). The card
+ * stays selected until the queue drains. Requests that can't be sent straight
+ * to DMA go through the DMA buffer of the command's slot, or are transferred
+ * synchronously if ReserveBlockBuffer() wasn't called. Flush and Trim wait for
+ * the transfers before them.
  */
 class Card : public Resource<Interface>, Interface {
 public:
-  static constexpr u32 SectorSize = 512, MaxTransferSize = 4;
-
-  explicit Card(util::NoConstruct) noexcept : m_request(util::NoConstruct{}) {}
+  static constexpr u32 SectorSize = 512,
+                       MaxTransferSize = PELI_SDIO_TRANSFER_SIZE / SectorSize,
+                       QueueDepth = 2;
+
+  explicit Card(util::NoConstruct) noexcept
+      : m_request(util::NoConstruct{}),
+        m_transfer{util::NoConstruct{}, util::NoConstruct{}},
+        m_erase_request{util::NoConstruct{}, util::NoConstruct{}} {}
   explicit Card(const char *path = Slot0, u32 flags = 0) noexcept
-      : Resource(path, flags) {}
+      : Resource(HandleCache::Shared{}, path, flags) {}
 
-  ~Card() { m_request.Sync(); }
+  ~Card();
 
   // Disk interface
   inline bool Device_Available() const noexcept;
@@ -32,7 +60,36 @@ public:
   static inline size_t Device_GetBlockSize() noexcept { return SectorSize; }
   IOSError Device_BlockTransfer(size_t first, size_t count, void *buffer,
                                 bool is_write) noexcept;
+  IOSError Device_Flush() noexcept { return FlushErase(); }
+  IOSError Device_Trim(size_t first, size_t count) noexcept {
+    return Erase(first, count);
+  }
 
+  // AsyncDeviceTable interface
+  void Device_GetInfo(disk::DeviceInfo &info) noexcept;
+  int Device_Submit(disk::BlockRequest &request) noexcept;
+  disk::BlockRequest *Device_Reap(bool wait) noexcept;
+
+  /**
+   * Erase a range of blocks, or queue it in batching mode.
+   */
+  IOSError Erase(size_t first, size_t count) noexcept;
+
+  /**
+   * Send the queued erases to the card. The last one is left running in the
+   * background.
+   */
+  IOSError FlushErase() noexcept;
+
+  /**
+   * Turn batching mode on or off, on by default. Turning it off sends anything
+   * queued, and each erase is then sent and waited for on its own.
+   */
+  void SetEraseBatching(bool enable) noexcept;
+
+  /**
+   * Allocate the DMA buffers used for unaligned transfers.
+   */
   void ReserveBlockBuffer();
 
   inline BufCommand::Request &SendCommand(BufCommand::Request &request,
@@ -47,11 +104,42 @@ public:
                                           u32 bus_width) noexcept;
 
 private:
-  void *m_block_buffer;
+  static constexpr u32 EraseBatch = PELI_SDIO_ERASE_BATCH;
+
+  struct EraseRange {
+    size_t first;
+    size_t count;
+  };
+
+  disk::BlockRequest *complete(Request &command) noexcept;
+  void drain() noexcept;
 
-  u16 m_relative_card_address;
-  bool m_high_capacity;
+  IOSError issueErase(const EraseRange &range) noexcept;
+  IOSError waitErase() noexcept;
+  bool eraseQueued(size_t first, size_t count) const noexcept;
+
+  void *m_block_buffers[2] = {};
+
+  u16 m_relative_card_address = 0;
+  bool m_high_capacity = false;
   BufCommand::Request m_request;
+  BufCommand::Request m_transfer[QueueDepth];
+
+  // Queued interface requests in flight, by transfer slot
+  disk::BlockRequest *m_slot_request[QueueDepth] = {};
+  bool m_slot_direct[QueueDepth] = {};
+  u32 m_in_flight = 0;
+  bool m_selected = false;
+  RequestSet<QueueDepth> m_set;
+  disk::CompletionQueue m_done;
+
+  // Erase and deselect of the erase in flight
+  BufCommand::Request m_erase_request[2];
+  bool m_erase_in_flight = false;
+
+  bool m_erase_batching = true;
+  u32 m_erase_count = 0;
+  EraseRange m_erase_queue[EraseBatch];
 };
 
 inline bool Card::Device_Available() const noexcept {
@@ -98,7 +186,7 @@ Card::Deselect(BufCommand::Request &request) noexcept {
 inline Interface::BufCommand::Request &
 Card::SetBlockLength(BufCommand::Request &request, u32 block_length) noexcept {
   return SendCommand(request, {
-                                  .cmd = Cmd::SD_CMD7_SELECT,
+                                  .cmd = Cmd::SD_CMD16_BLK_L,
                                   .cmd_type = 3,
                                   .response_type = ResponseType::R1,
                                   .arg = block_length,
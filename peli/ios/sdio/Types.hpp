@@ -32,6 +32,9 @@ enum class Cmd : u32 {
   SD_CMD18_MBLK_RD = 18,
   SD_CMD24_BLK_WR = 24,
   SD_CMD25_MBLK_WR = 25,
+  SD_CMD32_ERASE_WR_BLK_START = 32,
+  SD_CMD33_ERASE_WR_BLK_END = 33,
+  SD_CMD38_ERASE = 38,
   SD_ACMD41_SD_SEND_OP_COND = 41,
   SD_ACMD51_SEND_SCR = 51,
   SD_CMD55_APP_CMD = 55,
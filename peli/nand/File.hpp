@@ -6,11 +6,13 @@
 
 #pragma once
 
+#include "../ios/fs/BufferedFile.hpp"
 #include "../ios/fs/File.hpp"
 
 namespace peli::nand {
 
 using File = ios::fs::File;
+using BufferedFile = ios::fs::BufferedFile;
 using OpenMode = ios::fs::OpenMode;
 
 } // namespace peli::nand
\ No newline at end of file
@@ -0,0 +1,663 @@
+// peli/nand/StdIo.cpp - Newlib device for the NAND file system
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "StdIo.hpp"
+
+#if defined(PELI_NEWLIB)
+
+#include "../host/Host.hpp"
+#include "../ios/Error.hpp"
+#include "../ios/fs/File.hpp"
+#include "../ios/fs/Nand.hpp"
+#include "../util/Address.hpp"
+#include "../util/Constructor.hpp"
+#include "../util/String.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/iosupport.h>
+#include <sys/reent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+namespace peli::nand {
+
+namespace {
+
+using ios::IOSError;
+using ios::fs::Attr;
+using ios::fs::ClusterSize;
+using ios::fs::NodeName;
+using ios::fs::NodeNameSize;
+using ios::fs::OpenMode;
+using ios::fs::Path;
+using ios::fs::PathSize;
+using ios::low::Alignment;
+
+struct FileState {
+  FileState(const char *path, OpenMode mode, bool append) noexcept
+      : file(path, mode), append(append) {}
+
+  ~FileState() noexcept {
+    if (buffer) {
+      host::Free(buffer, ClusterSize);
+    }
+    if (bounce) {
+      host::Free(bounce, ClusterSize);
+    }
+  }
+
+  ios::fs::File file;
+  bool append;
+
+  // stdio buffer from StdIo::SetBuffer()
+  u8 *buffer = nullptr;
+
+  // For transfers to or from unaligned memory
+  u8 *bounce = nullptr;
+};
+
+struct DirState {
+  Path path;
+  char *names;
+  u32 names_size;
+  u32 count;
+  u32 index;
+  const char *next;
+};
+
+int toErrno(s32 error) noexcept {
+  switch (error) {
+  case IOSError::ISFS_ERROR_NOEXISTS:
+  case IOSError::IOS_ERROR_NOEXISTS:
+    return ENOENT;
+  case IOSError::ISFS_ERROR_EXISTS:
+  case IOSError::IOS_ERROR_EXISTS:
+    return EEXIST;
+  case IOSError::ISFS_ERROR_ACCESS:
+  case IOSError::IOS_ERROR_ACCESS:
+    return EACCES;
+  case IOSError::ISFS_ERROR_NOTEMPTY:
+    return ENOTEMPTY;
+  case IOSError::ISFS_ERROR_MAXBLOCKS:
+  case IOSError::ISFS_ERROR_MAXFILES:
+    return ENOSPC;
+  case IOSError::ISFS_ERROR_MAXFD:
+  case IOSError::IOS_ERROR_MAX:
+    return EMFILE;
+  case IOSError::ISFS_ERROR_MAXDEPTH:
+    return ENAMETOOLONG;
+  case IOSError::ISFS_ERROR_OPENFD:
+    return EBUSY;
+  case IOSError::IOS_ERROR_FAIL_ALLOC:
+    return ENOMEM;
+  case IOSError::ISFS_ERROR_INVALID:
+  case IOSError::IOS_ERROR_INVALID:
+    return EINVAL;
+  default:
+    return EIO;
+  }
+}
+
+int fail(struct _reent *r, s32 error) noexcept {
+  r->_errno = toErrno(error);
+  return -1;
+}
+
+// Strip the device name. Returns null if the path is too long for ISFS.
+const char *nandPath(const char *path) noexcept {
+  for (const char *c = path; *c != '\0'; c++) {
+    if (*c == ':') {
+      path = c + 1;
+      break;
+    }
+  }
+  return util::StrLen(path) < PathSize ? path : nullptr;
+}
+
+// ISFS permissions are 1 for read and 2 for write
+u8 toPerm(int mode, int shift) noexcept {
+  return ((mode >> shift) & 4 ? 1 : 0) | ((mode >> shift) & 2 ? 2 : 0);
+}
+
+int fromPerm(u8 perm, int shift) noexcept {
+  return ((perm & 1 ? 4 : 0) | (perm & 2 ? 2 : 0)) << shift;
+}
+
+Attr makeAttr(const char *path, int mode) noexcept {
+  Attr attr = {};
+  util::StrCopy<PathSize>(attr.path, path);
+  attr.perm_owner = toPerm(mode, 6);
+  attr.perm_group = toPerm(mode, 3);
+  attr.perm_other = toPerm(mode, 0);
+  return attr;
+}
+
+// ISFS refuses to list a file, which is the only way to tell the two apart
+IOSError isDir(const ios::fs::Nand &nand, const char *path, bool &is_dir,
+               u32 &count) noexcept {
+  IOSError error = nand.ReadDirCount(path, count);
+  is_dir = error == IOSError::ISFS_ERROR_OK;
+  return error == IOSError::ISFS_ERROR_INVALID ? IOSError::ISFS_ERROR_OK
+                                               : error;
+}
+
+void fillStat(struct stat *st, const Attr &attr, bool is_dir,
+              u32 size) noexcept {
+  *st = {};
+  st->st_mode = (is_dir ? S_IFDIR : S_IFREG) |
+                fromPerm(attr.perm_owner, 6) | fromPerm(attr.perm_group, 3) |
+                fromPerm(attr.perm_other, 0);
+  st->st_nlink = 1;
+  st->st_uid = attr.uid;
+  st->st_gid = attr.gid;
+  st->st_size = size;
+  // stdio sizes its buffer from this
+  st->st_blksize = ClusterSize;
+  st->st_blocks = (size + 511) / 512;
+}
+
+u8 *bounceBuffer(FileState *state) noexcept {
+  if (!state->bounce) {
+    state->bounce = static_cast<u8 *>(host::Alloc(Alignment, ClusterSize));
+  }
+  return state->bounce;
+}
+
+int sysOpen(struct _reent *r, void *file_struct, const char *path, int flags,
+            int mode) {
+  path = nandPath(path);
+  if (!path) {
+    r->_errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  OpenMode open_mode = (flags & O_ACCMODE) == O_RDONLY   ? OpenMode::Read
+                       : (flags & O_ACCMODE) == O_WRONLY ? OpenMode::Write
+                                                         : OpenMode::ReadWrite;
+
+  if (flags & (O_CREAT | O_TRUNC)) {
+    ios::fs::Nand nand;
+    Attr attr;
+    IOSError error = nand.GetAttr(path, attr);
+
+    if (error == IOSError::ISFS_ERROR_OK) {
+      if ((flags & O_CREAT) && (flags & O_EXCL)) {
+        r->_errno = EEXIST;
+        return -1;
+      }
+
+      if ((flags & O_TRUNC) && open_mode != OpenMode::Read) {
+        bool is_dir;
+        u32 count;
+        if (IOSError error = isDir(nand, path, is_dir, count)) {
+          return fail(r, error);
+        }
+        if (is_dir) {
+          r->_errno = EISDIR;
+          return -1;
+        }
+
+        // No truncate in ISFS, so recreate the file with the same attributes
+        util::StrCopy<PathSize>(attr.path, path);
+        if (IOSError error = nand.Delete(path)) {
+          return fail(r, error);
+        }
+        if (IOSError error = nand.CreateFile(attr)) {
+          return fail(r, error);
+        }
+      }
+    } else if (error == IOSError::ISFS_ERROR_NOEXISTS && (flags & O_CREAT)) {
+      if (IOSError error = nand.CreateFile(makeAttr(path, mode))) {
+        return fail(r, error);
+      }
+    } else if (error != IOSError::ISFS_ERROR_NOEXISTS) {
+      return fail(r, error);
+    }
+  }
+
+  FileState *state = static_cast<FileState *>(file_struct);
+  util::Construct(*state, path, open_mode, (flags & O_APPEND) != 0);
+  if (!state->file.IsValid()) {
+    s32 error = state->file.GetHandle();
+    state->~FileState();
+    return fail(r, error);
+  }
+  return 0;
+}
+
+int sysClose([[maybe_unused]] struct _reent *r, void *fd) {
+  static_cast<FileState *>(fd)->~FileState();
+  return 0;
+}
+
+::ssize_t sysRead(struct _reent *r, void *fd, char *ptr, size_t len) {
+  FileState *state = static_cast<FileState *>(fd);
+  size_t done = 0;
+
+  // Aligned memory is transferred into directly, except for a partial cache
+  // line at the end
+  if (util::IsAligned(Alignment, ptr)) {
+    const size_t direct = util::AlignDown(Alignment, len);
+    if (direct != 0) {
+      s32 result = state->file.Read(ptr, s32(direct)).Sync().GetResult();
+      if (result < 0) {
+        return fail(r, result);
+      }
+      done = size_t(result);
+      if (done < direct) {
+        return ::ssize_t(done);
+      }
+    }
+  }
+
+  while (done < len) {
+    u8 *bounce = bounceBuffer(state);
+    if (!bounce) {
+      return done != 0 ? ::ssize_t(done)
+                       : fail(r, IOSError::IOS_ERROR_FAIL_ALLOC);
+    }
+
+    const size_t chunk = len - done < ClusterSize ? len - done : ClusterSize;
+    s32 result = state->file.Read(bounce, s32(chunk)).Sync().GetResult();
+    if (result < 0) {
+      return done != 0 ? ::ssize_t(done) : fail(r, result);
+    }
+    __builtin_memcpy(ptr + done, bounce, size_t(result));
+    done += size_t(result);
+    if (size_t(result) < chunk) {
+      break;
+    }
+  }
+
+  return ::ssize_t(done);
+}
+
+::ssize_t sysWrite(struct _reent *r, void *fd, const char *ptr, size_t len) {
+  FileState *state = static_cast<FileState *>(fd);
+  if (state->append) {
+    s32 result = state->file.Seek(0, SEEK_END).Sync().GetResult();
+    if (result < 0) {
+      return fail(r, result);
+    }
+  }
+
+  size_t done = 0;
+  if (util::IsAligned(Alignment, ptr)) {
+    const size_t direct = util::AlignDown(Alignment, len);
+    if (direct != 0) {
+      s32 result = state->file
+                       .Write(const_cast<char *>(ptr), s32(direct))
+                       .Sync()
+                       .GetResult();
+      if (result < 0) {
+        return fail(r, result);
+      }
+      done = size_t(result);
+      if (done < direct) {
+        return ::ssize_t(done);
+      }
+    }
+  }
+
+  while (done < len) {
+    u8 *bounce = bounceBuffer(state);
+    if (!bounce) {
+      return done != 0 ? ::ssize_t(done)
+                       : fail(r, IOSError::IOS_ERROR_FAIL_ALLOC);
+    }
+
+    const size_t chunk = len - done < ClusterSize ? len - done : ClusterSize;
+    __builtin_memcpy(bounce, ptr + done, chunk);
+    s32 result = state->file.Write(bounce, s32(chunk)).Sync().GetResult();
+    if (result < 0) {
+      return done != 0 ? ::ssize_t(done) : fail(r, result);
+    }
+    done += size_t(result);
+    if (size_t(result) < chunk) {
+      break;
+    }
+  }
+
+  return ::ssize_t(done);
+}
+
+::off_t sysSeek(struct _reent *r, void *fd, ::off_t pos, int dir) {
+  FileState *state = static_cast<FileState *>(fd);
+  s32 result = state->file.Seek(s32(pos), dir).Sync().GetResult();
+  return result < 0 ? fail(r, result) : result;
+}
+
+int sysFstat(struct _reent *r, void *fd, struct stat *st) {
+  FileState *state = static_cast<FileState *>(fd);
+
+  s32 size;
+  if (IOSError error = state->file.GetSize(size)) {
+    return fail(r, error);
+  }
+
+  Attr attr = {};
+  if (state->file.GetPath()[0] != '\0') {
+    ios::fs::Nand().GetAttr(state->file.GetPath(), attr);
+  }
+  fillStat(st, attr, false, u32(size));
+  return 0;
+}
+
+int sysStat(struct _reent *r, const char *path, struct stat *st) {
+  path = nandPath(path);
+  if (!path) {
+    r->_errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  ios::fs::Nand nand;
+  Attr attr;
+  if (IOSError error = nand.GetAttr(path, attr)) {
+    return fail(r, error);
+  }
+
+  bool is_dir;
+  u32 count;
+  if (IOSError error = isDir(nand, path, is_dir, count)) {
+    return fail(r, error);
+  }
+
+  // The size needs an open handle, which may not be permitted
+  s32 size = 0;
+  if (!is_dir) {
+    ios::fs::File file(path, OpenMode::Read);
+    if (file.IsValid() && file.GetSize(size) != IOSError::ISFS_ERROR_OK) {
+      size = 0;
+    }
+  }
+
+  fillStat(st, attr, is_dir, u32(size));
+  return 0;
+}
+
+int sysUnlink(struct _reent *r, const char *name) {
+  const char *path = nandPath(name);
+  if (!path) {
+    r->_errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  ios::fs::Nand nand;
+  bool is_dir;
+  u32 count;
+  if (IOSError error = isDir(nand, path, is_dir, count)) {
+    return fail(r, error);
+  }
+  if (is_dir) {
+    r->_errno = EISDIR;
+    return -1;
+  }
+
+  IOSError error = nand.Delete(path);
+  return error ? fail(r, error) : 0;
+}
+
+int sysRmdir(struct _reent *r, const char *name) {
+  const char *path = nandPath(name);
+  if (!path) {
+    r->_errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  // ISFS deletes directories recursively, so check it's empty first
+  ios::fs::Nand nand;
+  bool is_dir;
+  u32 count;
+  if (IOSError error = isDir(nand, path, is_dir, count)) {
+    return fail(r, error);
+  }
+  if (!is_dir) {
+    r->_errno = ENOTDIR;
+    return -1;
+  }
+  if (count != 0) {
+    r->_errno = ENOTEMPTY;
+    return -1;
+  }
+
+  IOSError error = nand.Delete(path);
+  return error ? fail(r, error) : 0;
+}
+
+int sysRename(struct _reent *r, const char *old_name, const char *new_name) {
+  const char *from = nandPath(old_name);
+  const char *to = nandPath(new_name);
+  if (!from || !to) {
+    r->_errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  IOSError error = ios::fs::Nand().Rename(from, to);
+  return error ? fail(r, error) : 0;
+}
+
+int sysMkdir(struct _reent *r, const char *path, int mode) {
+  path = nandPath(path);
+  if (!path) {
+    r->_errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  IOSError error = ios::fs::Nand().CreateDir(makeAttr(path, mode));
+  return error ? fail(r, error) : 0;
+}
+
+DIR_ITER *sysDirOpen(struct _reent *r, DIR_ITER *dir_state, const char *path) {
+  path = nandPath(path);
+  if (!path) {
+    r->_errno = ENAMETOOLONG;
+    return nullptr;
+  }
+
+  ios::fs::Nand nand;
+  bool is_dir;
+  u32 count;
+  if (IOSError error = isDir(nand, path, is_dir, count)) {
+    fail(r, error);
+    return nullptr;
+  }
+  if (!is_dir) {
+    r->_errno = ENOTDIR;
+    return nullptr;
+  }
+
+  DirState *state = static_cast<DirState *>(dir_state->dirStruct);
+  *state = {};
+  util::StrCopy<PathSize>(state->path, path);
+
+  if (count != 0) {
+    state->names_size = count * NodeNameSize;
+    state->names =
+        static_cast<char *>(host::Alloc(Alignment, state->names_size));
+    if (!state->names) {
+      r->_errno = ENOMEM;
+      return nullptr;
+    }
+
+    u32 total;
+    if (IOSError error = nand.ReadDir(
+            path, count, reinterpret_cast<NodeName *>(state->names), total)) {
+      host::Free(state->names, state->names_size);
+      fail(r, error);
+      return nullptr;
+    }
+    state->count = total < count ? total : count;
+  }
+
+  state->next = state->names;
+  return dir_state;
+}
+
+int sysDirReset([[maybe_unused]] struct _reent *r, DIR_ITER *dir_state) {
+  DirState *state = static_cast<DirState *>(dir_state->dirStruct);
+  state->index = 0;
+  state->next = state->names;
+  return 0;
+}
+
+int sysDirNext(struct _reent *r, DIR_ITER *dir_state, char *filename,
+               struct stat *filestat) {
+  DirState *state = static_cast<DirState *>(dir_state->dirStruct);
+  if (state->index == state->count) {
+    r->_errno = ENOENT;
+    return -1;
+  }
+
+  const char *name = state->next;
+  // StrCopy returns the buffer size when the name had to be truncated
+  size_t length = util::StrCopy<NodeNameSize>(filename, name);
+  state->next += length == NodeNameSize ? length : length + 1;
+  state->index++;
+  length = util::StrLen(static_cast<const char *>(filename));
+
+  if (filestat) {
+    // Only the type is filled in, which is what readdir() needs
+    Path path;
+    const size_t parent_length =
+        util::StrLen(static_cast<const char *>(state->path));
+    if (parent_length + 1 + length >= PathSize) {
+      // Can't be looked up, and the parent's type would be wrong for it. The
+      // entry is consumed so the next call moves on.
+      r->_errno = ENAMETOOLONG;
+      return -1;
+    }
+
+    util::StrCopy<PathSize>(path, state->path);
+    if (parent_length == 0 || path[parent_length - 1] != '/') {
+      path[parent_length] = '/';
+      util::StrCopy<PathSize>(path + parent_length + 1, filename);
+    } else {
+      util::StrCopy<PathSize>(path + parent_length, filename);
+    }
+
+    bool is_dir = false;
+    u32 count;
+    isDir(ios::fs::Nand(), path, is_dir, count);
+    *filestat = {};
+    filestat->st_mode = is_dir ? S_IFDIR : S_IFREG;
+  }
+  return 0;
+}
+
+int sysDirClose([[maybe_unused]] struct _reent *r, DIR_ITER *dir_state) {
+  DirState *state = static_cast<DirState *>(dir_state->dirStruct);
+  if (state->names) {
+    host::Free(state->names, state->names_size);
+    state->names = nullptr;
+  }
+  return 0;
+}
+
+int sysStatVfs(struct _reent *r, [[maybe_unused]] const char *path,
+               struct statvfs *buf) {
+  ios::fs::Stats stats;
+  if (IOSError error = ios::fs::Nand().GetStats(stats)) {
+    return fail(r, error);
+  }
+
+  *buf = {};
+  buf->f_bsize = stats.cluster_size;
+  buf->f_frsize = stats.cluster_size;
+  buf->f_blocks = stats.free_clusters + stats.used_clusters;
+  buf->f_bfree = stats.free_clusters;
+  buf->f_bavail = stats.free_clusters;
+  buf->f_files = stats.free_inodes + stats.used_inodes;
+  buf->f_ffree = stats.free_inodes;
+  buf->f_favail = stats.free_inodes;
+  buf->f_flag = ST_NOSUID;
+  buf->f_namemax = NodeNameSize - 1;
+  return 0;
+}
+
+// Writes are not buffered below stdio
+int sysFsync([[maybe_unused]] struct _reent *r, [[maybe_unused]] void *fd) {
+  return 0;
+}
+
+constinit const devoptab_t s_devoptab = {
+    .name = "nand",
+    .structSize = sizeof(FileState),
+    .open_r = sysOpen,
+    .close_r = sysClose,
+    .write_r = sysWrite,
+    .read_r = sysRead,
+    .seek_r = sysSeek,
+    .fstat_r = sysFstat,
+    .stat_r = sysStat,
+    .link_r = nullptr,
+    .unlink_r = sysUnlink,
+    .chdir_r = nullptr,
+    .rename_r = sysRename,
+    .mkdir_r = sysMkdir,
+    .dirStateSize = sizeof(DirState),
+    .diropen_r = sysDirOpen,
+    .dirreset_r = sysDirReset,
+    .dirnext_r = sysDirNext,
+    .dirclose_r = sysDirClose,
+    .statvfs_r = sysStatVfs,
+    .ftruncate_r = nullptr,
+    .fsync_r = sysFsync,
+    .deviceData = nullptr,
+    .chmod_r = nullptr,
+    .fchmod_r = nullptr,
+    .rmdir_r = sysRmdir,
+    .lstat_r = sysStat,
+    .utimes_r = nullptr,
+    .fpathconf_r = nullptr,
+    .pathconf_r = nullptr,
+    .symlink_r = nullptr,
+    .readlink_r = nullptr,
+};
+
+} // namespace
+
+bool StdIo::Register() noexcept {
+  if (::FindDevice("nand:") >= 0) {
+    return true;
+  }
+  return ::AddDevice(&s_devoptab) >= 0;
+}
+
+void StdIo::Deregister() noexcept { ::RemoveDevice("nand:"); }
+
+FILE *StdIo::Open(const char *path, const char *mode) noexcept {
+  FILE *file = ::fopen(path, mode);
+  if (file) {
+    SetBuffer(file);
+  }
+  return file;
+}
+
+bool StdIo::SetBuffer(FILE *file) noexcept {
+  if (!file) {
+    return false;
+  }
+
+  __handle *handle = ::__get_handle(::fileno(file));
+  if (!handle || devoptab_list[handle->device] != &s_devoptab) {
+    return false;
+  }
+
+  FileState *state = static_cast<FileState *>(handle->fileStruct);
+  if (!state->buffer) {
+    state->buffer = static_cast<u8 *>(host::Alloc(Alignment, ClusterSize));
+    if (!state->buffer) {
+      return false;
+    }
+  }
+
+  return ::setvbuf(file, reinterpret_cast<char *>(state->buffer), _IOFBF,
+                   ClusterSize) == 0;
+}
+
+} // namespace peli::nand
+
+#endif // PELI_NEWLIB
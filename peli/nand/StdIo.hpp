@@ -0,0 +1,51 @@
+// peli/nand/StdIo.hpp - Newlib device for the NAND file system
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../host/Config.h"
+
+#if defined(PELI_NEWLIB)
+
+#include "../cmn/Types.hpp"
+#include <stdio.h>
+
+namespace peli::nand {
+
+/**
+ * Registers "nand:" as a newlib device, so the C file API can reach the NAND
+ * file system, e.g. fopen("nand:/shared2/sys/SYSCONF", "rb").
+ *
+ * ISFS only accepts 32-byte aligned buffers, so reads and writes through
+ * unaligned memory go through a bounce buffer. stdio's own buffer is allocated
+ * with malloc and usually isn't aligned, so open files with Open() (or call
+ * SetBuffer() after fopen()) to give stdio an aligned buffer of one NAND
+ * cluster, which IOS can then transfer into directly.
+ *
+ * ISFS has no way to truncate a file, so O_TRUNC deletes and recreates it with
+ * the same attributes, and ftruncate() is not supported.
+ */
+class StdIo {
+public:
+  static bool Register() noexcept;
+  static void Deregister() noexcept;
+
+  /**
+   * fopen() followed by SetBuffer().
+   */
+  static FILE *Open(const char *path, const char *mode) noexcept;
+
+  /**
+   * Give a file opened on the "nand:" device an aligned, cluster sized stdio
+   * buffer. Must be called before the first read or write. The buffer is freed
+   * when the file is closed.
+   */
+  static bool SetBuffer(FILE *file) noexcept;
+};
+
+} // namespace peli::nand
+
+#endif // PELI_NEWLIB
@@ -6,6 +6,7 @@
 
 #include "SysConf.hpp"
 #include "../../host/Mutex.hpp"
+#include "../../ios/HandleCache.hpp"
 #include "../../ios/fs/Types.hpp"
 #include "../../util/Address.hpp"
 #include "../../util/Defer.hpp"
@@ -20,7 +21,8 @@ SysConf &GetSysConf() noexcept {
 }
 
 SysConf::SysConf(const char *path) noexcept : m_state(State::Error) {
-  s32 fd = ios::low::IOS_Open(path, static_cast<u32>(ios::fs::OpenMode::Read));
+  s32 fd = ios::HandleCache::Acquire(
+      path, static_cast<u32>(ios::fs::OpenMode::Read));
   if (fd < 0) {
     return;
   }
@@ -45,7 +47,11 @@ host::Mutex *SysConf::lock() noexcept {
 
   if (m_state == State::Invalid) {
     m_state = State::Error;
-    if (m_request.Sync().GetResult() != Size) {
+    const bool read_ok = m_request.Sync().GetResult() == Size;
+
+    // The whole file is read up front, so the handle can go back to the cache
+    ios::HandleCache::Release(m_request.GetFd());
+    if (!read_ok) {
       return nullptr;
     }
 
@@ -82,6 +82,14 @@ u8 *Arena::AllocFromMem2Hi(size_t size, size_t align) {
   return ptr;
 }
 
+void Arena::FreeToMem2Hi(u8 *ptr, size_t size) {
+  ppc::Msr::NoInterruptsScope nis;
+
+  if (ptr == Mem2End && ptr + size <= ld::__mem2_arena_end) {
+    Mem2End = ptr + size;
+  }
+}
+
 u8 *Arena::SbrkAlloc(size_t size) {
   ppc::Msr::NoInterruptsScope nis;
 
@@ -24,6 +24,12 @@ public:
   static u8 *AllocFromMem2Lo(size_t size, size_t align);
   static u8 *AllocFromMem2Hi(size_t size, size_t align);
 
+  /**
+   * Give back an allocation from AllocFromMem2Hi. Only does anything if it was
+   * the most recent one still held.
+   */
+  static void FreeToMem2Hi(u8 *ptr, size_t size);
+
   static u8 *SbrkAlloc(size_t size);
   static u8 *SbrkFree(size_t size);
 };
@@ -0,0 +1,143 @@
+// peli/rt/RealTimeClock.cpp - Console real-time clock
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include "RealTimeClock.hpp"
+#include "../host/Host.hpp"
+#include "../hw/ExternalInterface.hpp"
+#include "../ios/fs/File.hpp"
+#include "../ppc/Msr.hpp"
+#include "../util/Defer.hpp"
+
+namespace peli::rt {
+
+namespace {
+
+// The RTC sits on EXI channel 0, device 1, along with the SRAM
+constexpr u32 RtcChannel = 0;
+constexpr u32 RtcDevice = 1;
+constexpr u32 RtcClock = 3; // 8 MHz
+constexpr u32 RtcReadCommand = 0x20000000;
+
+constexpr const char *ConfPath = "/shared2/sys/SYSCONF";
+constexpr u32 ConfSize = 0x4000;
+constexpr u8 ConfTypeLong = 5;
+
+enum class Bias : u8 {
+  Unread,
+  Valid,
+  Unavailable,
+};
+
+constinit Bias s_bias_state = Bias::Unread;
+constinit s32 s_bias = 0;
+
+// 4 byte immediate transfer on the selected device
+u32 exiTransfer(hw::ExternalInterface::Channel &channel, u32 data,
+                bool is_write) noexcept {
+  channel.DATA = data;
+  channel.CR = hw::ExternalInterface::Cr{
+      .TLEN = 3,
+      .RW = is_write ? 1u : 0u,
+      .TSTART = 1,
+  };
+  while (channel.CR.TSTART) {
+  }
+  return channel.DATA;
+}
+
+u32 readCounter() noexcept {
+  hw::ExternalInterface::Channel &channel = hw::EXI->CHANNEL[RtcChannel];
+  ppc::Msr::NoInterruptsScope guard;
+
+  // Interrupt status bits are cleared by writing 1, so leave them at 0
+  channel.CSR <=> [](hw::ExternalInterface::Csr csr) {
+    csr.EXTINT = 0;
+    csr.TCINT = 0;
+    csr.EXIINT = 0;
+    csr.CS = 1 << RtcDevice;
+    csr.CLK = RtcClock;
+    return csr;
+  };
+
+  exiTransfer(channel, RtcReadCommand, true);
+  const u32 counter = exiTransfer(channel, 0, false);
+
+  channel.CSR <=> [](hw::ExternalInterface::Csr csr) {
+    csr.EXTINT = 0;
+    csr.TCINT = 0;
+    csr.EXIINT = 0;
+    csr.CS = 0;
+    return csr;
+  };
+  return counter;
+}
+
+u32 readBigEndian(const u8 *data, u32 size) noexcept {
+  u32 value = 0;
+  for (u32 i = 0; i < size; i++) {
+    value = value << 8 | data[i];
+  }
+  return value;
+}
+
+// Find IPL.CB in SYSCONF. Each item is a type and name length byte, the name,
+// then the value.
+bool readBias(s32 &bias) noexcept {
+  ios::fs::File file(ConfPath, ios::fs::OpenMode::Read);
+  if (!file.IsValid()) {
+    return false;
+  }
+
+  u8 *conf = static_cast<u8 *>(host::Alloc(32, ConfSize));
+  if (!conf) {
+    return false;
+  }
+  auto defer_free = util::Defer([&]() { host::Free(conf, ConfSize); });
+
+  if (file.Read(conf, ConfSize).Sync().GetResult() != s32(ConfSize) ||
+      __builtin_memcmp(conf, "SCv0", 4) != 0) {
+    return false;
+  }
+
+  const u32 count = readBigEndian(conf + 4, 2);
+  for (u32 i = 0; i < count && 6 + i * 2 + 2 <= ConfSize; i++) {
+    const u32 offset = readBigEndian(conf + 6 + i * 2, 2);
+    if (offset + 1 + 6 + 4 > ConfSize) {
+      continue;
+    }
+
+    const u8 type = conf[offset] >> 5;
+    const u32 name_length = (conf[offset] & 0x1F) + 1u;
+    if (type == ConfTypeLong && name_length == 6 &&
+        __builtin_memcmp(conf + offset + 1, "IPL.CB", 6) == 0) {
+      bias = s32(readBigEndian(conf + offset + 1 + 6, 4));
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+s64 GetRealTime() noexcept {
+  if (s_bias_state == Bias::Unread) {
+    // Not retried, this is called on every FatFs timestamp
+    s_bias_state = readBias(s_bias) ? Bias::Valid : Bias::Unavailable;
+  }
+  if (s_bias_state != Bias::Valid) {
+    return -1;
+  }
+
+  // Read until two agree, in case the counter ticked mid-transfer
+  u32 counter = readCounter();
+  for (u32 previous = ~counter; counter != previous;) {
+    previous = counter;
+    counter = readCounter();
+  }
+  return s64(counter) + s_bias;
+}
+
+} // namespace peli::rt
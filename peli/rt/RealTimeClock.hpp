@@ -0,0 +1,20 @@
+// peli/rt/RealTimeClock.hpp - Console real-time clock
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "../cmn/Types.hpp"
+
+namespace peli::rt {
+
+/**
+ * Current local time in seconds since 2000-01-01 00:00, or -1 if it can't be
+ * read. This is the RTC counter plus the counter bias the System Menu keeps in
+ * SYSCONF (IPL.CB), which is read from the NAND on the first call.
+ */
+s64 GetRealTime() noexcept;
+
+} // namespace peli::rt
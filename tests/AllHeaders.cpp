@@ -6,6 +6,11 @@
 
 #include <peli/cmn/Macro.h>
 #include <peli/cmn/Types.hpp>
+#include <peli/disk/AsyncDeviceTable.hpp>
+#include <peli/disk/BlockCache.hpp>
+#include <peli/disk/Mem2.hpp>
+#include <peli/disk/RamDisk.hpp>
+#include <peli/disk/Scheduler.hpp>
 #include <peli/host/Config.h>
 #include <peli/host/Host.hpp>
 #include <peli/host/MessageQueue.hpp>
@@ -21,19 +26,25 @@
 #include <peli/hw/VideoInterface.hpp>
 #include <peli/hw/Wood.hpp>
 #include <peli/ios/Error.hpp>
+#include <peli/ios/HandleCache.hpp>
 #include <peli/ios/Interface.hpp>
 #include <peli/ios/LoMem.hpp>
 #include <peli/ios/Reply.hpp>
 #include <peli/ios/Request.hpp>
+#include <peli/ios/RequestSet.hpp>
 #include <peli/ios/Resource.hpp>
 #include <peli/ios/di/Types.hpp>
 #include <peli/ios/es/Types.hpp>
+#include <peli/ios/fs/BufferedFile.hpp>
 #include <peli/ios/fs/File.hpp>
 #include <peli/ios/fs/Interface.hpp>
+#include <peli/ios/fs/MetaCache.hpp>
 #include <peli/ios/fs/Nand.hpp>
+#include <peli/ios/fs/TreeWalker.hpp>
 #include <peli/ios/fs/Types.hpp>
 #include <peli/ios/iosc/Types.hpp>
 #include <peli/ios/low/Ipc.hpp>
+#include <peli/ios/low/Loopback.hpp>
 #include <peli/ios/net/ip/top/Types.hpp>
 #include <peli/ios/sdio/Card.hpp>
 #include <peli/ios/sdio/HcReg.hpp>
@@ -42,6 +53,7 @@
 #include <peli/ios/sdio/Types.hpp>
 #include <peli/nand/File.hpp>
 #include <peli/nand/Nand.hpp>
+#include <peli/nand/StdIo.hpp>
 #include <peli/nand/conf/Bt.hpp>
 #include <peli/nand/conf/Dev.hpp>
 #include <peli/nand/conf/Dvd.hpp>
@@ -0,0 +1,297 @@
+// peli/tests/DirIndex.cpp - FatFs directory index against a linear scan
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include <cstdlib>
+#include <peli/disk/BlockCache.hpp>
+#include <peli/disk/RamDisk.hpp>
+#include <peli/fat/FatFs.hpp>
+#include <peli/fat/IO.hpp>
+#include <peli/host/Host.hpp>
+#include <peli/log/VideoConsole.hpp>
+#include <peli/log/VideoConsoleStdOut.hpp>
+
+namespace {
+
+using peli::u32;
+using peli::u8;
+
+namespace fat = peli::fat;
+
+constexpr u32 DiskBlocks = 0x4800;
+constexpr u32 WorkSize = 0x10000;
+
+// Well past PELI_FAT_DIR_INDEX_MIN, so lookups in the directory go through the
+// index. Every third file has only a short name.
+constexpr u32 FileCount = 600;
+
+enum class State : u8 {
+  Gone,
+  Original,
+  Renamed,
+};
+
+struct Model {
+  const char *label;
+  State state[FileCount];
+  u32 tag[FileCount];
+  char path[96];
+  char other[96];
+};
+
+const char *originalPath(Model &m, u32 i) {
+  if (i % 3 == 0) {
+    std::snprintf(m.path, sizeof(m.path), "0:/big/F%04u.TXT", i);
+  } else {
+    std::snprintf(m.path, sizeof(m.path), "0:/big/Long file name %04u.dat",
+                  i);
+  }
+  return m.path;
+}
+
+const char *renamedPath(Model &m, u32 i) {
+  std::snprintf(m.path, sizeof(m.path), "0:/big/Renamed entry %04u.bin", i);
+  return m.path;
+}
+
+const char *currentPath(Model &m, u32 i) {
+  return m.state[i] == State::Renamed ? renamedPath(m, i) : originalPath(m, i);
+}
+
+bool check(Model &m, const char *what, fat::FRESULT result,
+           fat::FRESULT expect = fat::FR_OK) {
+  if (result != expect) {
+    std::printf("%s: %s %s returned %d, expected %d\n", m.label, what, m.path,
+                int(result), int(expect));
+    return false;
+  }
+  return true;
+}
+
+bool create(Model &m, u32 i, u32 tag) {
+  fat::FIL file;
+  fat::UINT written;
+  if (!check(m, "create",
+             fat::f_open(&file, originalPath(m, i),
+                         FA_CREATE_NEW | FA_WRITE)) ||
+      !check(m, "write", fat::f_write(&file, &tag, sizeof(tag), &written)) ||
+      !check(m, "close", fat::f_close(&file))) {
+    return false;
+  }
+  m.state[i] = State::Original;
+  m.tag[i] = tag;
+  return true;
+}
+
+// Look up every name the model knows, present or not, through the index
+bool checkLookups(Model &m) {
+  for (u32 i = 0; i < FileCount; i++) {
+    fat::FILINFO info;
+    if (m.state[i] != State::Original &&
+        !check(m, "stat", fat::f_stat(originalPath(m, i), &info),
+               fat::FR_NO_FILE)) {
+      return false;
+    }
+    if (m.state[i] != State::Renamed &&
+        !check(m, "stat", fat::f_stat(renamedPath(m, i), &info),
+               fat::FR_NO_FILE)) {
+      return false;
+    }
+    if (m.state[i] == State::Gone) {
+      continue;
+    }
+
+    fat::FIL file;
+    fat::UINT read;
+    u32 tag = ~0u;
+    if (!check(m, "open", fat::f_open(&file, currentPath(m, i), FA_READ)) ||
+        !check(m, "read", fat::f_read(&file, &tag, sizeof(tag), &read)) ||
+        !check(m, "close", fat::f_close(&file))) {
+      return false;
+    }
+    if (tag != m.tag[i]) {
+      std::printf("%s: %s holds %u, expected %u\n", m.label, m.path, tag,
+                  m.tag[i]);
+      return false;
+    }
+
+    // Names compare without regard to case
+    for (char *c = m.path; *c != '\0'; c++) {
+      if (*c >= 'a' && *c <= 'z') {
+        *c = char(*c - 'a' + 'A');
+      }
+    }
+    if (!check(m, "stat", fat::f_stat(m.path, &info))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Walk the directory in order and look each entry up again by both of its
+// names. The results must match what the scan found, and the scan must find
+// exactly what the model expects.
+bool checkScan(Model &m) {
+  u32 expected = 0;
+  for (u32 i = 0; i < FileCount; i++) {
+    expected += m.state[i] != State::Gone;
+  }
+
+  fat::DIR dir;
+  fat::FILINFO entry, info;
+  u32 entries = 0;
+  std::snprintf(m.path, sizeof(m.path), "0:/big");
+  if (!check(m, "opendir", fat::f_opendir(&dir, m.path))) {
+    return false;
+  }
+  for (;;) {
+    if (!check(m, "readdir", fat::f_readdir(&dir, &entry))) {
+      return false;
+    }
+    if (entry.fname[0] == '\0') {
+      break;
+    }
+    entries++;
+
+    const char *names[] = {entry.fname, entry.altname};
+    for (const char *name : names) {
+      if (name[0] == '\0') {
+        continue;
+      }
+      std::snprintf(m.path, sizeof(m.path), "0:/big/%s", name);
+      if (!check(m, "stat", fat::f_stat(m.path, &info))) {
+        return false;
+      }
+      // A lookup by the short name reports that name back in fname
+      const bool by_fname = name == entry.fname;
+      if (info.fsize != entry.fsize || info.fattrib != entry.fattrib ||
+          __builtin_strcmp(info.altname, entry.altname) != 0 ||
+          (by_fname && __builtin_strcmp(info.fname, entry.fname) != 0)) {
+        std::printf("%s: %s found %s, the scan found %s\n", m.label, m.path,
+                    info.altname, entry.altname);
+        return false;
+      }
+    }
+  }
+  if (!check(m, "closedir", fat::f_closedir(&dir))) {
+    return false;
+  }
+
+  if (entries != expected) {
+    std::printf("%s: the scan found %u entries, expected %u\n", m.label,
+                entries, expected);
+    return false;
+  }
+  return true;
+}
+
+bool verify(Model &m, const char *phase) {
+  if (!checkLookups(m) || !checkScan(m)) {
+    std::printf("%s: %s failed\n", m.label, phase);
+    return false;
+  }
+  std::printf("%s: %s ok\n", m.label, phase);
+  return true;
+}
+
+bool renameEntry(Model &m, u32 i, State to) {
+  std::snprintf(m.other, sizeof(m.other), "%s", currentPath(m, i));
+  const char *target =
+      to == State::Renamed ? renamedPath(m, i) : originalPath(m, i);
+  if (!check(m, "rename", fat::f_rename(m.other, target))) {
+    return false;
+  }
+  m.state[i] = to;
+  return true;
+}
+
+bool run(const char *label, fat::BYTE format, u8 *work) {
+  static fat::FATFS fs;
+  static Model m;
+  m = {};
+  m.label = label;
+
+  const fat::MKFS_PARM options = {fat::BYTE(format | FM_SFD), 0, 0, 0, 0};
+  std::snprintf(m.path, sizeof(m.path), "0:");
+  if (!check(m, "mkfs", fat::f_mkfs("0:", &options, work, WorkSize)) ||
+      !check(m, "mount", fat::f_mount(&fs, "0:", 1))) {
+    return false;
+  }
+
+  bool success = true;
+  std::snprintf(m.path, sizeof(m.path), "0:/big");
+  success = check(m, "mkdir", fat::f_mkdir(m.path));
+
+  for (u32 i = 0; success && i < FileCount; i++) {
+    success = create(m, i, i);
+  }
+  success = success && verify(m, "create");
+
+#if FF_USE_LFN == 3 && PELI_FAT_DIR_INDEX_COUNT > 0
+  if (success) {
+    bool indexed = false;
+    for (auto *index : fs.didx) {
+      indexed = indexed || index != nullptr;
+    }
+    if (!indexed) {
+      std::printf("%s: the directory was not indexed\n", label);
+      success = false;
+    }
+  }
+#endif
+
+  // Remove and rename entries through the index
+  for (u32 i = 0; success && i < FileCount; i++) {
+    if (i % 4 == 0) {
+      success = check(m, "unlink", fat::f_unlink(originalPath(m, i)));
+      m.state[i] = State::Gone;
+    } else if (i % 4 == 1) {
+      success = renameEntry(m, i, State::Renamed);
+    }
+  }
+  success = success && verify(m, "unlink and rename");
+
+  // Fill the freed slots with new files and move some names back
+  for (u32 i = 0; success && i < FileCount; i++) {
+    if (i % 8 == 0) {
+      success = create(m, i, FileCount + i);
+    } else if (i % 8 == 1) {
+      success = renameEntry(m, i, State::Original);
+    }
+  }
+  success = success && verify(m, "recreate");
+
+  fat::f_unmount("0:");
+  return success;
+}
+
+} // namespace
+
+int main() {
+  peli::log::VideoConsole console(false);
+
+  console.Print("\nMeow! Directory index test:\n");
+
+  // Register the console as stdout
+  peli::log::VideoConsoleStdOut::Register(console);
+
+  u8 *work = static_cast<u8 *>(peli::host::Alloc(32, WorkSize));
+  peli::disk::RamDisk ram_disk(DiskBlocks);
+  if (!work || !ram_disk.IsValid()) {
+    std::printf("Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  peli::disk::BlockCache cache(ram_disk);
+  fat::Disk::Register(0, cache);
+  const bool success =
+      run("fat", FM_FAT | FM_FAT32, work) && run("exfat", FM_EXFAT, work);
+  fat::Disk::Deregister(0);
+
+  peli::host::Free(work, WorkSize);
+  std::printf(success ? "All tests passed\n" : "Test failed\n");
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,446 @@
+// peli/tests/DiskBench.cpp - Block device throughput across the disk layers
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include <cstdlib>
+#include <peli/disk/AsyncDeviceTable.hpp>
+#include <peli/disk/BlockCache.hpp>
+#include <peli/disk/DeviceTable.hpp>
+#include <peli/disk/RamDisk.hpp>
+#include <peli/disk/Scheduler.hpp>
+#include <peli/fat/FatFs.hpp>
+#include <peli/fat/IO.hpp>
+#include <peli/fat/PrefetchReader.hpp>
+#include <peli/fat/StreamWriter.hpp>
+#include <peli/host/Host.hpp>
+#include <peli/ios/sdio/Card.hpp>
+#include <peli/log/VideoConsole.hpp>
+#include <peli/log/VideoConsoleStdOut.hpp>
+#include <peli/util/Time.hpp>
+
+namespace {
+
+using peli::u32;
+using peli::u64;
+using peli::u8;
+
+namespace fat = peli::fat;
+
+// Tests run over 8 MiB starting 1 MiB in, past the partition table. Writes put
+// back what was read from the region beforehand, so contents are preserved.
+constexpr u32 BlockSize = 512;
+constexpr u32 RegionBase = 0x800;
+constexpr u32 RegionBlocks = 0x4000;
+
+constexpr u32 RandomOps = 1024;
+constexpr u32 RandomBlocks = 4096 / BlockSize;
+constexpr u32 StreamBlocks = 0x800;
+
+constexpr u32 TransferSizes[] = {1, 8, 64, 256};
+
+// FatFs tests work in a directory of their own, removed afterwards
+constexpr u32 FileCount = 64;
+constexpr u32 FileChunk = 0x10000;
+constexpr u32 FileSize = 0x400000;
+
+struct Bench {
+  const char *device;
+  const char *layer;
+  peli::disk::DeviceTable table;
+
+  // Flush for layers that hold writes back
+  void *object;
+  int (*flush)(void *object);
+
+  const u8 *shadow;
+  u8 *buffer;
+};
+
+u64 elapsedUs(u64 start) {
+  return (peli::util::GetTime() - start) /
+         (peli::util::BusClock / 4 / 1000000);
+}
+
+void report(const Bench &bench, const char *test, u32 blocks_per_op, u32 ops,
+            u64 us) {
+  const u64 bytes = u64(ops) * blocks_per_op * BlockSize;
+  std::printf("%s,%s,%s,%u,%u,%llu,%llu,%llu\n", bench.device, bench.layer,
+              test, blocks_per_op, ops, us,
+              us != 0 ? u64(ops) * 1000000 / us : 0,
+              us != 0 ? bytes * 1000000 / 1024 / us : 0);
+}
+
+int transfer(Bench &bench, u32 block, u32 count, bool is_write) {
+  void *data = is_write
+                   ? const_cast<u8 *>(bench.shadow +
+                                      (block - RegionBase) * BlockSize)
+                   : bench.buffer;
+  return bench.table.m_block_transfer(bench.table.m_object, block, count, data,
+                                      is_write);
+}
+
+int flush(Bench &bench) {
+  return bench.flush ? bench.flush(bench.object) : 0;
+}
+
+bool sequential(Bench &bench, const char *test, u32 per_op, bool is_write) {
+  const u64 start = peli::util::GetTime();
+  u32 ops = 0;
+  for (u32 i = 0; i + per_op <= RegionBlocks; i += per_op, ops++) {
+    if (int error = transfer(bench, RegionBase + i, per_op, is_write)) {
+      std::printf("# %s %s failed at block %u: %d\n", bench.layer, test,
+                  RegionBase + i, error);
+      return false;
+    }
+  }
+  if (int error = is_write ? flush(bench) : 0) {
+    std::printf("# %s %s flush failed: %d\n", bench.layer, test, error);
+    return false;
+  }
+
+  report(bench, test, per_op, ops, elapsedUs(start));
+  return true;
+}
+
+bool randomAccess(Bench &bench, const char *test, bool is_write) {
+  // xorshift32 with a fixed seed, so every run hits the same blocks
+  u32 state = 0x1234567;
+  const u64 start = peli::util::GetTime();
+  for (u32 i = 0; i < RandomOps; i++) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    const u32 block =
+        RegionBase + state % (RegionBlocks / RandomBlocks) * RandomBlocks;
+    if (int error = transfer(bench, block, RandomBlocks, is_write)) {
+      std::printf("# %s %s failed at block %u: %d\n", bench.layer, test, block,
+                  error);
+      return false;
+    }
+  }
+  if (int error = is_write ? flush(bench) : 0) {
+    std::printf("# %s %s flush failed: %d\n", bench.layer, test, error);
+    return false;
+  }
+
+  report(bench, test, RandomBlocks, RandomOps, elapsedUs(start));
+  return true;
+}
+
+bool run(Bench &bench) {
+  for (u32 size : TransferSizes) {
+    if (!sequential(bench, "seq_read", size, false) ||
+        !sequential(bench, "seq_write", size, true)) {
+      return false;
+    }
+  }
+
+  return randomAccess(bench, "rand_read_4k", false) &&
+         randomAccess(bench, "rand_write_4k", true) &&
+         sequential(bench, "stream_read", StreamBlocks, false) &&
+         sequential(bench, "stream_write", StreamBlocks, true);
+}
+
+// Run the suite on the device directly and through each layer above it
+bool runLayers(const char *name, const peli::disk::AsyncDeviceTable &device,
+               u8 *shadow, u8 *buffer) {
+  peli::disk::AsyncDeviceTable raw = device;
+  if (int error = raw.Device_BlockTransfer(RegionBase, RegionBlocks, shadow,
+                                           false)) {
+    std::printf("# %s: reading the test region failed: %d\n", name, error);
+    return false;
+  }
+
+  Bench bench = {
+      .device = name,
+      .layer = "raw",
+      .table = raw,
+      .object = nullptr,
+      .flush = nullptr,
+      .shadow = shadow,
+      .buffer = buffer,
+  };
+  if (!run(bench)) {
+    return false;
+  }
+
+  // The layers set themselves up on first use, the device is already
+  // initialized
+  peli::disk::Scheduler scheduler(device);
+  bench.layer = "scheduler";
+  bench.table = scheduler;
+  bench.object = &scheduler;
+  bench.flush = [](void *object) {
+    return static_cast<peli::disk::Scheduler *>(object)->Flush();
+  };
+  if (!run(bench)) {
+    return false;
+  }
+
+  const auto &sched = scheduler.GetStats();
+  std::printf("# %s scheduler: %u writes, %u device writes, %u bypassed, "
+              "%u absorbed\n",
+              name, sched.writes, sched.writebacks, sched.bypass_writes,
+              sched.absorbed_blocks);
+
+  peli::disk::BlockCache cache(device);
+  bench.layer = "cache";
+  bench.table = cache;
+  bench.object = &cache;
+  bench.flush = [](void *object) {
+    return static_cast<peli::disk::BlockCache *>(object)->Flush();
+  };
+  if (!run(bench)) {
+    return false;
+  }
+
+  const auto &stats = cache.GetStats();
+  std::printf("# %s cache: %u/%u read hits, %u/%u read-ahead hits\n", name,
+              stats.read_hits, stats.read_hits + stats.read_misses,
+              stats.read_ahead_hits, stats.read_ahead_blocks);
+  return true;
+}
+
+void reportFat(const char *device, const char *test, u32 ops, u32 bytes,
+               u64 us) {
+  std::printf("%s,fatfs,%s,%u,%u,%llu,%llu,%llu\n", device, test,
+              bytes / ops / BlockSize, ops, us,
+              us != 0 ? u64(ops) * 1000000 / us : 0,
+              us != 0 ? u64(bytes) * 1000000 / 1024 / us : 0);
+}
+
+bool fatCheck(const char *device, const char *what, fat::FRESULT result) {
+  if (result != fat::FR_OK) {
+    std::printf("# %s fatfs %s failed: %d\n", device, what, int(result));
+    return false;
+  }
+  return true;
+}
+
+// Create, open, stat, list and delete small files, then stream a large one.
+// `drive` is the FatFs drive prefix, e.g. "0:".
+bool runFat(const char *device, const char *drive, bool format, u8 *buffer) {
+  static fat::FATFS fs;
+  char path[64];
+
+  if (format) {
+    const fat::MKFS_PARM options = {FM_ANY | FM_SFD, 0, 0, 0, 0};
+    if (!fatCheck(device, "mkfs",
+                  fat::f_mkfs(drive, &options, buffer,
+                              StreamBlocks * BlockSize))) {
+      return false;
+    }
+  }
+
+  if (!fatCheck(device, "mount", fat::f_mount(&fs, drive, 1))) {
+    return false;
+  }
+
+  std::snprintf(path, sizeof(path), "%s/peli-bench", drive);
+  fat::f_mkdir(path);
+
+  auto filePath = [&](u32 i) {
+    std::snprintf(path, sizeof(path), "%s/peli-bench/file%03u", drive, i);
+    return path;
+  };
+
+  bool success = true;
+  fat::FIL file;
+  fat::FILINFO info;
+
+  u64 start = peli::util::GetTime();
+  for (u32 i = 0; success && i < FileCount; i++) {
+    success = fatCheck(device, "create",
+                       fat::f_open(&file, filePath(i),
+                                   FA_CREATE_ALWAYS | FA_WRITE)) &&
+              fatCheck(device, "close", fat::f_close(&file));
+  }
+  if (success) {
+    reportFat(device, "create", FileCount, 0, elapsedUs(start));
+  }
+
+  start = peli::util::GetTime();
+  for (u32 i = 0; success && i < FileCount; i++) {
+    success = fatCheck(device, "open",
+                       fat::f_open(&file, filePath(i), FA_READ)) &&
+              fatCheck(device, "close", fat::f_close(&file));
+  }
+  if (success) {
+    reportFat(device, "open", FileCount, 0, elapsedUs(start));
+  }
+
+  start = peli::util::GetTime();
+  for (u32 i = 0; success && i < FileCount; i++) {
+    success = fatCheck(device, "stat", fat::f_stat(filePath(i), &info));
+  }
+  if (success) {
+    reportFat(device, "stat", FileCount, 0, elapsedUs(start));
+  }
+
+  if (success) {
+    fat::DIR dir;
+    u32 entries = 0;
+    std::snprintf(path, sizeof(path), "%s/peli-bench", drive);
+    start = peli::util::GetTime();
+    success = fatCheck(device, "opendir", fat::f_opendir(&dir, path));
+    while (success) {
+      success = fatCheck(device, "readdir", fat::f_readdir(&dir, &info));
+      if (!success || info.fname[0] == '\0') {
+        break;
+      }
+      entries++;
+    }
+    success = success && fatCheck(device, "closedir", fat::f_closedir(&dir));
+    if (success) {
+      reportFat(device, "readdir", entries, 0, elapsedUs(start));
+    }
+  }
+
+  // Large file streaming
+  std::snprintf(path, sizeof(path), "%s/peli-bench/stream", drive);
+  if (success) {
+    const fat::DWORD fat_writes = fs.fc_writes;
+    start = peli::util::GetTime();
+    success = fatCheck(device, "open",
+                       fat::f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE));
+    for (u32 offset = 0; success && offset < FileSize; offset += FileChunk) {
+      fat::UINT written;
+      success = fatCheck(device, "write",
+                         fat::f_write(&file, buffer, FileChunk, &written));
+    }
+    success = success && fatCheck(device, "close", fat::f_close(&file));
+    if (success) {
+      reportFat(device, "stream_write", FileSize / FileChunk, FileSize,
+                elapsedUs(start));
+      std::printf("# %s fatfs stream_write: %u FAT writes\n", device,
+                  fs.fc_writes - fat_writes);
+    }
+  }
+
+  if (success) {
+    start = peli::util::GetTime();
+    success = fatCheck(device, "open", fat::f_open(&file, path, FA_READ));
+    for (u32 offset = 0; success && offset < FileSize; offset += FileChunk) {
+      fat::UINT read;
+      success = fatCheck(device, "read",
+                         fat::f_read(&file, buffer, FileChunk, &read));
+    }
+    success = success && fatCheck(device, "close", fat::f_close(&file));
+    if (success) {
+      reportFat(device, "stream_read", FileSize / FileChunk, FileSize,
+                elapsedUs(start));
+    }
+  }
+
+  // The same through a PrefetchReader, which reads ahead on its own thread
+  if (success) {
+    fat::PrefetchReader reader;
+    start = peli::util::GetTime();
+    success = fatCheck(device, "open", reader.Open(path));
+    for (u32 offset = 0; success && offset < FileSize; offset += FileChunk) {
+      fat::UINT read;
+      success = fatCheck(device, "read", reader.Read(buffer, FileChunk, &read));
+    }
+    success = success && fatCheck(device, "close", reader.Close());
+    if (success) {
+      reportFat(device, "stream_prefetch", FileSize / FileChunk, FileSize,
+                elapsedUs(start));
+    }
+  }
+
+  // Sustained write through a StreamWriter, into a preallocated file
+  if (success) {
+    fat::StreamWriter writer;
+    const fat::DWORD fat_writes = fs.fc_writes;
+    start = peli::util::GetTime();
+    success = fatCheck(device, "open", writer.Open(path, FileSize));
+    for (u32 offset = 0; success && offset < FileSize; offset += FileChunk) {
+      success = fatCheck(device, "write", writer.Write(buffer, FileChunk));
+    }
+    success = success && fatCheck(device, "close", writer.Close());
+    if (success) {
+      reportFat(device, "stream_writer", FileSize / FileChunk, FileSize,
+                elapsedUs(start));
+      std::printf("# %s fatfs stream_writer: %u FAT writes, %s\n", device,
+                  fs.fc_writes - fat_writes,
+                  writer.GetStats().reserved ? "contiguous" : "not reserved");
+    }
+  }
+
+  // Clean up even after a failure
+  fat::f_unlink(path);
+  start = peli::util::GetTime();
+  for (u32 i = 0; i < FileCount; i++) {
+    fat::f_unlink(filePath(i));
+  }
+  if (success) {
+    reportFat(device, "unlink", FileCount, 0, elapsedUs(start));
+  }
+  std::snprintf(path, sizeof(path), "%s/peli-bench", drive);
+  fat::f_unlink(path);
+
+  fat::f_unmount(drive);
+  return success;
+}
+
+} // namespace
+
+int main() {
+  peli::log::VideoConsole console(false);
+
+  console.Print("\nMeow! Disk benchmark:\n");
+
+  // Register the console as stdout
+  peli::log::VideoConsoleStdOut::Register(console);
+
+  constexpr u32 BufferSize = StreamBlocks * BlockSize;
+  constexpr u32 ShadowSize = RegionBlocks * BlockSize;
+  u8 *buffer = static_cast<u8 *>(peli::host::Alloc(32, BufferSize));
+  u8 *shadow = static_cast<u8 *>(peli::host::Alloc(32, ShadowSize));
+  if (!buffer || !shadow) {
+    std::printf("Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  std::printf("device,layer,test,blocks_per_op,ops,us,iops,kib_per_s\n");
+
+  bool success = true;
+
+  {
+    peli::disk::RamDisk ram_disk(RegionBase + RegionBlocks);
+    if (ram_disk.IsValid()) {
+      success = runLayers("ram", ram_disk, shadow, buffer);
+
+      // FatFs through the cache, on a freshly formatted disk
+      peli::disk::BlockCache cache(ram_disk);
+      fat::Disk::Register(0, cache);
+      success = success && runFat("ram", "0:", true, buffer);
+      fat::Disk::Deregister(0);
+    } else {
+      std::printf("# ram: out of memory\n");
+    }
+  }
+
+  // The card's own queued interface, with two commands in flight
+  peli::ios::sdio::Card card;
+  if (success && card.Device_Available() && card.Device_Init() == 0) {
+    card.ReserveBlockBuffer();
+    success = runLayers("sd", card, shadow, buffer);
+
+    // FatFs through the cache, on the card's existing filesystem
+    peli::disk::BlockCache cache(card);
+    fat::Disk::Register(1, cache);
+    success = success && runFat("sd", "1:", false, buffer);
+    fat::Disk::Deregister(1);
+  } else if (success) {
+    std::printf("# sd: unavailable\n");
+  }
+
+  peli::host::Free(shadow, ShadowSize);
+  peli::host::Free(buffer, BufferSize);
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,210 @@
+// peli/tests/IosLoopback.cpp - Benchmark the IPC stack against the loopback
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+//
+// Usage: IosLoopback <nand root> [sd image] [latency us] [latency us per KiB]
+
+#include <cstdio>
+#include <cstdlib>
+#include <peli/host/Config.h>
+
+#if defined(PELI_IOS_LOOPBACK)
+
+#include <peli/disk/DeviceTable.hpp>
+#include <peli/ios/fs/File.hpp>
+#include <peli/ios/fs/Nand.hpp>
+#include <peli/ios/fs/TreeWalker.hpp>
+#include <peli/ios/low/Loopback.hpp>
+#include <peli/ios/sdio/Card.hpp>
+#include <peli/log/VideoConsole.hpp>
+#include <peli/log/VideoConsoleStdOut.hpp>
+#include <peli/nand/conf/SysConf.hpp>
+#include <peli/util/String.hpp>
+#include <peli/util/Time.hpp>
+
+namespace {
+
+constexpr peli::u32 ChunkSize = 0x8000;
+constexpr peli::u32 TotalSize = 0x100000;
+constexpr const char *FilePath = "/tmp/loopback.bin";
+
+alignas(32) peli::u8 s_buffer[ChunkSize];
+
+peli::u64 elapsedUs(peli::u64 start) {
+  return (peli::util::GetTime() - start) /
+         (peli::util::BusClock / 4 / 1000000);
+}
+
+// CSV so results can be collected and compared between runs
+void report(const char *name, peli::u64 us, peli::u64 bytes) {
+  std::printf("%s,%llu,%llu,%llu\n", name, us, bytes,
+              us != 0 ? bytes * 1000000 / 1024 / us : 0);
+}
+
+bool benchNand() {
+  peli::ios::fs::Nand nand;
+  if (!nand.IsValid()) {
+    std::printf("# /dev/fs open failed: %d\n", nand.GetHandle());
+    return false;
+  }
+
+  nand.Delete(FilePath);
+  peli::ios::fs::Attr attr = {};
+  peli::util::StrCopy<peli::ios::fs::PathSize>(attr.path, FilePath);
+  attr.perm_owner = attr.perm_group = 3;
+  if (peli::ios::IOSError error = nand.CreateFile(attr)) {
+    std::printf("# CreateFile failed: %d\n", error);
+    return false;
+  }
+
+  peli::ios::fs::File file(FilePath, peli::ios::fs::OpenMode::ReadWrite);
+  if (!file.IsValid()) {
+    std::printf("# Open failed: %d\n", file.GetHandle());
+    return false;
+  }
+
+  peli::u64 start = peli::util::GetTime();
+  for (peli::u32 i = 0; i < TotalSize / ChunkSize; i++) {
+    if (file.Write(s_buffer, ChunkSize).Sync().GetResult() !=
+        peli::s32(ChunkSize)) {
+      std::printf("# Write failed at chunk %u\n", i);
+      return false;
+    }
+  }
+  report("nand_write", elapsedUs(start), TotalSize);
+
+  file.Seek(0, 0).Sync();
+
+  start = peli::util::GetTime();
+  for (peli::u32 i = 0; i < TotalSize / ChunkSize; i++) {
+    if (file.Read(s_buffer, ChunkSize).Sync().GetResult() !=
+        peli::s32(ChunkSize)) {
+      std::printf("# Read failed at chunk %u\n", i);
+      return false;
+    }
+  }
+  report("nand_read", elapsedUs(start), TotalSize);
+
+  start = peli::util::GetTime();
+  peli::ios::fs::FileStats stats;
+  for (peli::u32 i = 0; i < 256; i++) {
+    file.GetFileStats(stats);
+  }
+  report("nand_file_stats_x256", elapsedUs(start), 0);
+
+  start = peli::util::GetTime();
+  peli::ios::fs::Attr file_attr;
+  for (peli::u32 i = 0; i < 256; i++) {
+    nand.GetAttr(FilePath, file_attr);
+  }
+  report("nand_get_attr_x256", elapsedUs(start), 0);
+
+  peli::u32 entries = 0;
+  start = peli::util::GetTime();
+  peli::ios::fs::TreeWalker walker(nand);
+  peli::ios::IOSError error = walker.Walk(
+      "/",
+      [](const peli::ios::fs::TreeWalker::Entry &, void *arg) {
+        ++*static_cast<peli::u32 *>(arg);
+        return peli::ios::fs::TreeWalker::Action::Continue;
+      },
+      &entries);
+  report("nand_walk", elapsedUs(start), 0);
+  std::printf("# walked %u entries: %d\n", entries, error);
+
+  return true;
+}
+
+bool benchSysConf() {
+  peli::u64 start = peli::util::GetTime();
+  auto &conf = peli::nand::conf::GetSysConf();
+  report("sysconf_load", elapsedUs(start), 0);
+
+  std::printf("# SYSCONF entries: %u\n", conf.GetCount());
+  return true;
+}
+
+bool benchSd() {
+  peli::ios::sdio::Card card;
+  peli::disk::DeviceTable table = card;
+
+  if (!table.m_available(table.m_object)) {
+    std::printf("# SD card unavailable\n");
+    return false;
+  }
+  if (int error = table.m_init(table.m_object)) {
+    std::printf("# SD init failed: %d\n", error);
+    return false;
+  }
+
+  card.ReserveBlockBuffer();
+
+  constexpr peli::u32 SectorSize = peli::ios::sdio::Card::SectorSize;
+  peli::u64 start = peli::util::GetTime();
+  for (peli::u32 i = 0; i < TotalSize / SectorSize; i++) {
+    if (int error =
+            table.m_block_transfer(table.m_object, i, 1, s_buffer, false)) {
+      std::printf("# SD read failed at sector %u: %d\n", i, error);
+      return false;
+    }
+  }
+  report("sd_read_single", elapsedUs(start), TotalSize);
+
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  peli::log::VideoConsole console(false);
+
+  console.Print("\nMeow! IOS loopback benchmark:\n");
+
+  // Register the console as stdout
+  peli::log::VideoConsoleStdOut::Register(console);
+
+  if (argc < 2) {
+    std::printf(
+        "Usage: %s <nand root> [sd image] [latency us] [latency us per KiB]\n",
+        argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const peli::ios::low::Loopback::Config config = {
+      .nand_root = argv[1],
+      .sd_image = argc > 2 ? argv[2] : nullptr,
+      .latency_us = argc > 3 ? peli::u32(std::atoi(argv[3])) : 0,
+      .latency_per_kib_us = argc > 4 ? peli::u32(std::atoi(argv[4])) : 0,
+  };
+
+  if (!peli::ios::low::Loopback::Install(config)) {
+    std::printf("Loopback install failed\n");
+    return EXIT_FAILURE;
+  }
+
+  std::printf("test,us,bytes,kib_per_s\n");
+
+  bool success = benchNand();
+  success = benchSysConf() && success;
+  if (config.sd_image) {
+    success = benchSd() && success;
+  }
+
+  auto stats = peli::ios::low::Loopback::GetStats();
+  std::printf("# requests: %u, read: %llu, written: %llu\n", stats.requests,
+              stats.bytes_read, stats.bytes_written);
+
+  peli::ios::low::Loopback::Uninstall();
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else
+
+int main() {
+  std::printf("Built without PELI_IOS_LOOPBACK\n");
+  return EXIT_FAILURE;
+}
+
+#endif // PELI_IOS_LOOPBACK
@@ -0,0 +1,90 @@
+// peli/tests/SDCardBench.cpp - Sequential SD card read throughput
+//   Written by mkwcat
+//
+// Copyright (c) 2025 mkwcat
+// SPDX-License-Identifier: MIT
+
+#include <cstdio>
+#include <cstdlib>
+#include <peli/disk/DeviceTable.hpp>
+#include <peli/host/Host.hpp>
+#include <peli/ios/sdio/Card.hpp>
+#include <peli/log/VideoConsole.hpp>
+#include <peli/log/VideoConsoleStdOut.hpp>
+#include <peli/util/Time.hpp>
+
+namespace {
+
+constexpr peli::u32 SectorSize = peli::ios::sdio::Card::SectorSize;
+constexpr peli::u32 TotalSectors = 0x800000 / SectorSize;
+
+peli::u64 elapsedUs(peli::u64 start) {
+  return (peli::util::GetTime() - start) /
+         (peli::util::BusClock / 4 / 1000000);
+}
+
+// Read the first TotalSectors sectors, `per_call` sectors at a time
+bool bench(peli::disk::DeviceTable &table, const char *name,
+           peli::u32 per_call, peli::u8 *buffer) {
+  peli::u64 start = peli::util::GetTime();
+  for (peli::u32 i = 0; i < TotalSectors; i += per_call) {
+    if (int error = table.m_block_transfer(table.m_object, i, per_call,
+                                           buffer, false)) {
+      std::printf("# %s failed at sector %u: %d\n", name, i, error);
+      return false;
+    }
+  }
+
+  peli::u64 us = elapsedUs(start);
+  peli::u64 bytes = peli::u64(TotalSectors) * SectorSize;
+  std::printf("%s,%u,%llu,%llu\n", name, per_call, us,
+              us != 0 ? bytes * 1000000 / 1024 / us : 0);
+  return true;
+}
+
+} // namespace
+
+int main() {
+  peli::log::VideoConsole console(false);
+
+  console.Print("\nMeow! SD Card benchmark:\n");
+
+  // Register the console as stdout
+  peli::log::VideoConsoleStdOut::Register(console);
+
+  peli::ios::sdio::Card card;
+  peli::disk::DeviceTable table = card;
+
+  if (!table.m_available(table.m_object)) {
+    std::printf("Disk unavailable\n");
+    return EXIT_FAILURE;
+  }
+
+  if (int error = table.m_init(table.m_object)) {
+    std::printf("Disk_Init() failed: %d\n", error);
+    return EXIT_FAILURE;
+  }
+
+  card.ReserveBlockBuffer();
+
+  constexpr peli::u32 MaxSectors = peli::ios::sdio::Card::MaxTransferSize * 4;
+  peli::u8 *buffer = static_cast<peli::u8 *>(
+      peli::host::Alloc(32, MaxSectors * SectorSize + 32));
+  if (!buffer) {
+    std::printf("Out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  std::printf("test,sectors_per_call,us,kib_per_s\n");
+
+  // 4 sectors per call matches the old per-command limit
+  bool success = bench(table, "aligned", 1, buffer) &&
+                 bench(table, "aligned", 4, buffer) &&
+                 bench(table, "aligned", 64, buffer) &&
+                 bench(table, "aligned", MaxSectors, buffer) &&
+                 bench(table, "unaligned", 4, buffer + 4) &&
+                 bench(table, "unaligned", MaxSectors, buffer + 4);
+
+  peli::host::Free(buffer, MaxSectors * SectorSize + 32);
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}